@@ -0,0 +1,279 @@
+/* Copyright (c) 2013-2018 Ardexa Pty Ltd. All rights reserved.
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+#include <stdio.h>
+#include <math.h>
+#include <sstream>
+#include "aggregator.hpp"
+#include "utils.hpp"
+
+/* Constructor for the sample_ring class */
+sample_ring::sample_ring()
+{
+    this->head = 0;
+    this->count = 0;
+}
+
+/* Double the buffer, keeping the samples in order */
+void sample_ring::grow()
+{
+    vector<timed_sample_t> bigger(this->buffer.empty() ? AGGREGATE_RING_SIZE : this->buffer.size() * 2);
+    for (size_t i = 0; i < this->count; i++) {
+        bigger[i] = this->buffer[(this->head + i) & (this->buffer.size() - 1)];
+    }
+    this->buffer.swap(bigger);
+    this->head = 0;
+}
+
+void sample_ring::push_back(const timed_sample_t &sample)
+{
+    if (this->count == this->buffer.size()) {
+        this->grow();
+    }
+    this->buffer[(this->head + this->count) & (this->buffer.size() - 1)] = sample;
+    this->count++;
+}
+
+void sample_ring::pop_front()
+{
+    this->head = (this->head + 1) & (this->buffer.size() - 1);
+    this->count--;
+}
+
+void sample_ring::pop_back()
+{
+    this->count--;
+}
+
+const timed_sample_t &sample_ring::front()
+{
+    return this->buffer[this->head];
+}
+
+const timed_sample_t &sample_ring::back()
+{
+    return this->buffer[(this->head + this->count - 1) & (this->buffer.size() - 1)];
+}
+
+size_t sample_ring::size()
+{
+    return this->count;
+}
+
+bool sample_ring::empty()
+{
+    return (this->count == 0);
+}
+
+/* Constructor for the rolling_series class */
+rolling_series::rolling_series()
+{
+    this->sum = 0.0;
+}
+
+/* Add a sample. Samples must be added in time order */
+void rolling_series::add(int64_t time_ms, double value)
+{
+    timed_sample_t sample = {time_ms, value};
+
+    this->samples.push_back(sample);
+    this->sum += value;
+
+    /* A sample can never be the minimum (or maximum) once a smaller (or larger) one has come after it */
+    while ((not this->minimums.empty()) and (this->minimums.back().value >= value)) this->minimums.pop_back();
+    this->minimums.push_back(sample);
+    while ((not this->maximums.empty()) and (this->maximums.back().value <= value)) this->maximums.pop_back();
+    this->maximums.push_back(sample);
+}
+
+/* Drop the samples taken before 'oldest_ms' */
+void rolling_series::expire(int64_t oldest_ms)
+{
+    while ((not this->samples.empty()) and (this->samples.front().time_ms < oldest_ms)) {
+        this->sum -= this->samples.front().value;
+        this->samples.pop_front();
+    }
+    while ((not this->minimums.empty()) and (this->minimums.front().time_ms < oldest_ms)) this->minimums.pop_front();
+    while ((not this->maximums.empty()) and (this->maximums.front().time_ms < oldest_ms)) this->maximums.pop_front();
+
+    /* Start the sum again when the window empties, so rounding errors can't build up */
+    if (this->samples.empty()) this->sum = 0.0;
+}
+
+size_t rolling_series::count()
+{
+    return this->samples.size();
+}
+
+double rolling_series::total()
+{
+    return this->sum;
+}
+
+/* These return ERROR_VALUE_FLOAT if there are no samples in the window */
+double rolling_series::mean()
+{
+    return this->samples.empty() ? ERROR_VALUE_FLOAT : this->sum / this->samples.size();
+}
+
+double rolling_series::minimum()
+{
+    return this->minimums.empty() ? ERROR_VALUE_FLOAT : this->minimums.front().value;
+}
+
+double rolling_series::maximum()
+{
+    return this->maximums.empty() ? ERROR_VALUE_FLOAT : this->maximums.front().value;
+}
+
+double rolling_series::first()
+{
+    return this->samples.empty() ? ERROR_VALUE_FLOAT : this->samples.front().value;
+}
+
+double rolling_series::last()
+{
+    return this->samples.empty() ? ERROR_VALUE_FLOAT : this->samples.back().value;
+}
+
+/* Check a decoded value isn't the error value */
+static bool valid(float value)
+{
+    return (value != (float) ERROR_VALUE_FLOAT);
+}
+
+/* Drop the samples that are older than the window */
+static void expire_window(aggregate_window_t &window, int64_t time_ms)
+{
+    int64_t oldest_ms = time_ms - window.span_ms;
+
+    window.packets.expire(oldest_ms);
+    window.outside_temperature.expire(oldest_ms);
+    window.outside_humidity.expire(oldest_ms);
+    window.wind_speed.expire(oldest_ms);
+    window.wind_east.expire(oldest_ms);
+    window.wind_north.expire(oldest_ms);
+    window.rain.expire(oldest_ms);
+    window.barometer.expire(oldest_ms);
+}
+
+/* Constructor for the aggregator class */
+aggregator::aggregator(const vector<int> &window_minutes, bool wdspd_kmh)
+{
+    this->wdspd_kmh = wdspd_kmh;
+    this->last_time_ms = 0;
+    this->window_list.resize(window_minutes.size());
+    for (size_t i = 0; i < window_minutes.size(); i++) {
+        this->window_list[i].minutes = window_minutes[i];
+        this->window_list[i].span_ms = (int64_t) window_minutes[i] * 60000;
+    }
+}
+
+/* Add a decoded LOOP packet, received at 'time_ms' on the monotonic clock */
+void aggregator::add(const davis_data_t &davis_data, int64_t time_ms)
+{
+    /* The rain is a rate (mm/hr), so the rain that fell is the rate over the time since the last packet. After a
+       long gap the rate in between isn't known, so only AGGREGATE_MAX_GAP_MS of it is counted */
+    bool have_rain = valid(davis_data.rain) and (this->last_time_ms > 0);
+    double rain = 0.0;
+    if (have_rain) {
+        int64_t gap_ms = min(time_ms - this->last_time_ms, (int64_t) AGGREGATE_MAX_GAP_MS);
+        rain = davis_data.rain * (double) gap_ms / 3600000.0;
+    }
+    this->last_time_ms = time_ms;
+
+    /* The wind direction is averaged as a unit vector, so 350 and 10 degrees average to 0 (not 180) */
+    bool have_direction = valid(davis_data.wind_direction);
+    double east = 0.0, north = 0.0;
+    if (have_direction) {
+        east = sin(davis_data.wind_direction * M_PI / 180.0);
+        north = cos(davis_data.wind_direction * M_PI / 180.0);
+    }
+
+    for (size_t i = 0; i < this->window_list.size(); i++) {
+        aggregate_window_t &window = this->window_list[i];
+        expire_window(window, time_ms);
+        window.packets.add(time_ms, 1.0);
+        if (valid(davis_data.outside_temperature)) window.outside_temperature.add(time_ms, davis_data.outside_temperature);
+        if (valid(davis_data.outside_humidity)) window.outside_humidity.add(time_ms, davis_data.outside_humidity);
+        if (valid(davis_data.wind_speed)) window.wind_speed.add(time_ms, davis_data.wind_speed);
+        if (have_direction) {
+            window.wind_east.add(time_ms, east);
+            window.wind_north.add(time_ms, north);
+        }
+        if (have_rain) window.rain.add(time_ms, rain);
+        if (valid(davis_data.barometer)) window.barometer.add(time_ms, davis_data.barometer);
+    }
+}
+
+size_t aggregator::windows()
+{
+    return this->window_list.size();
+}
+
+/* The header line of the aggregate logs */
+string aggregator::header()
+{
+    string speed = this->wdspd_kmh ? "km/h" : "m/s";
+    return "# DateTime,Window (minutes),Packets,Outside Temperature Min (celsius),Outside Temperature Max (celsius),"
+           "Outside Temperature Mean (celsius),Outside Humidity Mean (percent),Wind Speed Mean (" + speed + "),"
+           "Wind Gust (" + speed + "),Wind Direction Mean (degrees),Rain (mm),Barometer Mean (hectopascals),"
+           "Barometer Change (hectopascals)";
+}
+
+/* Write the CSV line (without a newline) for one window, ending at 'time_ms', into 'buffer'. Statistics with no
+   samples in the window are error values. Returns the length of the line, or 0 if it doesn't fit */
+size_t aggregator::format(char *buffer, size_t size, size_t window_index, const char *datetime, int64_t time_ms)
+{
+    aggregate_window_t &window = this->window_list[window_index];
+    expire_window(window, time_ms);
+
+    double direction = ERROR_VALUE_FLOAT;
+    if (window.wind_east.count() > 0) {
+        direction = atan2(window.wind_east.mean(), window.wind_north.mean()) * 180.0 / M_PI;
+        if (direction < 0.0) direction += 360.0;
+    }
+    double rain = (window.rain.count() > 0) ? window.rain.total() : ERROR_VALUE_FLOAT;
+    double change = ERROR_VALUE_FLOAT;
+    if (window.barometer.count() > 0) {
+        change = window.barometer.last() - window.barometer.first();
+    }
+
+    int length = snprintf(buffer, size, "%s,%d,%zu,%.2f,%.2f,%.2f,%.2f,%.2f,%.2f,%.2f,%.2f,%.2f,%.2f", datetime,
+                          window.minutes, window.packets.count(), window.outside_temperature.minimum(),
+                          window.outside_temperature.maximum(), window.outside_temperature.mean(),
+                          window.outside_humidity.mean(), window.wind_speed.mean(), window.wind_speed.maximum(),
+                          direction, rain, window.barometer.mean(), change);
+    if ((length < 0) or ((size_t) length >= size)) {
+        return 0;
+    }
+    return length;
+}
+
+/* Parse a list of window lengths in minutes, such as "1,10,60". Returns false if it isn't valid */
+bool parse_window_minutes(string raw, vector<int> &window_minutes)
+{
+    istringstream tokens(raw);
+    string token;
+    long minutes;
+
+    window_minutes.clear();
+    while (getline(tokens, token, ',')) {
+        if ((not convert_long(trim_whitespace(token), &minutes)) or (minutes < 1) or (minutes > AGGREGATE_MAX_MINUTES)) {
+            return false;
+        }
+        window_minutes.push_back((int) minutes);
+    }
+    return (not window_minutes.empty());
+}
@@ -0,0 +1,117 @@
+/* Copyright (c) 2013-2018 Ardexa Pty Ltd. All rights reserved.
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+#ifndef AGGREGATOR_HPP_INCLUDED
+#define AGGREGATOR_HPP_INCLUDED
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <stddef.h>
+#include "configs.hpp"
+
+using namespace std;
+
+/* A sample of one series, and when it was taken (on the monotonic clock) */
+typedef struct timed_sample_s {
+    int64_t time_ms;
+    double value;
+} timed_sample_t;
+
+/* A double-ended queue of samples, in a circular buffer. It only grows (doubling) until it holds a whole window,
+   so once the windows are full nothing is allocated. The size is always a power of 2, so indexes wrap with a mask */
+class sample_ring
+{
+    public:
+        /* methods are public */
+        sample_ring();
+        void push_back(const timed_sample_t &sample);
+        void pop_front();
+        void pop_back();
+        const timed_sample_t &front();
+        const timed_sample_t &back();
+        size_t size();
+        bool empty();
+
+    private:
+        /* members are private */
+        void grow();
+        vector<timed_sample_t> buffer;
+        size_t head;
+        size_t count;
+};
+
+/* The samples of one series over the last 'span_ms'. The sum is kept as samples are added and dropped, and the
+   minimum and maximum are the fronts of monotonic queues, so each sample costs O(1) (amortized) */
+class rolling_series
+{
+    public:
+        /* methods are public */
+        rolling_series();
+        void add(int64_t time_ms, double value);
+        void expire(int64_t oldest_ms);
+        size_t count();
+        double total();
+        double mean();
+        double minimum();
+        double maximum();
+        double first();
+        double last();
+
+    private:
+        /* members are private */
+        sample_ring samples;
+        sample_ring minimums;
+        sample_ring maximums;
+        double sum;
+};
+
+/* The statistics for one window length */
+typedef struct aggregate_window_s {
+    int minutes;
+    int64_t span_ms;
+    rolling_series packets;
+    rolling_series outside_temperature;
+    rolling_series outside_humidity;
+    rolling_series wind_speed;
+    rolling_series wind_east;
+    rolling_series wind_north;
+    rolling_series rain;
+    rolling_series barometer;
+} aggregate_window_t;
+
+/* This class keeps rolling statistics of every LOOP packet, over one or more windows (such as the last 1, 10 and 60
+   minutes): the min, max and mean outside temperature, the mean humidity, the mean wind speed and the peak gust,
+   the vector averaged wind direction, the rain that fell and the change in the barometer. Each packet is added to
+   every window in O(1), so nothing but the statistics needs to be logged */
+class aggregator
+{
+    public:
+        /* methods are public */
+        aggregator(const vector<int> &window_minutes, bool wdspd_kmh);
+        void add(const davis_data_t &davis_data, int64_t time_ms);
+        size_t windows();
+        size_t format(char *buffer, size_t size, size_t window, const char *datetime, int64_t time_ms);
+        string header();
+
+    private:
+        /* members are private */
+        vector<aggregate_window_t> window_list;
+        bool wdspd_kmh;
+        int64_t last_time_ms;
+};
+
+bool parse_window_minutes(string raw, vector<int> &window_minutes);
+
+#endif /* AGGREGATOR_HPP_INCLUDED */
@@ -0,0 +1,292 @@
+/* Copyright (c) 2013-2018 Ardexa Pty Ltd. All rights reserved.
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "archive.hpp"
+#include "log_writer.hpp"
+
+/* Convert the archive time given on the command line, in the format "2017-01-30T15:30" (local time).
+   "all" will download the whole archive */
+bool parse_archive_time(string archive_time, struct tm *since)
+{
+    memset(since, 0, sizeof(struct tm));
+    if (archive_time == "all") {
+        return true;
+    }
+
+    const char *end = strptime(archive_time.c_str(), "%Y-%m-%dT%H:%M", since);
+    if ((end == NULL) or (*end != '\0') or (since->tm_year < 100)) {
+        return false;
+    }
+    return true;
+}
+
+/* Read 2 bytes, least significant first */
+static unsigned int archive_u16(const unsigned char *record, int offset)
+{
+    return (record[offset + 1] << 8) | record[offset];
+}
+
+/* Read a signed 2 byte temperature (in F / 10) and convert it to Celsius */
+static float archive_temperature(const unsigned char *record, int offset)
+{
+    short raw = (short) archive_u16(record, offset);
+    if ((raw == 32767) or (raw == -32768)) {
+        return ERROR_VALUE_FLOAT;
+    }
+
+    float celsius = ((raw / 10.0) - 32.0) * 5/9;
+    if ((celsius < -80.0) || (celsius > 100.0)) {
+        return ERROR_VALUE_FLOAT;
+    }
+    return celsius;
+}
+
+/* Read a single byte soil temperature (in F + 90) and convert it to Celsius */
+static float archive_soil_temperature(const unsigned char *record, int offset)
+{
+    if (record[offset] == 255) {
+        return ERROR_VALUE_FLOAT;
+    }
+    return (((float) record[offset] - 90) - 32.0) * 5/9;
+}
+
+/* Read a single byte value, where 255 is dashed */
+static float archive_byte(const unsigned char *record, int offset)
+{
+    if (record[offset] == 255) {
+        return ERROR_VALUE_FLOAT;
+    }
+    return (float) record[offset];
+}
+
+/* Decode a 52 byte Rev B archive record into the davis_data struct, and the time it was written into 'stamp'.
+   Returns false if the record is empty (all 0xFF), or isn't a Rev B record */
+bool decode_archive_record(const unsigned char *record, davis_data_t *davis_data, struct tm *stamp, bool wdspd_kmh, float barocal, bool winddir_180)
+{
+    unsigned int date_stamp = archive_u16(record, 0);
+    unsigned int time_stamp = archive_u16(record, 2);
+
+    if ((date_stamp == 0xFFFF) or (date_stamp == 0) or (record[42] != 0x00)) {
+        return false;
+    }
+
+    /* The date is: day + month*32 + (year - 2000)*512, and the time is: (hour * 100) + minute */
+    memset(stamp, 0, sizeof(struct tm));
+    stamp->tm_mday = date_stamp & 0x1F;
+    stamp->tm_mon = ((date_stamp >> 5) & 0x0F) - 1;
+    stamp->tm_year = (date_stamp >> 9) + 100;
+    stamp->tm_hour = time_stamp / 100;
+    stamp->tm_min = time_stamp % 100;
+    stamp->tm_isdst = -1;
+
+    clear_davis_data(davis_data);
+
+    davis_data->outside_temperature = archive_temperature(record, 4);
+    davis_data->inside_temperature = archive_temperature(record, 20);
+
+    /* Number of rain clicks over the archive period. Use the same scaling as the LOOP packets */
+    davis_data->rain = archive_u16(record, 10) * 0.25;
+
+    /* convert inches of mercury to hectopascals, then calibrate. 0 is dashed */
+    unsigned int barometer = archive_u16(record, 14);
+    if (barometer != 0) {
+        davis_data->barometer = (float) barometer/1000 * 33.86;
+        if ((davis_data->barometer < 800.0) || (davis_data->barometer > 1100.0)) {
+            davis_data->barometer = ERROR_VALUE_FLOAT;
+        }
+        else {
+            davis_data->barometer = davis_data->barometer * barocal;
+        }
+    }
+
+    unsigned int solar = archive_u16(record, 16);
+    if ((solar != 32767) and (solar <= 1800)) {
+        davis_data->solar_radiation = (float) solar;
+    }
+
+    davis_data->inside_humidity = archive_byte(record, 22);
+    davis_data->outside_humidity = archive_byte(record, 23);
+
+    /* Average wind speed in mph. Convert to metres/s */
+    if (record[24] != 255) {
+        davis_data->wind_speed = (float) (record[24] * 0.44704);
+        if (wdspd_kmh) {
+            davis_data->wind_speed = davis_data->wind_speed * MS_TO_KMH;
+        }
+    }
+
+    /* Prevailing wind direction, as a code from 0 (N) to 15 (NNW) */
+    if (record[27] < 16) {
+        davis_data->wind_direction = record[27] * 22.5;
+        if (winddir_180) {
+            davis_data->wind_direction = davis_data->wind_direction + 180.0;
+            if (davis_data->wind_direction >= 360.0) {
+                davis_data->wind_direction = davis_data->wind_direction - 360.0;
+            }
+        }
+    }
+
+    /* Average UV index, in UV Index / 10 */
+    if (record[28] != 255) {
+        davis_data->UV = (float) record[28] / 10;
+    }
+
+    davis_data->soil_temp1 = archive_soil_temperature(record, 38);
+    davis_data->soil_temp2 = archive_soil_temperature(record, 39);
+    davis_data->soil_temp3 = archive_soil_temperature(record, 40);
+    davis_data->soil_temp4 = archive_soil_temperature(record, 41);
+    davis_data->soil_moist1 = archive_byte(record, 48);
+    davis_data->soil_moist2 = archive_byte(record, 49);
+    davis_data->soil_moist3 = archive_byte(record, 50);
+    davis_data->soil_moist4 = archive_byte(record, 51);
+
+    return true;
+}
+
+/* Send the DMPAFT command, and the date and time of the last record already downloaded. Returns the number of
+   pages that will be sent, and the first new record in the first page. Returns false if the Davis didn't accept it */
+static bool start_download(int modem_filedesc, struct tm since, int *pages, int *first_record, bool debug)
+{
+    unsigned char request[6];
+    unsigned char response[6];
+    unsigned int date_stamp = 0, time_stamp = 0;
+
+    tcflush(modem_filedesc, TCIFLUSH);
+    if (not send_command(modem_filedesc, "DMPAFT\n", debug)) return false;
+    if (not wait_for_ack(modem_filedesc, debug)) return false;
+
+    /* Zero for both of these values (and the CRC) will download the whole archive */
+    if (since.tm_year >= 100) {
+        date_stamp = since.tm_mday + (since.tm_mon + 1) * 32 + (since.tm_year - 100) * 512;
+        time_stamp = since.tm_hour * 100 + since.tm_min;
+    }
+    request[0] = date_stamp & 0xFF;
+    request[1] = date_stamp >> 8;
+    request[2] = time_stamp & 0xFF;
+    request[3] = time_stamp >> 8;
+    crc16_append(request, 4);
+
+    if (write(modem_filedesc, request, sizeof(request)) != sizeof(request)) {
+        if (debug) cout << "Could not write the DMPAFT date and time" << endl;
+        return false;
+    }
+    if (not wait_for_ack(modem_filedesc, debug)) return false;
+
+    if ((read_bytes(modem_filedesc, response, sizeof(response), ARCHIVE_READ_TIMEOUT_MS) != sizeof(response)) or (not crc16_check(response, sizeof(response)))) {
+        if (debug) cout << "Bad DMPAFT page count received" << endl;
+        return false;
+    }
+    *pages = (response[1] << 8) | response[0];
+    *first_record = (response[3] << 8) | response[2];
+
+    return true;
+}
+
+/* Download the archive records written after 'since', and log each of them to 'davis_archive_YYYY-MM-DD.log'.
+   These are kept apart from the daily logs, so the daily logs stay in time order. Each page is ACKed as soon
+   as its CRC is checked, so the Davis sends the next page while this one is being decoded and logged.
+   Returns the number of records logged, or -1 if the download could not be started */
+int download_archive(int modem_filedesc, struct tm since, arguments &arguments_list)
+{
+    unsigned char page[ARCHIVE_PAGE_SIZE];
+    unsigned char response;
+    int pages = 0, first_record = 0, logged = 0;
+    bool debug = arguments_list.get_debug();
+    time_t newest = 0;
+    log_writer writer(arguments_list.get_log_directory(), "davis_archive_", header_line(arguments_list.wdspd_kmh, arguments_list.loop2), false);
+
+    /* Records are written in groups. This doesn't hold up the download, since it is all written when it is finished */
+    writer.set_durability(ARCHIVE_RECORDS_PER_PAGE * 20, 0, arguments_list.sync);
+    if (arguments_list.binary) {
+        writer.enable_binary(arguments_list.barocal, arguments_list.wdspd_kmh, arguments_list.winddir_180, arguments_list.loop2);
+    }
+    if (arguments_list.blocks) {
+        writer.enable_blocks(arguments_list.barocal, arguments_list.wdspd_kmh, arguments_list.winddir_180, arguments_list.loop2);
+    }
+
+    if (not wake_davis(modem_filedesc, debug)) {
+        cout << "The Davis did not wake up" << endl;
+        return -1;
+    }
+    if (not start_download(modem_filedesc, since, &pages, &first_record, debug)) {
+        cout << "The Davis did not accept the archive download request" << endl;
+        return -1;
+    }
+    if (debug) cout << "Archive pages: " << pages << " First record: " << first_record << endl;
+
+    /* Start the download */
+    response = ACK;
+    if (write(modem_filedesc, &response, 1) != 1) {
+        return -1;
+    }
+
+    for (int page_number = 0; page_number < pages; page_number++) {
+        int retries = 0;
+        while (true) {
+            int received = read_bytes(modem_filedesc, page, sizeof(page), ARCHIVE_READ_TIMEOUT_MS);
+            if ((received == sizeof(page)) and crc16_check(page, sizeof(page))) {
+                break;
+            }
+            if (++retries > ARCHIVE_RETRIES) {
+                cout << "Archive page " << page_number << " could not be read. Cancelling the download" << endl;
+                response = ESC;
+                if (write(modem_filedesc, &response, 1) != 1) {
+                    if (debug) cout << "Could not cancel the download" << endl;
+                }
+                return logged;
+            }
+            if (debug) cout << "Bad archive page " << page_number << ". Requesting it again" << endl;
+            tcflush(modem_filedesc, TCIFLUSH);
+            response = NAK;
+            if (write(modem_filedesc, &response, 1) != 1) {
+                return logged;
+            }
+        }
+
+        /* ACK straight away, so the next page is on its way while this one is logged */
+        response = ACK;
+        if (write(modem_filedesc, &response, 1) != 1) {
+            if (debug) cout << "Could not ACK archive page " << page_number << endl;
+        }
+
+        /* In the first page, the records before 'first_record' are older than requested */
+        int record_number = (page_number == 0) ? first_record : 0;
+        for (; record_number < ARCHIVE_RECORDS_PER_PAGE; record_number++) {
+            davis_data_t davis_data;
+            struct tm stamp;
+            char datetime[DATESIZE + 10];
+            char line[LINE_SIZE];
+
+            /* Skip the sequence number at the start of the page */
+            const unsigned char *record = &page[1 + record_number * ARCHIVE_RECORD_SIZE];
+            if (not decode_archive_record(record, &davis_data, &stamp, arguments_list.wdspd_kmh, arguments_list.barocal, arguments_list.winddir_180)) {
+                continue;
+            }
+
+            /* After the newest record, the archive has old records that are yet to be overwritten */
+            time_t record_time = mktime(&stamp);
+            if (record_time <= newest) {
+                continue;
+            }
+            newest = record_time;
+
+            strftime(datetime, sizeof(datetime), "%Y-%m-%dT%H:%M:%S%z", &stamp);
+            size_t length = format_result(line, sizeof(line), davis_data, arguments_list.loop2, datetime);
+            writer.append(line, length, davis_data, (int64_t) record_time * 1000, (int32_t) stamp.tm_gmtoff);
+            logged++;
+        }
+    }
+
+    if (debug) cout << "Archive records logged: " << logged << endl;
+    return logged;
+}
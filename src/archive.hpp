@@ -0,0 +1,32 @@
+/* Copyright (c) 2013-2018 Ardexa Pty Ltd. All rights reserved.
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef ARCHIVE_HPP_INCLUDED
+#define ARCHIVE_HPP_INCLUDED
+
+#include <string>
+#include <iostream>
+#include <ctime>
+#include "configs.hpp"
+#include "utils.hpp"
+#include "serial.hpp"
+#include "crc.hpp"
+#include "arguments.hpp"
+
+using namespace std;
+
+bool parse_archive_time(string archive_time, struct tm *since);
+int download_archive(int modem_filedesc, struct tm since, arguments &arguments_list);
+bool decode_archive_record(const unsigned char *record, davis_data_t *davis_data, struct tm *stamp, bool wdspd_kmh, float barocal, bool winddir_180);
+
+#endif /* ARCHIVE_HPP_INCLUDED */
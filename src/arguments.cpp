@@ -12,6 +12,8 @@
  */
 
 #include "arguments.hpp"
+#include "archive.hpp"
+#include "aggregator.hpp"
 
 using namespace std;
 
@@ -24,9 +26,23 @@ arguments::arguments()
     this->barocal = 1.0;
     this->wdspd_kmh =  false;
     this->winddir_180 = false;
+    this->daemon = false;
+    this->interval = DEFAULT_LOG_INTERVAL;
+    this->loop2 = false;
+    this->archive = false;
+    memset(&this->archive_since, 0, sizeof(this->archive_since));
+    this->binary = false;
+    this->blocks = false;
+    this->capture = false;
+    this->flush_records = DEFAULT_FLUSH_RECORDS;
+    this->flush_ms = DEFAULT_FLUSH_MS;
+    this->sync = false;
+    this->pid_file = PID_FILE;
+    this->read_timeout_ms = DEFAULT_READ_TIMEOUT_MS;
+    this->stats = false;
 
     /* Usage string */
-    this->usage_string = "Usage: ardexa-davis [-t device] [-d directory] [-e] [-w] [-b barocal] [-z]\n";
+    this->usage_string = "Usage: ardexa-davis [-t device] [-d directory] [-e] [-w] [-b barocal] [-z] [-D] [-i seconds] [-2] [-a YYYY-MM-DDTHH:MM|all] [-B] [--blocks] [--capture] [--bin2csv file]\n                    [--flush-records n] [--flush-ms ms] [--fsync] [--pid-file file] [--stations file]\n                    [--read-timeout ms] [--aggregate minutes[,minutes...]] [--shm name] [--metrics unix:path|[address:]port]\n                    [--stats]\n";
 }
 
 /* This method is to initialize the member variables based on the command line arguments */
@@ -35,16 +51,58 @@ int arguments::initialize(int argc, char * argv[])
 	int opt;
 	bool ret_error = false;
     string barocal_raw = "1.0";
+    string interval_raw = "";
+    string archive_raw = "";
+    long number;
+    static struct option long_options[] = {
+        {"daemon",        no_argument,       0, 'D'},
+        {"interval",      required_argument, 0, 'i'},
+        {"loop2",         no_argument,       0, '2'},
+        {"archive",       required_argument, 0, 'a'},
+        {"binary",        no_argument,       0, 'B'},
+        {"blocks",        no_argument,       0, 'K'},
+        {"capture",       no_argument,       0, 'W'},
+        {"bin2csv",       required_argument, 0, 'C'},
+        {"flush-records", required_argument, 0, 'N'},
+        {"flush-ms",      required_argument, 0, 'M'},
+        {"fsync",         no_argument,       0, 'Y'},
+        {"pid-file",      required_argument, 0, 'P'},
+        {"stations",      required_argument, 0, 'S'},
+        {"read-timeout",  required_argument, 0, 'R'},
+        {"aggregate",     required_argument, 0, 'G'},
+        {"shm",           required_argument, 0, 'L'},
+        {"metrics",       required_argument, 0, 'X'},
+        {"stats",         no_argument,       0, 'T'},
+        {0, 0, 0, 0}
+    };
 
     /**
-     * -t <device> (optional) name of the /dev/ device
+     * -t <device> (optional) name of the /dev/ device, or 'all' to log every Davis USB adaptor found (in daemon mode)
      * -d <directory> (optional) name of the logging directory
      * -e (optional) if specified, debug will be turned on
      * -w (optional) if specified, wind speed is in km/h, not m/s
      * -z (optional) if specified, wind direction will be shifted 180 degs (to cater for the anemometer arm pointing south)
      * -b (optional) if specified, will calibrate the barometer using this number as a multiplication to the raw value
+     * -D, --daemon (optional) if specified, keep the serial session open and log continuously
+     * -i, --interval <seconds> (optional) in daemon mode, the minimum time between logged samples
+     * -2, --loop2 (optional) if specified, request alternating LOOP and LOOP2 packets, and log the LOOP2 values as well
+     * -a, --archive <YYYY-MM-DDTHH:MM|all> (optional) if specified, download the archive records after this time, log them and exit
+     * -B, --binary (optional) if specified, also write each reading to a daily binary log
+     * --blocks (optional) if specified, also write each reading to a daily compressed block log
+     * --capture (optional) if specified, also write each packet, as received, to a daily capture (for davis-bench and reprocessing)
+     * --bin2csv <file> (optional) if specified, convert a binary or block log to CSV on stdout and exit
+     * --flush-records <n> (optional) write the logs when this many lines are waiting
+     * --flush-ms <ms> (optional) write the logs when a line has waited this long
+     * --fsync (optional) if specified, make sure the lines are on disk each time the logs are written
+     * --pid-file <file> (optional) the PID file, so more than one instance can run (one for each Davis)
+     * --read-timeout <ms> (optional) for a single reading, the longest wait for data from the Davis before giving up
+     * --aggregate <minutes,...> (optional) in daemon mode, also log rolling statistics over windows of these lengths, such as 1,10,60
+     * --stations <file> (optional) log all the Davis consoles listed in this file, each with its own directory and calibration (in daemon mode)
+     * --shm <name> (optional) also publish each reading to the shared memory segment with this name, for davis-latest
+     * --metrics <unix:path|[address:]port> (optional) in daemon mode, serve the metrics in the Prometheus text format on this socket
+     * --stats (optional) on exit, print the time taken by each stage of reading and logging the packets (the daemon also prints them on SIGUSR1)
      */
-    while ((opt = getopt(argc, argv, "t:d:efb:wz")) != -1) {
+    while ((opt = getopt_long(argc, argv, "t:d:efb:wzDi:2a:B", long_options, NULL)) != -1) {
         switch (opt) {
             case 't':
                 /* The device will be verified later */
@@ -66,6 +124,80 @@ int arguments::initialize(int argc, char * argv[])
             case 'e':
                 this->debug = true;
                 break;
+            case 'D':
+                this->daemon = true;
+                break;
+            case 'i':
+                interval_raw = optarg;
+                break;
+            case '2':
+                this->loop2 = true;
+                break;
+            case 'a':
+                this->archive = true;
+                archive_raw = optarg;
+                break;
+            case 'B':
+                this->binary = true;
+                break;
+            case 'K':
+                this->blocks = true;
+                break;
+            case 'W':
+                this->capture = true;
+                break;
+            case 'C':
+                this->bin2csv = optarg;
+                break;
+            case 'N':
+                if ((not convert_long(optarg, &number)) or (number < 1)) {
+                    cout << "The number of lines to flush must be a positive integer: " << optarg << endl;
+                    ret_error = true;
+                }
+                this->flush_records = number;
+                break;
+            case 'M':
+                if ((not convert_long(optarg, &number)) or (number < 0)) {
+                    cout << "The flush time must be a number of milliseconds: " << optarg << endl;
+                    ret_error = true;
+                }
+                this->flush_ms = number;
+                break;
+            case 'Y':
+                this->sync = true;
+                break;
+            case 'P':
+                this->pid_file = optarg;
+                break;
+            case 'S':
+                this->stations_file = optarg;
+                break;
+            case 'G':
+                if (not parse_window_minutes(optarg, this->aggregate_minutes)) {
+                    cout << "The aggregate windows must be a list of minutes (up to " << AGGREGATE_MAX_MINUTES << "), such as 1,10,60: " << optarg << endl;
+                    ret_error = true;
+                }
+                break;
+            case 'L':
+                if (string(optarg).find('/', 1) != string::npos) {
+                    cout << "The shared memory name can't contain a '/': " << optarg << endl;
+                    ret_error = true;
+                }
+                this->shm_name = optarg;
+                break;
+            case 'T':
+                this->stats = true;
+                break;
+            case 'X':
+                this->metrics_address = optarg;
+                break;
+            case 'R':
+                if ((not convert_long(optarg, &number)) or (number < 1)) {
+                    cout << "The read timeout must be a positive number of milliseconds: " << optarg << endl;
+                    ret_error = true;
+                }
+                this->read_timeout_ms = number;
+                break;
             default:
                 this->usage();
                 return 1;
@@ -83,7 +215,44 @@ int arguments::initialize(int argc, char * argv[])
         ret_error = true;
     }
 
-	if (not create_directory(this->log_directory)) {
+    // Convert "interval_raw" to a float
+    if (not interval_raw.empty()) {
+        try {
+            this->interval = stof(interval_raw, &idx);
+            if (this->interval < 0.0) {
+                cout << "The logging interval cannot be negative: " << interval_raw << endl;
+                ret_error = true;
+            }
+        }
+        catch ( const std::exception& e ) {
+            cout << "Could not convert the logging interval to a float: " << interval_raw << endl;
+            ret_error = true;
+        }
+    }
+
+    if (this->archive) {
+        if (not parse_archive_time(archive_raw, &this->archive_since)) {
+            cout << "The archive time must be in the format YYYY-MM-DDTHH:MM, or 'all': " << archive_raw << endl;
+            ret_error = true;
+        }
+        /* The archive is downloaded and then the application exits, so it can't also log continuously */
+        if (this->daemon) {
+            cout << "The archive can't be downloaded in daemon mode (-D)" << endl;
+            ret_error = true;
+        }
+    }
+
+    /* Logging many consoles is only done in daemon mode */
+    if ((not this->stations_file.empty()) or (this->device == "all")) {
+        if (this->archive) {
+            cout << "The archive can only be downloaded from one Davis at a time" << endl;
+            ret_error = true;
+        }
+        this->daemon = true;
+    }
+
+	/* Converting a binary log doesn't use the logging directory */
+	if (this->bin2csv.empty() and (not create_directory(this->log_directory))) {
 		cout << "Could not create the logging directory: " << this->log_directory << endl;
 		ret_error = true;
 	}
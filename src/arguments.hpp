@@ -15,11 +15,13 @@
 #define ARGUMENTS_HPP_INCLUDED
 
 #include <string>
+#include <vector>
 #include "arguments.hpp"
 #include "utils.hpp"
 #include "configs.hpp"
 #include <iostream>
 #include <unistd.h>
+#include <getopt.h>
 
 using namespace std;
 
@@ -37,6 +39,25 @@ class arguments
         float barocal;
         bool wdspd_kmh;
         bool winddir_180;
+        bool daemon;
+        float interval;
+        bool loop2;
+        bool archive;
+        struct tm archive_since;
+        bool binary;
+        bool blocks;
+        bool capture;
+        string bin2csv;
+        int flush_records;
+        int flush_ms;
+        bool sync;
+        string pid_file;
+        string stations_file;
+        int read_timeout_ms;
+        vector<int> aggregate_minutes;
+        string shm_name;
+        string metrics_address;
+        bool stats;
 
     private:
         /* members are private */
@@ -0,0 +1,480 @@
+/* Copyright (c) 2013-2018 Ardexa Pty Ltd. All rights reserved.
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+/* davis-bench measures the stages of the hot path, from the bytes read from the Davis to the lines in the logs:
+   assembling LOOP packets (loop_parser), decoding them (extract_results), making the CSV line (format_result)
+   and writing it (log_writer). Handing the packets to the logging thread (frame_ring) is timed as well. Each
+   stage is timed on its own over a corpus of packets, then all of them together, as the daemon runs them. For
+   each, it reports the time and heap allocations for each packet, and the bytes written to the logs.
+
+   The corpus is made by the encoder, from simulated weather, or read from a file of packets. The logs are written
+   to a temporary directory, by default in /dev/shm, so the disk isn't measured. With -m or -A, it exits with an
+   error if the whole path is slower, or allocates more, than given. This is the regression gate for CI */
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <new>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <getopt.h>
+#include "configs.hpp"
+#include "utils.hpp"
+#include "crc.hpp"
+#include "encoder.hpp"
+#include "loop_parser.hpp"
+#include "log_writer.hpp"
+#include "capture.hpp"
+#include "timestamp.hpp"
+#include "aggregator.hpp"
+#include "frame_ring.hpp"
+
+using namespace std;
+
+#define BENCH_CORPUS 1024         /* The number of packets made for the corpus */
+#define BENCH_READ_SIZE 64        /* The bytes in each read() from a USB serial adaptor */
+
+/* Global variables */
+int g_debug = DEFAULT_DEBUG_VALUE;
+
+/* Count every allocation made through new. The standard containers, and strings, all use it */
+static unsigned long g_allocations = 0;
+
+void *operator new(size_t size)
+{
+    g_allocations++;
+    void *memory = malloc(size ? size : 1);
+    if (memory == NULL) throw bad_alloc();
+    return memory;
+}
+
+void *operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void *memory) noexcept
+{
+    free(memory);
+}
+
+void operator delete[](void *memory) noexcept
+{
+    free(memory);
+}
+
+/* The results of one stage */
+struct stage_result_t {
+    string name;
+    double ns_per_frame;
+    double allocations_per_frame;
+    double bytes_per_frame;
+};
+
+/* Stops the compiler optimizing away work whose result isn't used */
+static volatile float g_sink;
+
+/* Make the corpus from simulated weather, a packet every 2.5 seconds. With 'loop2', LOOP and LOOP2 packets alternate */
+static vector<string> make_corpus(bool loop2)
+{
+    vector<string> corpus;
+    unsigned char frame[LOOP_PACKET_SIZE];
+    double start = time(NULL);
+
+    for (int i = 0; i < BENCH_CORPUS; i++) {
+        davis_data_t davis_data = simulated_weather(start + i * 2.5, i % 8);
+        if (loop2 and (i % 2 == 1)) encode_loop2(davis_data, frame);
+        else encode_loop(davis_data, frame);
+        corpus.push_back(string((char *) frame, LOOP_PACKET_SIZE));
+    }
+    return corpus;
+}
+
+/* Read a corpus of recorded packets from a file: a capture written by --capture, or a raw stream, where anything
+   between the packets is skipped */
+static vector<string> read_corpus(string filename)
+{
+    vector<string> corpus;
+    unsigned char buffer[BUFSIZE];
+    loop_parser parser;
+
+    if (is_capture_file(filename)) {
+        capture_reader reader;
+        if (reader.open(filename)) {
+            for (size_t i = 0; i < reader.get_count(); i++) {
+                if (reader.valid(i)) corpus.push_back(string((const char *) reader.get_records()[i].frame, LOOP_PACKET_SIZE));
+            }
+        }
+        return corpus;
+    }
+
+    int filedesc = open(filename.c_str(), O_RDONLY);
+    if (filedesc < 0) {
+        perror(filename.c_str());
+        return corpus;
+    }
+    int result;
+    while ((result = read(filedesc, buffer, sizeof(buffer))) > 0) {
+        const unsigned char *data = buffer;
+        size_t remaining = result;
+        while (remaining > 0) {
+            size_t used = parser.feed(data, remaining);
+            data += used;
+            remaining -= used;
+            if (parser.frame_ready()) corpus.push_back(string((const char *) parser.frame(), LOOP_PACKET_SIZE));
+        }
+    }
+    close(filedesc);
+    return corpus;
+}
+
+/* Remove the files written to the temporary directory, then the directory */
+static void remove_directory(string directory)
+{
+    DIR *dir = opendir(directory.c_str());
+    if (dir == NULL) return;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        string name = entry->d_name;
+        if ((name != ".") and (name != "..")) unlink((directory + "/" + name).c_str());
+    }
+    closedir(dir);
+    rmdir(directory.c_str());
+}
+
+/* Time assembling the packets from a stream, as read() returns it from the serial line */
+static stage_result_t bench_parse(const vector<string> &corpus, long frames)
+{
+    string stream;
+    for (size_t i = 0; i < corpus.size(); i++) stream += corpus[i];
+    loop_parser parser;
+    long count = 0;
+
+    unsigned long allocations = g_allocations;
+    int64_t start = monotonic_now_ns();
+    while (count < frames) {
+        const unsigned char *data = (const unsigned char *) stream.data();
+        size_t remaining = stream.length();
+        while ((remaining > 0) and (count < frames)) {
+            size_t length = min(remaining, (size_t) BENCH_READ_SIZE);
+            while (length > 0) {
+                size_t used = parser.feed(data, length);
+                data += used;
+                length -= used;
+                remaining -= used;
+                if (parser.frame_ready()) count++;
+            }
+        }
+    }
+    int64_t elapsed = monotonic_now_ns() - start;
+
+    return {"parse", (double) elapsed / count, (double) (g_allocations - allocations) / count, 0.0};
+}
+
+/* Time decoding the packets */
+static stage_result_t bench_decode(const vector<string> &corpus, long frames)
+{
+    davis_data_t davis_data;
+    clear_davis_data(&davis_data);
+
+    unsigned long allocations = g_allocations;
+    int64_t start = monotonic_now_ns();
+    for (long i = 0; i < frames; i++) {
+        extract_results((const unsigned char *) corpus[i % corpus.size()].data(), &davis_data, false, false, 1.0, false);
+        g_sink = davis_data.outside_temperature;
+    }
+    int64_t elapsed = monotonic_now_ns() - start;
+
+    return {"decode", (double) elapsed / frames, (double) (g_allocations - allocations) / frames, 0.0};
+}
+
+/* Time making the CSV lines, each with a receive time */
+static stage_result_t bench_format(const vector<davis_data_t> &decoded, long frames, bool loop2)
+{
+    size_t length = 0;
+    char line[LINE_SIZE];
+    char datetime[DATETIME_SIZE];
+    datetime_formatter formatter;
+    int32_t utc_offset;
+
+    unsigned long allocations = g_allocations;
+    int64_t start = monotonic_now_ns();
+    for (long i = 0; i < frames; i++) {
+        receive_stamp_t stamp = stamp_now();
+        formatter.format(datetime, stamp.realtime_ns, &utc_offset);
+        length += format_result(line, sizeof(line), decoded[i % decoded.size()], loop2, datetime);
+    }
+    int64_t elapsed = monotonic_now_ns() - start;
+    g_sink = length;
+
+    return {"format", (double) elapsed / frames, (double) (g_allocations - allocations) / frames, 0.0};
+}
+
+/* Time adding the packets to rolling 1, 10 and 60 minute windows, as --aggregate does. The packets are 2.5 seconds
+   apart, so the windows are full after the first 1440 */
+static stage_result_t bench_aggregate(const vector<davis_data_t> &decoded, long frames)
+{
+    vector<int> window_minutes;
+    window_minutes.push_back(1);
+    window_minutes.push_back(10);
+    window_minutes.push_back(60);
+    aggregator aggregates(window_minutes, false);
+
+    unsigned long allocations = g_allocations;
+    int64_t start = monotonic_now_ns();
+    for (long i = 0; i < frames; i++) {
+        aggregates.add(decoded[i % decoded.size()], (int64_t) i * 2500);
+    }
+    int64_t elapsed = monotonic_now_ns() - start;
+
+    return {"aggregate", (double) elapsed / frames, (double) (g_allocations - allocations) / frames, 0.0};
+}
+
+/* Time handing the packets from the reading thread to the logging thread through the frame ring, as the daemon
+   does. Both ends are run by this thread, so it is the cost of the copies and the wakeups */
+static stage_result_t bench_ring(const vector<string> &corpus, long frames)
+{
+    frame_ring ring(FRAME_RING_SIZE);
+    receive_stamp_t stamp = stamp_now();
+    frame_slot_t *slot;
+    long count = 0;
+
+    unsigned long allocations = g_allocations;
+    int64_t start = monotonic_now_ns();
+    for (long i = 0; i < frames; i++) {
+        ring.push(NULL, stamp, (const unsigned char *) corpus[i % corpus.size()].data());
+        if ((slot = ring.front()) != NULL) {
+            count += slot->frame[0];
+            ring.pop();
+        }
+    }
+    int64_t elapsed = monotonic_now_ns() - start;
+    if (count == 0) cout << "No packets were passed through the ring" << endl;
+
+    return {"ring", (double) elapsed / frames, (double) (g_allocations - allocations) / frames, 0.0};
+}
+
+/* Time writing the lines to the daily log and 'latest.csv' */
+static stage_result_t bench_log(const vector<davis_data_t> &decoded, const vector<string> &lines, long frames, string directory, int flush_records, bool binary, bool blocks, bool loop2)
+{
+    int32_t utc_offset;
+    char datetime[DATETIME_SIZE];
+    datetime_formatter formatter;
+    receive_stamp_t stamp = stamp_now();
+    int64_t timestamp_ms = stamp.realtime_ns / 1000000;
+    unsigned long allocations;
+    int64_t start, elapsed;
+    uint64_t bytes;
+
+    {
+        log_writer writer(directory, "davis_", header_line(false, loop2), true);
+        writer.set_durability(flush_records, 0, false);
+        if (binary) writer.enable_binary(1.0, false, false, loop2);
+        if (blocks) writer.enable_blocks(1.0, false, false, loop2);
+        formatter.format(datetime, stamp.realtime_ns, &utc_offset);
+
+        allocations = g_allocations;
+        start = monotonic_now_ns();
+        for (long i = 0; i < frames; i++) {
+            size_t index = i % lines.size();
+            writer.append(lines[index], decoded[index], timestamp_ms, utc_offset);
+        }
+        writer.flush();
+        elapsed = monotonic_now_ns() - start;
+        allocations = g_allocations - allocations;
+        bytes = writer.get_bytes_written();
+    }
+
+    return {"log", (double) elapsed / frames, (double) allocations / frames, (double) bytes / frames};
+}
+
+/* Time the whole path, as run_daemon() runs it: the stream is assembled into packets, each is decoded, and a line
+   is made and logged for each LOOP packet (or LOOP2 packet, if they alternate) */
+static stage_result_t bench_pipeline(const vector<string> &corpus, long frames, string directory, int flush_records, bool binary, bool blocks, bool loop2)
+{
+    string stream;
+    for (size_t i = 0; i < corpus.size(); i++) stream += corpus[i];
+    loop_parser parser;
+    davis_data_t davis_data;
+    int log_type = loop2 ? LOOP2_TYPE : LOOP_TYPE;
+    char line[LINE_SIZE];
+    char datetime[DATETIME_SIZE];
+    datetime_formatter formatter;
+    long count = 0;
+    unsigned long allocations;
+    int64_t start, elapsed;
+    uint64_t bytes;
+
+    clear_davis_data(&davis_data);
+    {
+        log_writer writer(directory, "davis_", header_line(false, loop2), true);
+        writer.set_durability(flush_records, 0, false);
+        if (binary) writer.enable_binary(1.0, false, false, loop2);
+        if (blocks) writer.enable_blocks(1.0, false, false, loop2);
+
+        allocations = g_allocations;
+        start = monotonic_now_ns();
+        while (count < frames) {
+            const unsigned char *data = (const unsigned char *) stream.data();
+            size_t remaining = stream.length();
+            while ((remaining > 0) and (count < frames)) {
+                size_t length = min(remaining, (size_t) BENCH_READ_SIZE);
+                receive_stamp_t stamp = stamp_now();
+                while (length > 0) {
+                    size_t used = parser.feed(data, length);
+                    data += used;
+                    length -= used;
+                    remaining -= used;
+                    if (not parser.frame_ready()) continue;
+
+                    count++;
+                    int packet_type = extract_results(parser.frame(), &davis_data, false, false, 1.0, false);
+                    if (packet_type == log_type) {
+                        int32_t utc_offset;
+                        formatter.format(datetime, stamp.realtime_ns, &utc_offset);
+                        size_t line_length = format_result(line, sizeof(line), davis_data, loop2, datetime);
+                        writer.append(line, line_length, davis_data, stamp.realtime_ns / 1000000, utc_offset);
+                    }
+                }
+            }
+        }
+        writer.flush();
+        elapsed = monotonic_now_ns() - start;
+        allocations = g_allocations - allocations;
+        bytes = writer.get_bytes_written();
+    }
+
+    return {"all", (double) elapsed / count, (double) allocations / count, (double) bytes / count};
+}
+
+static void usage()
+{
+    cout << "Usage: davis-bench [-n frames] [-f corpus file] [-d directory] [-2] [-B] [-K] [-N flush records] [-m max ns] [-A max allocations]" << endl;
+}
+
+int main(int argc, char *argv[])
+{
+    int opt;
+    long frames = 200000;
+    string corpus_file;
+    string base_directory = "/dev/shm";
+    bool loop2 = false;
+    bool binary = false;
+    bool blocks = false;
+    int flush_records = DEFAULT_FLUSH_RECORDS;
+    double max_ns = 0.0;
+    double max_allocations = -1.0;
+
+    /**
+     * -n <frames> (optional) the number of packets to time in each stage
+     * -f <file> (optional) a file of recorded packets (such as a capture) to use as the corpus, instead of simulated weather
+     * -d <directory> (optional) where the temporary logging directory is made. Defaults to /dev/shm
+     * -2 (optional) if specified, LOOP and LOOP2 packets alternate, and the LOOP2 columns are logged
+     * -B (optional) if specified, the binary log is written as well
+     * -K (optional) if specified, the compressed block log is written as well
+     * -N <records> (optional) the lines buffered before the logs are written, as --flush-records
+     * -m <ns> (optional) fail if the whole path takes longer than this for each packet
+     * -A <allocations> (optional) fail if the whole path makes more heap allocations than this for each packet
+     */
+    try {
+        while ((opt = getopt(argc, argv, "n:f:d:2BKN:m:A:h")) != -1) {
+            switch (opt) {
+                case 'n': frames = stol(optarg); break;
+                case 'f': corpus_file = optarg; break;
+                case 'd': base_directory = optarg; break;
+                case '2': loop2 = true; break;
+                case 'B': binary = true; break;
+                case 'K': blocks = true; break;
+                case 'N': flush_records = stoi(optarg); break;
+                case 'm': max_ns = stod(optarg); break;
+                case 'A': max_allocations = stod(optarg); break;
+                default:
+                    usage();
+                    return 1;
+            }
+        }
+    }
+    catch (exception &e) {
+        cout << "Invalid number for option -" << (char) opt << ": " << optarg << endl;
+        return 1;
+    }
+    if ((frames < 1) or (flush_records < 1)) {
+        usage();
+        return 1;
+    }
+
+    vector<string> corpus = corpus_file.empty() ? make_corpus(loop2) : read_corpus(corpus_file);
+    if (corpus.empty()) {
+        cout << "No LOOP packets in the corpus" << endl;
+        return 1;
+    }
+
+    /* The later stages start from the decoded packets and the lines, so they are timed on their own */
+    vector<davis_data_t> decoded;
+    vector<string> lines;
+    davis_data_t davis_data;
+    clear_davis_data(&davis_data);
+    for (size_t i = 0; i < corpus.size(); i++) {
+        extract_results((const unsigned char *) corpus[i].data(), &davis_data, false, false, 1.0, false);
+        decoded.push_back(davis_data);
+        lines.push_back(write_result_string(davis_data, loop2));
+    }
+
+    char directory_template[PATH_MAX];
+    snprintf(directory_template, sizeof(directory_template), "%s/davis-bench.XXXXXX", base_directory.c_str());
+    if (mkdtemp(directory_template) == NULL) {
+        perror(directory_template);
+        return 1;
+    }
+    string directory = directory_template;
+
+    vector<stage_result_t> results;
+    results.push_back(bench_parse(corpus, frames));
+    results.push_back(bench_decode(corpus, frames));
+    results.push_back(bench_format(decoded, frames, loop2));
+    results.push_back(bench_aggregate(decoded, frames));
+    results.push_back(bench_ring(corpus, frames));
+    results.push_back(bench_log(decoded, lines, frames, directory + "/log", flush_records, binary, blocks, loop2));
+    results.push_back(bench_pipeline(corpus, frames, directory + "/all", flush_records, binary, blocks, loop2));
+    remove_directory(directory + "/log");
+    remove_directory(directory + "/all");
+    remove_directory(directory);
+
+    cout << "# Packets: " << frames << " Corpus: " << corpus.size() << " Flush records: " << flush_records;
+    cout << (loop2 ? " LOOP2" : "") << (binary ? " Binary" : "") << (blocks ? " Blocks" : "") << endl;
+    cout << "# Stage,ns/packet,Allocations/packet,Bytes written/packet" << endl;
+    cout << fixed;
+    for (size_t i = 0; i < results.size(); i++) {
+        cout << results[i].name << "," << setprecision(1) << results[i].ns_per_frame << ",";
+        cout << setprecision(2) << results[i].allocations_per_frame << "," << results[i].bytes_per_frame << endl;
+    }
+
+    /* The regression gate */
+    stage_result_t &all = results.back();
+    int result = 0;
+    if ((max_ns > 0.0) and (all.ns_per_frame > max_ns)) {
+        cout << "FAILED: " << setprecision(1) << all.ns_per_frame << " ns/packet is more than " << max_ns << endl;
+        result = 2;
+    }
+    if ((max_allocations >= 0.0) and (all.allocations_per_frame > max_allocations)) {
+        cout << "FAILED: " << setprecision(2) << all.allocations_per_frame << " allocations/packet is more than " << max_allocations << endl;
+        result = 2;
+    }
+
+    return result;
+}
@@ -0,0 +1,168 @@
+/* Copyright (c) 2013-2018 Ardexa Pty Ltd. All rights reserved.
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "binary_log.hpp"
+
+/* The columns of the binary log, in the same order as the CSV. A unit of "speed" is m/s or km/h, depending on
+   the calibration */
+typedef struct binary_column_s {
+    const char *name;
+    const char *unit;
+    float davis_data_t::*member;
+} binary_column_t;
+
+static const binary_column_t binary_columns[BINARY_FIELDS] = {
+    { "inside_temperature",  "celsius",    &davis_data_t::inside_temperature },
+    { "outside_temperature", "celsius",    &davis_data_t::outside_temperature },
+    { "inside_humidity",     "percent",    &davis_data_t::inside_humidity },
+    { "outside_humidity",    "percent",    &davis_data_t::outside_humidity },
+    { "wind_speed",          "speed",      &davis_data_t::wind_speed },
+    { "wind_direction",      "degrees",    &davis_data_t::wind_direction },
+    { "barometer",           "hPa",        &davis_data_t::barometer },
+    { "solar_radiation",     "w/m^2",      &davis_data_t::solar_radiation },
+    { "uv_index",            "index",      &davis_data_t::UV },
+    { "rain",                "mm",         &davis_data_t::rain },
+    { "console_battery",     "volts",      &davis_data_t::console_battery },
+    { "soil_temperature_1",  "celsius",    &davis_data_t::soil_temp1 },
+    { "soil_moisture_1",     "centibar",   &davis_data_t::soil_moist1 },
+    { "soil_temperature_2",  "celsius",    &davis_data_t::soil_temp2 },
+    { "soil_moisture_2",     "centibar",   &davis_data_t::soil_moist2 },
+    { "soil_temperature_3",  "celsius",    &davis_data_t::soil_temp3 },
+    { "soil_moisture_3",     "centibar",   &davis_data_t::soil_moist3 },
+    { "soil_temperature_4",  "celsius",    &davis_data_t::soil_temp4 },
+    { "soil_moisture_4",     "centibar",   &davis_data_t::soil_moist4 },
+    { "wind_avg_10min",      "speed",      &davis_data_t::wind_avg_10min },
+    { "wind_avg_2min",       "speed",      &davis_data_t::wind_avg_2min },
+    { "wind_gust_10min",     "speed",      &davis_data_t::wind_gust_10min },
+    { "wind_gust_direction", "degrees",    &davis_data_t::wind_gust_direction },
+    { "dew_point",           "celsius",    &davis_data_t::dew_point },
+    { "heat_index",          "celsius",    &davis_data_t::heat_index },
+    { "wind_chill",          "celsius",    &davis_data_t::wind_chill },
+    { "thsw_index",          "celsius",    &davis_data_t::thsw }
+};
+
+/* Fill in the header for a new binary log */
+void make_binary_header(binary_header_t *header, float barocal, bool wdspd_kmh, bool winddir_180, bool loop2)
+{
+    memset(header, 0, sizeof(binary_header_t));
+    memcpy(header->magic, BINARY_MAGIC, sizeof(header->magic));
+    header->version = BINARY_VERSION;
+    header->header_size = BINARY_HEADER_SIZE;
+    header->record_size = sizeof(binary_record_t);
+    header->field_count = BINARY_FIELDS;
+    header->barocal = barocal;
+    header->wdspd_kmh = wdspd_kmh;
+    header->winddir_180 = winddir_180;
+    header->loop2 = loop2;
+
+    for (int i = 0; i < BINARY_FIELDS; i++) {
+        const char *unit = binary_columns[i].unit;
+        if (strcmp(unit, "speed") == 0) {
+            unit = wdspd_kmh ? "km/h" : "m/s";
+        }
+        strncpy(header->fields[i].name, binary_columns[i].name, BINARY_NAME_SIZE - 1);
+        strncpy(header->fields[i].unit, unit, BINARY_UNIT_SIZE - 1);
+    }
+}
+
+/* Fill in a binary log record from the davis_data struct */
+void make_binary_record(binary_record_t *record, davis_data_t davis_data, int64_t timestamp_ms, int32_t utc_offset)
+{
+    memset(record, 0, sizeof(binary_record_t));
+    record->timestamp_ms = timestamp_ms;
+    record->utc_offset = utc_offset;
+    for (int i = 0; i < BINARY_FIELDS; i++) {
+        record->values[i] = davis_data.*(binary_columns[i].member);
+    }
+}
+
+/* Convert a binary log record back to the davis_data struct */
+davis_data_t binary_record_data(const binary_record_t *record)
+{
+    davis_data_t davis_data;
+
+    for (int i = 0; i < BINARY_FIELDS; i++) {
+        davis_data.*(binary_columns[i].member) = record->values[i];
+    }
+    return davis_data;
+}
+
+/* Returns the local time of a record, in the same format as the daily logs: "2017-01-30T15:30:45.250+1000" */
+string binary_record_datetime(const binary_record_t *record)
+{
+    char buffer[DATESIZE + 10];
+    struct tm timeinfo;
+    time_t local_time = (time_t) (record->timestamp_ms / 1000) + record->utc_offset;
+    int millis = (int) (record->timestamp_ms % 1000);
+    int offset_minutes = record->utc_offset / 60;
+    char sign = '+';
+
+    gmtime_r(&local_time, &timeinfo);
+    if (offset_minutes < 0) {
+        sign = '-';
+        offset_minutes = -offset_minutes;
+    }
+    size_t length = strftime(buffer, sizeof(buffer), "%Y-%m-%dT%H:%M:%S", &timeinfo);
+    snprintf(&buffer[length], sizeof(buffer) - length, ".%03d%c%02d%02d", millis, sign, offset_minutes / 60, offset_minutes % 60);
+
+    return string(buffer);
+}
+
+/* Convert a binary log to the same CSV as the daily logs, and write it to 'out'. Returns 0 on success */
+int binary_to_csv(string filename, ostream &out)
+{
+    struct stat st_file;
+
+    int filedesc = open(filename.c_str(), O_RDONLY);
+    if (filedesc < 0) {
+        cout << "Cannot open binary log: " << filename << endl;
+        return 2;
+    }
+    if ((fstat(filedesc, &st_file) != 0) or (st_file.st_size < BINARY_HEADER_SIZE)) {
+        cout << "Not a binary log: " << filename << endl;
+        close(filedesc);
+        return 2;
+    }
+
+    void *mapped = mmap(NULL, st_file.st_size, PROT_READ, MAP_PRIVATE, filedesc, 0);
+    close(filedesc);
+    if (mapped == MAP_FAILED) {
+        cout << "Cannot map binary log: " << filename << endl;
+        return 2;
+    }
+
+    const binary_header_t *header = (const binary_header_t *) mapped;
+    if ((memcmp(header->magic, BINARY_MAGIC, sizeof(header->magic)) != 0) or (header->version != BINARY_VERSION) or
+        (header->header_size != BINARY_HEADER_SIZE) or (header->header_size > (uint64_t) st_file.st_size) or
+        (header->record_size != sizeof(binary_record_t)) or (header->field_count != BINARY_FIELDS)) {
+        cout << "Not a binary log, or an unsupported version: " << filename << endl;
+        munmap(mapped, st_file.st_size);
+        return 2;
+    }
+
+    /* A partly written record at the end is ignored */
+    size_t records = (st_file.st_size - header->header_size) / header->record_size;
+    const binary_record_t *record = (const binary_record_t *) ((const char *) mapped + header->header_size);
+
+    char line[LINE_SIZE];
+    out << header_line(header->wdspd_kmh, header->loop2) << "\n";
+    for (size_t i = 0; i < records; i++) {
+        davis_data_t davis_data = binary_record_data(&record[i]);
+        size_t length = format_result(line, sizeof(line) - 1, davis_data, header->loop2, binary_record_datetime(&record[i]).c_str());
+        line[length] = '\n';
+        out.write(line, length + 1);
+    }
+
+    munmap(mapped, st_file.st_size);
+    return 0;
+}
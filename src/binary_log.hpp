@@ -0,0 +1,81 @@
+/* Copyright (c) 2013-2018 Ardexa Pty Ltd. All rights reserved.
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef BINARY_LOG_HPP_INCLUDED
+#define BINARY_LOG_HPP_INCLUDED
+
+#include <string>
+#include <iostream>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "configs.hpp"
+#include "utils.hpp"
+
+using namespace std;
+
+/* The binary log is a header of BINARY_HEADER_SIZE bytes, followed by fixed size records. All values are little
+   endian, as written by the Raspberry Pi and x86. Because every record is the same size, the whole file can be
+   mmap'ed and any column read with a fixed stride, without parsing any text.
+
+   The header holds the schema (the name and unit of each column) and the calibration that was used, so the
+   values can be converted back to the same CSV as the daily logs. */
+
+#define BINARY_MAGIC "DAVISBIN"
+#define BINARY_VERSION 1
+#define BINARY_HEADER_SIZE 4096
+#define BINARY_RECORD_SIZE 128
+#define BINARY_FIELDS 27            /* The 19 LOOP columns, then the 8 LOOP2 columns */
+#define BINARY_NAME_SIZE 48
+#define BINARY_UNIT_SIZE 16
+
+typedef struct binary_field_s {
+    char name[BINARY_NAME_SIZE];
+    char unit[BINARY_UNIT_SIZE];
+} binary_field_t;
+
+typedef struct binary_header_s {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;           /* Offset of the first record */
+    uint32_t record_size;
+    uint32_t field_count;
+    float barocal;
+    uint8_t wdspd_kmh;
+    uint8_t winddir_180;
+    uint8_t loop2;                  /* If 0, the LOOP2 columns are all error values */
+    uint8_t reserved;
+    binary_field_t fields[BINARY_FIELDS];
+} binary_header_t;
+
+typedef struct binary_record_s {
+    int64_t timestamp_ms;           /* Milliseconds since the epoch (UTC) */
+    int32_t utc_offset;             /* Seconds east of UTC, of the local time when it was logged */
+    uint32_t reserved;
+    float values[BINARY_FIELDS];    /* In the same order as the CSV columns */
+    uint32_t padding;               /* Makes the record 128 bytes */
+} binary_record_t;
+
+/* The structs are written to the file as they are, so their layout is the file's */
+static_assert(sizeof(binary_header_t) <= BINARY_HEADER_SIZE, "The binary log header doesn't fit in BINARY_HEADER_SIZE");
+static_assert(sizeof(binary_record_t) == BINARY_RECORD_SIZE, "A binary log record isn't BINARY_RECORD_SIZE bytes");
+
+void make_binary_header(binary_header_t *header, float barocal, bool wdspd_kmh, bool winddir_180, bool loop2);
+void make_binary_record(binary_record_t *record, davis_data_t davis_data, int64_t timestamp_ms, int32_t utc_offset);
+davis_data_t binary_record_data(const binary_record_t *record);
+string binary_record_datetime(const binary_record_t *record);
+int binary_to_csv(string filename, ostream &out);
+
+#endif /* BINARY_LOG_HPP_INCLUDED */
@@ -0,0 +1,595 @@
+/* Copyright (c) 2013-2018 Ardexa Pty Ltd. All rights reserved.
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+
+#include <float.h>
+#include <stddef.h>
+#include <errno.h>
+#include <math.h>
+#include "block_store.hpp"
+
+/* The buckets for the delta of the delta of the timestamps (in milliseconds), after a '1' bit. The prefix and its
+   length, then the number of bits in the value. A delta of the delta of 0 is a single '0' bit */
+typedef struct dod_bucket_s {
+    uint64_t prefix;
+    int prefix_bits;
+    int value_bits;
+} dod_bucket_t;
+
+static const dod_bucket_t dod_buckets[] = {
+    { 0x2, 2, 7 },
+    { 0x6, 3, 12 },
+    { 0xe, 4, 20 },
+    { 0xf, 4, 64 }
+};
+#define DOD_BUCKETS (sizeof(dod_buckets) / sizeof(dod_buckets[0]))
+
+/* The state at the start of a block */
+static void clear_block_state(block_state_t *state, int64_t first_ms, int32_t utc_offset)
+{
+    memset(state, 0, sizeof(block_state_t));
+    state->last_ms = first_ms;
+    state->last_offset = utc_offset;
+    memset(state->leading, BLOCK_NO_WINDOW, sizeof(state->leading));
+}
+
+/* Returns true if 'value' isn't the error value */
+static bool valid_value(float value)
+{
+    return value != (float) ERROR_VALUE_FLOAT;
+}
+
+static uint32_t float_bits(float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+static float bits_float(uint32_t bits)
+{
+    float value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+/* Sign extend the low 'bits' of 'value' */
+static int64_t sign_extend(uint64_t value, int bits)
+{
+    if (bits >= 64) return (int64_t) value;
+    uint64_t sign = (uint64_t) 1 << (bits - 1);
+    return (int64_t) ((value ^ sign) - sign);
+}
+
+/* Read 'bits' bits (up to 64) from 'data', most significant first, without going past 'limit' bits.
+   Returns false if there aren't enough */
+static bool get_bits(const unsigned char *data, size_t limit, size_t *pos, int bits, uint64_t *value)
+{
+    if (*pos + bits > limit) {
+        return false;
+    }
+    *value = 0;
+    while (bits > 0) {
+        int available = 8 - (*pos & 7);
+        int take = (bits < available) ? bits : available;
+        uint64_t chunk = (data[*pos >> 3] >> (available - take)) & ((1 << take) - 1);
+        *value = (*value << take) | chunk;
+        *pos += take;
+        bits -= take;
+    }
+    return true;
+}
+
+/* Write all of 'length' bytes at 'offset'. Returns true on success */
+static bool write_at(int filedesc, const unsigned char *buffer, size_t length, off_t offset)
+{
+    size_t done = 0;
+
+    while (done < length) {
+        ssize_t result = pwrite(filedesc, buffer + done, length - done, offset + done);
+        if (result < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        done += result;
+    }
+    return true;
+}
+
+/* Constructor for the block_writer class. The calibration should be set before it is opened */
+block_writer::block_writer()
+{
+    this->filedesc = -1;
+    this->block_offset = 0;
+    this->flushed_bits = 0;
+    memset(this->block, 0, sizeof(this->block));
+    this->set_calibration(1.0, false, false, false);
+    clear_block_state(&this->state, 0, 0);
+}
+
+/* Destructor. The last block is sealed */
+block_writer::~block_writer()
+{
+    this->close();
+}
+
+/* Set the calibration that is written in the header of each block */
+void block_writer::set_calibration(float barocal, bool wdspd_kmh, bool winddir_180, bool loop2)
+{
+    memset(&this->calibration, 0, sizeof(this->calibration));
+    memcpy(this->calibration.magic, BLOCK_MAGIC, sizeof(this->calibration.magic));
+    this->calibration.version = BLOCK_VERSION;
+    this->calibration.wdspd_kmh = wdspd_kmh;
+    this->calibration.winddir_180 = winddir_180;
+    this->calibration.loop2 = loop2;
+    this->calibration.barocal = barocal;
+}
+
+/* Open a block log. If it already has blocks, a new block is started after them, so the last block written
+   before a restart is left as it is. Returns true on success */
+bool block_writer::open(string fullpath)
+{
+    struct stat st_file;
+
+    this->close();
+    this->filedesc = ::open(fullpath.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+    if (this->filedesc < 0) {
+        if (g_debug > 0) cout << "Cannot open block log: " << fullpath << endl;
+        return false;
+    }
+    if (fstat(this->filedesc, &st_file) != 0) {
+        this->close();
+        return false;
+    }
+    this->block_offset = ((st_file.st_size + BLOCK_SIZE - 1) / BLOCK_SIZE) * BLOCK_SIZE;
+    return true;
+}
+
+/* Seal the last block and close the file */
+void block_writer::close()
+{
+    this->seal();
+    if (this->filedesc >= 0) ::close(this->filedesc);
+    this->filedesc = -1;
+    ((block_header_t *) this->block)->count = 0;
+}
+
+/* The file descriptor, or -1 if it isn't open */
+int block_writer::get_filedesc()
+{
+    return this->filedesc;
+}
+
+/* Add a record to the current block. When the block is full, it is written out and a new block started, so
+   returns the bytes written (normally 0), or -1 on error */
+ssize_t block_writer::append(const davis_data_t &davis_data, int64_t timestamp_ms, int32_t utc_offset)
+{
+    binary_record_t record;
+    block_header_t *header = (block_header_t *) this->block;
+    ssize_t written = 0;
+
+    make_binary_record(&record, davis_data, timestamp_ms, utc_offset);
+    if (header->count == 0) {
+        this->start_block(timestamp_ms, utc_offset);
+    }
+
+    block_state_t saved = this->state;
+    if (not this->encode(&record)) {
+        /* Take back the bits of the record that didn't fit, then write out the full block and start the next */
+        unsigned char *data = this->block + sizeof(block_header_t);
+        size_t byte = saved.bit_pos / 8;
+        if (saved.bit_pos % 8 != 0) {
+            data[byte] &= (unsigned char) (0xff00 >> (saved.bit_pos % 8));
+            byte++;
+        }
+        memset(&data[byte], 0, BLOCK_SIZE - sizeof(block_header_t) - byte);
+        this->state = saved;
+
+        written = this->seal();
+        this->block_offset += BLOCK_SIZE;
+        this->start_block(timestamp_ms, utc_offset);
+        this->encode(&record);
+    }
+
+    header->count++;
+    header->data_bits = this->state.bit_pos;
+    if (timestamp_ms < header->min_ms) header->min_ms = timestamp_ms;
+    if (timestamp_ms > header->max_ms) header->max_ms = timestamp_ms;
+    for (int i = 0; i < BINARY_FIELDS; i++) {
+        float value = record.values[i];
+        if (not valid_value(value)) continue;
+        if (value < header->min[i]) header->min[i] = value;
+        if (value > header->max[i]) header->max[i] = value;
+    }
+
+    return written;
+}
+
+/* Write the records added since the last flush, then the header that counts them (but not the min and max, which
+   would be most of the bytes written). The block isn't padded, so the last block of a file can be short. Returns
+   the bytes written, or -1 on error */
+ssize_t block_writer::flush()
+{
+    block_header_t *header = (block_header_t *) this->block;
+
+    if ((header->count == 0) or (this->state.bit_pos == this->flushed_bits)) {
+        return 0;
+    }
+    if (this->filedesc < 0) {
+        return -1;
+    }
+
+    size_t start = sizeof(block_header_t) + this->flushed_bits / 8;
+    size_t end = sizeof(block_header_t) + (this->state.bit_pos + 7) / 8;
+    size_t header_size = offsetof(block_header_t, min);
+    if ((not write_at(this->filedesc, this->block + start, end - start, this->block_offset + start)) or
+        (not write_at(this->filedesc, this->block, header_size, this->block_offset))) {
+        if (g_debug > 0) cout << "Error writing to a block log" << endl;
+        return -1;
+    }
+    this->flushed_bits = this->state.bit_pos;
+
+    return (end - start) + header_size;
+}
+
+/* Write the rest of the block and its whole header, marked as sealed. Returns the bytes written, or -1 on error */
+ssize_t block_writer::seal()
+{
+    block_header_t *header = (block_header_t *) this->block;
+
+    if (header->count == 0) {
+        return 0;
+    }
+    ssize_t written = this->flush();
+    if (written < 0) {
+        return -1;
+    }
+    header->flags |= BLOCK_SEALED;
+    if (not write_at(this->filedesc, this->block, sizeof(block_header_t), this->block_offset)) {
+        if (g_debug > 0) cout << "Error writing to a block log" << endl;
+        return -1;
+    }
+    header->count = 0;
+
+    return written + sizeof(block_header_t);
+}
+
+/* Start an empty block, with the first record at 'timestamp_ms' */
+void block_writer::start_block(int64_t timestamp_ms, int32_t utc_offset)
+{
+    block_header_t *header = (block_header_t *) this->block;
+
+    memset(this->block, 0, sizeof(this->block));
+    memcpy(header, &this->calibration, sizeof(block_header_t));
+    header->min_ms = timestamp_ms;
+    header->max_ms = timestamp_ms;
+    header->first_ms = timestamp_ms;
+    header->utc_offset = utc_offset;
+    for (int i = 0; i < BINARY_FIELDS; i++) {
+        header->min[i] = FLT_MAX;
+        header->max[i] = -FLT_MAX;
+    }
+    clear_block_state(&this->state, timestamp_ms, utc_offset);
+    this->flushed_bits = 0;
+}
+
+/* Add 'bits' bits (up to 64) of 'value' to the block, most significant first. Returns false if it is full */
+bool block_writer::put_bits(uint64_t value, int bits)
+{
+    unsigned char *data = this->block + sizeof(block_header_t);
+
+    if (this->state.bit_pos + bits > BLOCK_DATA_BITS) {
+        return false;
+    }
+    while (bits > 0) {
+        int available = 8 - (this->state.bit_pos & 7);
+        int take = (bits < available) ? bits : available;
+        unsigned char chunk = (value >> (bits - take)) & ((1 << take) - 1);
+        data[this->state.bit_pos >> 3] |= chunk << (available - take);
+        this->state.bit_pos += take;
+        bits -= take;
+    }
+    return true;
+}
+
+/* Encode a record after the last one. Returns false if it doesn't fit, leaving the state part way through */
+bool block_writer::encode(const binary_record_t *record)
+{
+    block_state_t *state = &this->state;
+
+    /* The timestamp, as the change in the time since the record before */
+    int64_t delta = record->timestamp_ms - state->last_ms;
+    int64_t dod = delta - state->last_delta;
+    state->last_ms = record->timestamp_ms;
+    state->last_delta = delta;
+    if (dod == 0) {
+        if (not this->put_bits(0, 1)) return false;
+    }
+    else {
+        for (size_t i = 0; i < DOD_BUCKETS; i++) {
+            int bits = dod_buckets[i].value_bits;
+            if ((bits < 64) and ((dod < -((int64_t) 1 << (bits - 1))) or (dod >= ((int64_t) 1 << (bits - 1))))) continue;
+            uint64_t mask = (bits < 64) ? (((uint64_t) 1 << bits) - 1) : ~((uint64_t) 0);
+            if ((not this->put_bits(dod_buckets[i].prefix, dod_buckets[i].prefix_bits)) or
+                (not this->put_bits((uint64_t) dod & mask, bits))) return false;
+            break;
+        }
+    }
+
+    /* The UTC offset only changes twice a year, if at all */
+    if (record->utc_offset == state->last_offset) {
+        if (not this->put_bits(0, 1)) return false;
+    }
+    else {
+        if ((not this->put_bits(1, 1)) or (not this->put_bits((uint32_t) record->utc_offset, 32))) return false;
+        state->last_offset = record->utc_offset;
+    }
+
+    /* Each value is XOR'ed with the one before. If the bits that differ fit in the window of the last XOR that
+       was stored in full, only they are stored. Otherwise the window is stored with them */
+    for (int i = 0; i < BINARY_FIELDS; i++) {
+        uint32_t value = float_bits(record->values[i]);
+        uint32_t xored = value ^ state->last_value[i];
+        state->last_value[i] = value;
+        if (xored == 0) {
+            if (not this->put_bits(0, 1)) return false;
+            continue;
+        }
+
+        int leading = __builtin_clz(xored);
+        int trailing = __builtin_ctz(xored);
+        if ((state->leading[i] != BLOCK_NO_WINDOW) and (leading >= state->leading[i]) and (trailing >= state->trailing[i])) {
+            int meaningful = 32 - state->leading[i] - state->trailing[i];
+            if ((not this->put_bits(0x2, 2)) or (not this->put_bits(xored >> state->trailing[i], meaningful))) return false;
+        }
+        else {
+            int meaningful = 32 - leading - trailing;
+            if ((not this->put_bits(0x3, 2)) or (not this->put_bits(leading, 5)) or (not this->put_bits(meaningful - 1, 5)) or
+                (not this->put_bits(xored >> trailing, meaningful))) return false;
+            state->leading[i] = leading;
+            state->trailing[i] = trailing;
+        }
+    }
+
+    return true;
+}
+
+/* Returns true if this looks like the header of a block */
+bool block_header_valid(const block_header_t *header)
+{
+    return (memcmp(header->magic, BLOCK_MAGIC, sizeof(header->magic)) == 0) and (header->version == BLOCK_VERSION) and
+           (header->count > 0) and (header->data_bits <= BLOCK_DATA_BITS);
+}
+
+/* Decode the records of a block of 'size' bytes, and add them to 'records'. Returns the number of records, or -1
+   if it isn't a valid block */
+int decode_block(const unsigned char *block, size_t size, vector<binary_record_t> *records)
+{
+    block_header_t header;
+    block_state_t state;
+    uint64_t bits;
+
+    if (size < sizeof(block_header_t)) {
+        return -1;
+    }
+    memcpy(&header, block, sizeof(header));
+    if ((not block_header_valid(&header)) or (sizeof(block_header_t) + (header.data_bits + 7) / 8 > size)) {
+        return -1;
+    }
+
+    const unsigned char *data = block + sizeof(block_header_t);
+    size_t limit = header.data_bits;
+    size_t first = records->size();
+    clear_block_state(&state, header.first_ms, header.utc_offset);
+
+    for (int n = 0; n < header.count; n++) {
+        binary_record_t record;
+        memset(&record, 0, sizeof(record));
+
+        /* The timestamp. Count the '1's of the prefix to find the bucket */
+        int64_t dod = 0;
+        size_t ones = 0;
+        while (ones < DOD_BUCKETS) {
+            if (not get_bits(data, limit, &state.bit_pos, 1, &bits)) goto invalid;
+            if (bits == 0) break;
+            ones++;
+        }
+        if (ones > 0) {
+            const dod_bucket_t *bucket = &dod_buckets[ones - 1];
+            if (not get_bits(data, limit, &state.bit_pos, bucket->value_bits, &bits)) goto invalid;
+            dod = sign_extend(bits, bucket->value_bits);
+        }
+        state.last_delta += dod;
+        state.last_ms += state.last_delta;
+        record.timestamp_ms = state.last_ms;
+
+        if (not get_bits(data, limit, &state.bit_pos, 1, &bits)) goto invalid;
+        if (bits != 0) {
+            if (not get_bits(data, limit, &state.bit_pos, 32, &bits)) goto invalid;
+            state.last_offset = (int32_t) (uint32_t) bits;
+        }
+        record.utc_offset = state.last_offset;
+
+        for (int i = 0; i < BINARY_FIELDS; i++) {
+            if (not get_bits(data, limit, &state.bit_pos, 1, &bits)) goto invalid;
+            if (bits != 0) {
+                if (not get_bits(data, limit, &state.bit_pos, 1, &bits)) goto invalid;
+                if (bits != 0) {
+                    uint64_t leading, meaningful;
+                    if ((not get_bits(data, limit, &state.bit_pos, 5, &leading)) or
+                        (not get_bits(data, limit, &state.bit_pos, 5, &meaningful))) goto invalid;
+                    meaningful++;
+                    if (leading + meaningful > 32) goto invalid;
+                    state.leading[i] = leading;
+                    state.trailing[i] = 32 - leading - meaningful;
+                }
+                else if (state.leading[i] == BLOCK_NO_WINDOW) {
+                    goto invalid;
+                }
+                int meaningful = 32 - state.leading[i] - state.trailing[i];
+                if (not get_bits(data, limit, &state.bit_pos, meaningful, &bits)) goto invalid;
+                state.last_value[i] ^= (uint32_t) (bits << state.trailing[i]);
+            }
+            record.values[i] = bits_float(state.last_value[i]);
+        }
+        records->push_back(record);
+    }
+    return header.count;
+
+invalid:
+    records->resize(first);
+    return -1;
+}
+
+/* Map a whole file for reading. Returns NULL if it can't, or it is empty */
+static const unsigned char *map_file(string filename, size_t *size)
+{
+    struct stat st_file;
+
+    int filedesc = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    if (filedesc < 0) {
+        return NULL;
+    }
+    if ((fstat(filedesc, &st_file) != 0) or (st_file.st_size == 0)) {
+        close(filedesc);
+        return NULL;
+    }
+    void *mapped = mmap(NULL, st_file.st_size, PROT_READ, MAP_PRIVATE, filedesc, 0);
+    close(filedesc);
+    if (mapped == MAP_FAILED) {
+        return NULL;
+    }
+    *size = st_file.st_size;
+    return (const unsigned char *) mapped;
+}
+
+/* Returns true if the file starts with a block */
+bool is_block_log(string filename)
+{
+    char magic[sizeof(((block_header_t *) 0)->magic)];
+
+    int filedesc = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    if (filedesc < 0) {
+        return false;
+    }
+    bool found = (read(filedesc, magic, sizeof(magic)) == (ssize_t) sizeof(magic)) and (memcmp(magic, BLOCK_MAGIC, sizeof(magic)) == 0);
+    close(filedesc);
+    return found;
+}
+
+/* Convert a block log to the same CSV as the daily logs, and write it to 'out'. Blocks that aren't valid (such as
+   one that was never written) are skipped. Returns 0 on success */
+int blocks_to_csv(string filename, ostream &out)
+{
+    size_t size;
+    const unsigned char *mapped = map_file(filename, &size);
+    if (mapped == NULL) {
+        cout << "Cannot open block log: " << filename << endl;
+        return 2;
+    }
+
+    vector<binary_record_t> records;
+    char line[LINE_SIZE];
+    bool header_written = false;
+    for (size_t offset = 0; offset < size; offset += BLOCK_SIZE) {
+        size_t length = (size - offset < BLOCK_SIZE) ? size - offset : BLOCK_SIZE;
+        records.clear();
+        if (decode_block(&mapped[offset], length, &records) < 0) {
+            continue;
+        }
+
+        const block_header_t *header = (const block_header_t *) &mapped[offset];
+        if (not header_written) {
+            out << header_line(header->wdspd_kmh, header->loop2) << "\n";
+            header_written = true;
+        }
+        for (size_t i = 0; i < records.size(); i++) {
+            davis_data_t davis_data = binary_record_data(&records[i]);
+            size_t line_length = format_result(line, sizeof(line) - 1, davis_data, header->loop2, binary_record_datetime(&records[i]).c_str());
+            line[line_length] = '\n';
+            out.write(line, line_length + 1);
+        }
+    }
+
+    munmap((void *) mapped, size);
+    if (not header_written) {
+        cout << "Not a block log, or an unsupported version: " << filename << endl;
+        return 2;
+    }
+    return 0;
+}
+
+/* Add the values of 'columns' in the records of a block log between 'start_ms' and 'end_ms' to 'stats', as
+   query_log_file() does. Blocks that are all outside the range are skipped by their header, without decoding
+   them. Returns the number of records in the range */
+int query_block_file(string filename, int64_t start_ms, int64_t end_ms, const vector<int> &columns, vector<column_stats_t> *stats)
+{
+    size_t size;
+    int lines = 0;
+    const unsigned char *mapped = map_file(filename, &size);
+    if (mapped == NULL) {
+        return 0;
+    }
+
+    vector<binary_record_t> records;
+    for (size_t offset = 0; offset < size; offset += BLOCK_SIZE) {
+        size_t length = (size - offset < BLOCK_SIZE) ? size - offset : BLOCK_SIZE;
+        if (length < sizeof(block_header_t)) break;
+        const block_header_t *header = (const block_header_t *) &mapped[offset];
+        if ((not block_header_valid(header)) or (header->max_ms < start_ms) or (header->min_ms > end_ms)) continue;
+
+        records.clear();
+        if (decode_block(&mapped[offset], length, &records) < 0) continue;
+        for (size_t n = 0; n < records.size(); n++) {
+            if ((records[n].timestamp_ms < start_ms) or (records[n].timestamp_ms > end_ms)) continue;
+            lines++;
+            for (size_t i = 0; i < columns.size(); i++) {
+                if ((columns[i] < 0) or (columns[i] >= BINARY_FIELDS)) continue;
+                double value = records[n].values[columns[i]];
+                if (not valid_value(value)) continue;
+
+                column_stats_t *column_stats = &(*stats)[i];
+                column_stats->count++;
+                column_stats->sum += value;
+                if (value < column_stats->min) column_stats->min = value;
+                if (value > column_stats->max) column_stats->max = value;
+            }
+        }
+    }
+
+    munmap((void *) mapped, size);
+    return lines;
+}
+
+/* Returns the header line of the CSV for a block log (without the leading "# "), or an empty string */
+string read_block_header_line(string filename)
+{
+    size_t size;
+    string header;
+    const unsigned char *mapped = map_file(filename, &size);
+    if (mapped == NULL) {
+        return header;
+    }
+
+    for (size_t offset = 0; offset + sizeof(block_header_t) <= size; offset += BLOCK_SIZE) {
+        const block_header_t *block_header = (const block_header_t *) &mapped[offset];
+        if (block_header_valid(block_header)) {
+            header = header_line(block_header->wdspd_kmh, block_header->loop2).substr(2);
+            break;
+        }
+    }
+
+    munmap((void *) mapped, size);
+    return header;
+}
@@ -0,0 +1,124 @@
+/* Copyright (c) 2013-2018 Ardexa Pty Ltd. All rights reserved.
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+
+#ifndef BLOCK_STORE_HPP_INCLUDED
+#define BLOCK_STORE_HPP_INCLUDED
+
+#include <string>
+#include <vector>
+#include <iostream>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "configs.hpp"
+#include "utils.hpp"
+#include "binary_log.hpp"
+#include "log_index.hpp"
+
+using namespace std;
+
+/* The block log 'davis_YYYY-MM-DD.blk' holds the same records as the binary log, compressed in the manner of
+   Facebook's Gorilla. The file is a row of BLOCK_SIZE byte blocks, and each block can be decoded on its own: its
+   header holds the calibration, the number of records, the range of their timestamps and the min and max of each
+   column, so a query can skip the blocks it doesn't need without decoding them.
+
+   After the header, the records are a stream of bits. The timestamps are stored as the change in the time
+   between records (the delta of the delta), which is a single bit when the records are evenly spaced. Each value
+   is XOR'ed with the value before it in the same column: a value that hasn't changed is a single bit, and one that
+   has only stores the bits that differ. The UTC offset is a single bit, unless it changed. Nothing is lost, so
+   decoding gives back exactly the floats of the binary log.
+
+   Each time the logs are flushed, the new records of the block being filled are written, with the part of its
+   header before the min and max, so at most the records waiting to be flushed are lost. The block is sealed (its
+   whole header written) when it is full, or the file is closed, and the next one starts BLOCK_SIZE bytes further
+   on. The min and max of a block that isn't sealed (such as the last one, after a crash) can't be relied on */
+
+#define BLOCK_MAGIC "DVBK"
+#define BLOCK_VERSION 1
+#define BLOCK_SIZE 4096
+#define BLOCK_SUFFIX ".blk"
+#define BLOCK_SEALED 0x1            /* The block won't change, and its min and max are complete */
+#define BLOCK_NO_WINDOW 0xff        /* No XOR of the column has been stored in full yet */
+
+typedef struct block_header_s {
+    char magic[4];
+    uint8_t version;
+    uint8_t wdspd_kmh;
+    uint8_t winddir_180;
+    uint8_t loop2;                  /* If 0, the LOOP2 columns are all error values */
+    float barocal;
+    uint16_t count;                 /* Records in the block */
+    uint16_t data_bits;             /* Length of the encoded records after the header */
+    int64_t min_ms;                 /* The earliest and latest timestamps in the block */
+    int64_t max_ms;
+    int64_t first_ms;               /* The timestamp and UTC offset that the first record is encoded against */
+    int32_t utc_offset;
+    uint32_t flags;                 /* BLOCK_SEALED once the block is finished */
+    float min[BINARY_FIELDS];       /* Not counting error values. If a column has none, its min is above its max. */
+    float max[BINARY_FIELDS];       /* These are only written when the block is sealed */
+} block_header_t;
+
+#define BLOCK_DATA_BITS ((BLOCK_SIZE - sizeof(block_header_t)) * 8)
+
+/* The state that each record is encoded against. The decoder keeps the same state */
+typedef struct block_state_s {
+    size_t bit_pos;
+    int64_t last_ms;
+    int64_t last_delta;
+    int32_t last_offset;
+    uint32_t last_value[BINARY_FIELDS];
+    uint8_t leading[BINARY_FIELDS];     /* The window of the last XOR stored in full, or BLOCK_NO_WINDOW */
+    uint8_t trailing[BINARY_FIELDS];
+} block_state_t;
+
+/* This class writes a daily block log. Like the log_writer, it is given the records one at a time, and only
+   writes when it is flushed, or when a block is full */
+class block_writer
+{
+    public:
+        /* methods are public */
+        block_writer();
+        ~block_writer();
+        void set_calibration(float barocal, bool wdspd_kmh, bool winddir_180, bool loop2);
+        bool open(string fullpath);
+        void close();
+        ssize_t append(const davis_data_t &davis_data, int64_t timestamp_ms, int32_t utc_offset);
+        ssize_t flush();
+        ssize_t seal();
+        int get_filedesc();
+
+    private:
+        /* members are private */
+        void start_block(int64_t timestamp_ms, int32_t utc_offset);
+        bool encode(const binary_record_t *record);
+        bool put_bits(uint64_t value, int bits);
+        block_header_t calibration;
+        unsigned char block[BLOCK_SIZE];
+        block_state_t state;
+        int filedesc;
+        off_t block_offset;             /* Where the current block goes in the file */
+        size_t flushed_bits;            /* Bits of the current block that are already in the file */
+};
+
+bool block_header_valid(const block_header_t *header);
+int decode_block(const unsigned char *block, size_t size, vector<binary_record_t> *records);
+bool is_block_log(string filename);
+int blocks_to_csv(string filename, ostream &out);
+int query_block_file(string filename, int64_t start_ms, int64_t end_ms, const vector<int> &columns, vector<column_stats_t> *stats);
+string read_block_header_line(string filename);
+
+#endif /* BLOCK_STORE_HPP_INCLUDED */
@@ -0,0 +1,292 @@
+/* Copyright (c) 2013-2018 Ardexa Pty Ltd. All rights reserved.
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+
+#include "capture.hpp"
+#include "histogram.hpp"
+
+/* Constructor for the capture_writer class. 'prefix' is the start of the daily file names, such as "davis_", and
+   'device' is written in the header of each file */
+capture_writer::capture_writer(string directory, string prefix, string device)
+{
+    /* Add an ending '/' to the directory path, if it doesn't exist */
+    if (*directory.rbegin() != '/') {
+        directory += "/";
+    }
+    this->directory = directory;
+    this->prefix = prefix;
+    this->flush_records = DEFAULT_FLUSH_RECORDS;
+    this->flush_ms = DEFAULT_FLUSH_MS;
+    this->filedesc = -1;
+    this->day_start_ms = 0;
+    this->day_end_ms = 0;
+    this->records_waiting = 0;
+    this->oldest_waiting_ms = 0;
+
+    memset(&this->header, 0, sizeof(this->header));
+    memcpy(this->header.magic, CAPTURE_MAGIC, sizeof(this->header.magic));
+    this->header.version = CAPTURE_VERSION;
+    this->header.header_size = CAPTURE_HEADER_SIZE;
+    this->header.record_size = sizeof(capture_record_t);
+    this->header.frame_size = LOOP_PACKET_SIZE;
+    strncpy(this->header.device, device.c_str(), CAPTURE_DEVICE_SIZE - 1);
+}
+
+/* Destructor. Anything still buffered is written */
+capture_writer::~capture_writer()
+{
+    this->flush();
+    this->close_file();
+}
+
+/* Set when the buffered records are written, as log_writer::set_durability() */
+void capture_writer::set_durability(int flush_records, int flush_ms)
+{
+    this->flush_records = (flush_records < 1) ? 1 : flush_records;
+    this->flush_ms = (flush_ms < 0) ? 0 : flush_ms;
+}
+
+/* Add a packet of LOOP_PACKET_SIZE bytes, received at 'realtime_ns'. Returns 0 on success */
+int capture_writer::append(const unsigned char *frame, int64_t realtime_ns, int32_t utc_offset)
+{
+    capture_record_t record;
+    int64_t timestamp_ms = realtime_ns / 1000000;
+
+    /* Start a new daily file if this packet is from a different day */
+    if ((timestamp_ms < this->day_start_ms) or (timestamp_ms >= this->day_end_ms)) {
+        int result = this->rotate(timestamp_ms);
+        if (result != 0) {
+            return result;
+        }
+    }
+
+    memset(&record, 0, sizeof(record));
+    record.realtime_ns = realtime_ns;
+    record.utc_offset = utc_offset;
+    memcpy(record.frame, frame, LOOP_PACKET_SIZE);
+    this->buffer.append((const char *) &record, sizeof(record));
+
+    if (this->records_waiting == 0) {
+        this->oldest_waiting_ms = monotonic_now_ms();
+    }
+    this->records_waiting++;
+    this->frames.add();
+
+    if (this->records_waiting >= this->flush_records) {
+        return this->flush();
+    }
+    return this->flush_if_due();
+}
+
+/* Write the buffered records if the oldest has waited long enough. Returns 0 on success */
+int capture_writer::flush_if_due()
+{
+    if ((this->records_waiting > 0) and (monotonic_now_ms() - this->oldest_waiting_ms >= this->flush_ms)) {
+        return this->flush();
+    }
+    return 0;
+}
+
+/* Write all the buffered records. Returns 0 on success */
+int capture_writer::flush()
+{
+    size_t done = 0;
+
+    if (this->buffer.empty()) {
+        return 0;
+    }
+    this->records_waiting = 0;
+    if (this->filedesc < 0) {
+        this->buffer.clear();
+        this->write_errors.add();
+        return 2;
+    }
+
+    while (done < this->buffer.length()) {
+        ssize_t result = write(this->filedesc, this->buffer.data() + done, this->buffer.length() - done);
+        if (result < 0) {
+            if (errno == EINTR) continue;
+            if (g_debug > 0) cout << "Error writing to a capture file" << endl;
+            break;
+        }
+        done += result;
+    }
+    this->bytes_written.add(done);
+    bool complete = (done == this->buffer.length());
+    this->buffer.clear();
+    if (not complete) {
+        this->write_errors.add();
+        return 2;
+    }
+    return 0;
+}
+
+/* Add the counts to the metrics. 'labels' tells the captures apart */
+void capture_writer::register_metrics(metrics_registry &registry, string labels)
+{
+    registry.add("davis_capture_frames_total", METRIC_COUNTER, "Packets captured", labels, &this->frames);
+    registry.add("davis_capture_write_errors_total", METRIC_COUNTER, "Writes of the captures that failed", labels, &this->write_errors);
+    registry.add("davis_capture_bytes_written_total", METRIC_COUNTER, "Bytes written to the captures", labels, &this->bytes_written);
+}
+
+/* Close the file of the current day, and open the one for the day of 'timestamp_ms'. Returns 0 on success */
+int capture_writer::rotate(int64_t timestamp_ms)
+{
+    char date[DATESIZE];
+
+    /* Anything buffered belongs to the old file */
+    this->flush();
+    this->close_file();
+
+    date_string(local_day(timestamp_ms, &this->day_start_ms, &this->day_end_ms), date, sizeof(date));
+    if ((not check_directory(this->directory)) and (not create_directory(this->directory))) {
+        this->day_end_ms = 0;
+        return 2;
+    }
+
+    string fullpath = this->directory + this->prefix + date + CAPTURE_SUFFIX;
+    this->filedesc = open(fullpath.c_str(), O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    if (this->filedesc < 0) {
+        if (g_debug > 0) cout << "Cannot open capture file: " << fullpath << endl;
+        this->day_end_ms = 0;
+        return 2;
+    }
+
+    /* A record cut short by a crash would put all the ones after it out of step, so it is removed. A new file
+       needs the header, padded out to CAPTURE_HEADER_SIZE */
+    if (trim_torn_tail(this->filedesc, CAPTURE_HEADER_SIZE, sizeof(capture_record_t)) == 0) {
+        string header_block(CAPTURE_HEADER_SIZE, '\0');
+        memcpy(&header_block[0], &this->header, sizeof(this->header));
+        this->buffer += header_block;
+    }
+    return 0;
+}
+
+/* Close the file */
+void capture_writer::close_file()
+{
+    if (this->filedesc >= 0) close(this->filedesc);
+    this->filedesc = -1;
+}
+
+/* Constructor for the capture_reader class */
+capture_reader::capture_reader()
+{
+    this->mapped = NULL;
+    this->mapped_size = 0;
+    this->count = 0;
+}
+
+capture_reader::~capture_reader()
+{
+    this->close();
+}
+
+/* Map a capture. Returns false (after printing the reason) if it can't be read, or isn't a capture */
+bool capture_reader::open(string filename)
+{
+    struct stat st_file;
+
+    this->close();
+    int filedesc = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    if (filedesc < 0) {
+        cout << "Cannot open capture file: " << filename << endl;
+        return false;
+    }
+    if ((fstat(filedesc, &st_file) != 0) or (st_file.st_size < CAPTURE_HEADER_SIZE)) {
+        cout << "Not a capture file: " << filename << endl;
+        ::close(filedesc);
+        return false;
+    }
+    void *mapped = mmap(NULL, st_file.st_size, PROT_READ, MAP_PRIVATE, filedesc, 0);
+    ::close(filedesc);
+    if (mapped == MAP_FAILED) {
+        cout << "Cannot map capture file: " << filename << endl;
+        return false;
+    }
+    this->mapped = mapped;
+    this->mapped_size = st_file.st_size;
+
+    const capture_header_t *header = this->get_header();
+    if ((memcmp(header->magic, CAPTURE_MAGIC, sizeof(header->magic)) != 0) or (header->version != CAPTURE_VERSION) or
+        (header->header_size < sizeof(capture_header_t)) or (header->header_size > this->mapped_size) or
+        (header->record_size != sizeof(capture_record_t)) or (header->frame_size != LOOP_PACKET_SIZE)) {
+        cout << "Not a capture file, or an unsupported version: " << filename << endl;
+        this->close();
+        return false;
+    }
+
+    /* A partly written record at the end is ignored */
+    this->count = (this->mapped_size - header->header_size) / header->record_size;
+    return true;
+}
+
+/* Unmap the capture */
+void capture_reader::close()
+{
+    if (this->mapped) munmap(this->mapped, this->mapped_size);
+    this->mapped = NULL;
+    this->mapped_size = 0;
+    this->count = 0;
+}
+
+const capture_header_t *capture_reader::get_header()
+{
+    return (const capture_header_t *) this->mapped;
+}
+
+const capture_record_t *capture_reader::get_records()
+{
+    return (const capture_record_t *) ((const char *) this->mapped + this->get_header()->header_size);
+}
+
+size_t capture_reader::get_count()
+{
+    return this->count;
+}
+
+/* The index of the first record received at or after 'realtime_ns' (or get_count(), if there is none). If the
+   clock was set back while capturing, the records aren't quite in order, and this is only approximate */
+size_t capture_reader::find(int64_t realtime_ns)
+{
+    const capture_record_t *records = this->get_records();
+    size_t low = 0, high = this->count;
+
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        if (records[middle].realtime_ns < realtime_ns) low = middle + 1;
+        else high = middle;
+    }
+    return low;
+}
+
+/* Returns true if the packet of a record has a good CRC, so it was written in full */
+bool capture_reader::valid(size_t index)
+{
+    return (index < this->count) and crc16_check(this->get_records()[index].frame, LOOP_PACKET_SIZE);
+}
+
+/* Returns true if the file starts as a capture does */
+bool is_capture_file(string filename)
+{
+    char magic[sizeof(((capture_header_t *) 0)->magic)];
+
+    int filedesc = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    if (filedesc < 0) {
+        return false;
+    }
+    bool found = (read(filedesc, magic, sizeof(magic)) == (ssize_t) sizeof(magic)) and (memcmp(magic, CAPTURE_MAGIC, sizeof(magic)) == 0);
+    close(filedesc);
+    return found;
+}
@@ -0,0 +1,125 @@
+/* Copyright (c) 2013-2018 Ardexa Pty Ltd. All rights reserved.
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+
+#ifndef CAPTURE_HPP_INCLUDED
+#define CAPTURE_HPP_INCLUDED
+
+#include <string>
+#include <iostream>
+#include <stdint.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "configs.hpp"
+#include "utils.hpp"
+#include "crc.hpp"
+#include "timestamp.hpp"
+#include "journal.hpp"
+#include "metrics.hpp"
+
+using namespace std;
+
+/* With --capture, every LOOP and LOOP2 packet is also written, exactly as it was received, to the daily capture
+   'davis_YYYY-MM-DD.cap'. So if a conversion turns out to be wrong, or the calibration was, the logs can be made
+   again from the packets (by davis-reprocess), and the captures can be used as the corpus for davis-bench.
+
+   The file is a header of CAPTURE_HEADER_SIZE bytes, then fixed size records in the order the packets were
+   received, each with the time it was received and the packet with its CRC. Because the records are the same size
+   and in order, the file is its own index: the record at a time is found with a binary search. Each packet still
+   has its CRC, so a record that was only partly written (after a power cut) is seen and skipped */
+
+#define CAPTURE_MAGIC "DAVISCAP"
+#define CAPTURE_VERSION 1
+#define CAPTURE_HEADER_SIZE 64
+#define CAPTURE_SUFFIX ".cap"
+#define CAPTURE_DEVICE_SIZE 40
+
+typedef struct capture_header_s {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;                   /* Offset of the first record */
+    uint32_t record_size;
+    uint32_t frame_size;
+    char device[CAPTURE_DEVICE_SIZE];       /* Where the packets were read from */
+} capture_header_t;
+
+typedef struct capture_record_s {
+    int64_t realtime_ns;                    /* When the read that completed the packet returned (UTC) */
+    int32_t utc_offset;                     /* Seconds east of UTC, at that time */
+    unsigned char frame[LOOP_PACKET_SIZE];  /* The packet, as received, without the leading ACK */
+    uint8_t reserved;                       /* Makes the record 112 bytes */
+} capture_record_t;
+
+/* This class writes the daily captures. Like the log_writer, the records are buffered and written in groups,
+   with the same 'flush_records' and 'flush_ms' */
+class capture_writer
+{
+    public:
+        /* methods are public */
+        capture_writer(string directory, string prefix, string device);
+        ~capture_writer();
+        void set_durability(int flush_records, int flush_ms);
+        int append(const unsigned char *frame, int64_t realtime_ns, int32_t utc_offset);
+        int flush();
+        int flush_if_due();
+        void register_metrics(metrics_registry &registry, string labels);
+
+    private:
+        /* members are private */
+        int rotate(int64_t timestamp_ms);
+        void close_file();
+        string directory;
+        string prefix;
+        capture_header_t header;
+        int flush_records;
+        int flush_ms;
+        int filedesc;
+        string buffer;
+        int64_t day_start_ms;
+        int64_t day_end_ms;
+        int records_waiting;
+        int64_t oldest_waiting_ms;
+        metric_counter frames;
+        metric_counter write_errors;
+        metric_counter bytes_written;
+};
+
+/* This class maps a capture, to read its records */
+class capture_reader
+{
+    public:
+        /* methods are public */
+        capture_reader();
+        ~capture_reader();
+        bool open(string filename);
+        void close();
+        const capture_header_t *get_header();
+        const capture_record_t *get_records();
+        size_t get_count();
+        size_t find(int64_t realtime_ns);
+        bool valid(size_t index);
+
+    private:
+        /* members are private */
+        void *mapped;
+        size_t mapped_size;
+        size_t count;
+};
+
+bool is_capture_file(string filename);
+
+#endif /* CAPTURE_HPP_INCLUDED */
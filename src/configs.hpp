@@ -16,20 +16,56 @@
 #define CONFIGS_HPP_INCLUDED
 
 #define BAUDRATE B19200    /* Baud rate for the davis weather station is 19200 by default */
-#define TIMEOUT 150        /* In deciseconds...so 150 = 15 seconds */
 #define DATESIZE 20
 #define DEFAULT_LOG_DIRECTORY "/opt/ardexa/davis/" /* Default logging directory */
 #define ERROR_VALUE_FLOAT -9999.9   /* If an error is encountered, this number will be written to the log */
 #define BUFSIZE 255
-#define MINCHARS 200
-#define LOOP_LENGTH 100
+#define LINE_SIZE 1024     /* Big enough for any CSV line */
 #define MS_TO_KMH 3.6
+#define LOOP_PACKET_SIZE 99    /* A LOOP packet, without the leading ACK */
+#define LOOP_TYPE_OFFSET 4    /* The packet type is at this offset. 0 is a LOOP packet, and 1 is a LOOP2 packet */
+#define LOOP_TYPE 0
+#define LOOP2_TYPE 1
+#define LPS_LOOP 1             /* LPS bitmask for LOOP packets only */
+#define LPS_LOOP_LOOP2 3       /* LPS bitmask for alternating LOOP and LOOP2 packets */
+#define ONESHOT_MAX_PACKETS 4  /* When taking a single reading, give up if the packets needed are not in the first 4 */
+#define LOOP_BURST 200         /* In daemon mode, the number of LOOP packets requested by each LPS command */
+#define WAKE_ATTEMPTS 3        /* The wakeup LF is sent this many times before giving up, as the Davis protocol says */
+#define WAKE_TIMEOUT_MS 1200   /* The console answers the wakeup with LF CR within 1.2 seconds */
+#define ACK_TIMEOUT_MS 2000    /* The longest wait for an ACK to a command */
+#define DEFAULT_READ_TIMEOUT_MS 3000 /* For a single reading, the longest wait for the next data. A LOOP packet is sent every 2.5 seconds */
+#define ACK 0x06               /* Response to a command that was understood */
+#define NAK 0x21               /* Sent to the Davis to have an archive page sent again */
+#define CANCEL 0x18            /* Response to a command with a bad CRC */
+#define ESC 0x1B               /* Sent to the Davis to cancel an archive download */
+#define ARCHIVE_PAGE_SIZE 267  /* Sequence number, 5 archive records, 4 unused bytes and a CRC */
+#define ARCHIVE_RECORD_SIZE 52
+#define ARCHIVE_RECORDS_PER_PAGE 5
+#define ARCHIVE_RETRIES 3      /* Number of times a page with a bad CRC is requested again */
+#define ARCHIVE_READ_TIMEOUT_MS 2000 /* The longest wait for an archive page */
+#define DAEMON_STALL_TIME 15   /* In seconds. If nothing is received for this long, the console is woken up again */
+#define STATION_POLL_MS 250    /* With many stations, the longest the event loop waits. Lets it notice signals and flush the logs */
+#define STATION_REOPEN_TIME 10 /* In seconds. A device that can't be opened, or is unplugged, is tried again after this */
+#define STATION_MONITORED_REOPEN_TIME 60 /* In seconds. When udev reports adaptors being plugged in, this is only a fallback */
+#define STATION_MAX_EVENTS 64  /* The most epoll events handled at a time */
+#define FRAME_RING_SIZE 1024   /* Packets waiting to be logged. At 2.5 seconds each, 40 minutes of one console */
+#define AGGREGATE_EMIT_SECONDS 60 /* A line for each aggregate window is logged at the start of each minute */
+#define AGGREGATE_MAX_MINUTES 1440 /* The longest aggregate window is a day */
+#define AGGREGATE_MAX_GAP_MS 10000 /* The most time a rain rate is counted for, when packets are missing */
+#define AGGREGATE_RING_SIZE 64     /* The first size of the sample buffers, which double as needed */
+#define DEFAULT_FLUSH_RECORDS 1   /* By default, each line is written to the logs as soon as it is logged */
+#define DEFAULT_FLUSH_MS 0
+#define DEFAULT_LOG_INTERVAL 0.0  /* In seconds. In daemon mode, 0 will log every LOOP packet (every 2.5 seconds) */
 
 #define HEADER_LINE "# DateTime,Inside Temperature (celsius),Outside Temperature (celsius),Inside Humidity (percent),Outside Humidity (percent),Wind Speed (m/s),Wind Direction (degrees),Barometer (hectopascals),Solar Radiation (w/m^2),UV Index,Rain (mm),Console Battery (volts), Soil Temperature 1 (C), Soil Moisture 1 (centibar), Soil Temperature 2 (C), Soil Moisture 2 (centibar), Soil Temperature 3 (C), Soil Moisture 3 (centibar), Soil Temperature 4 (C), Soil Moisture 4 (centibar)"
 
 
 #define HEADER_LINE_KMH "# DateTime,Inside Temperature (celsius),Outside Temperature (celsius),Inside Humidity (percent),Outside Humidity (percent),Wind Speed (km/h),Wind Direction (degrees),Barometer (hectopascals),Solar Radiation (w/m^2),UV Index,Rain (mm),Console Battery (volts), Soil Temperature 1 (C), Soil Moisture 1 (centibar), Soil Temperature 2 (C), Soil Moisture 2 (centibar), Soil Temperature 3 (C), Soil Moisture 3 (centibar), Soil Temperature 4 (C), Soil Moisture 4 (centibar)"
 
+/* Added to the end of the header lines when LOOP2 packets are requested */
+#define HEADER_LOOP2 ",10 Min Avg Wind Speed (m/s),2 Min Avg Wind Speed (m/s),10 Min Wind Gust (m/s),10 Min Wind Gust Direction (degrees),Dew Point (celsius),Heat Index (celsius),Wind Chill (celsius),THSW Index (celsius)"
+
+#define HEADER_LOOP2_KMH ",10 Min Avg Wind Speed (km/h),2 Min Avg Wind Speed (km/h),10 Min Wind Gust (km/h),10 Min Wind Gust Direction (degrees),Dew Point (celsius),Heat Index (celsius),Wind Chill (celsius),THSW Index (celsius)"
 
 
 /* Davis weather station Vendor ID: 10c4 and Product ID: ea61 ... or .... Bus 001 Device 009: ID 10c4:ea60
@@ -39,6 +75,10 @@
 #define DAVIS_USBSERIAL_PRODUCT "ea61"
 #define DAVIS_USBSERIAL_PRODUCT2 "ea60"
 #define PID_FILE "/run/ardexa-davis.pid"
+#define DEFAULT_SHM_NAME "ardexa-davis"  /* The shared memory segment davis-latest reads, if no name is given */
+#define LATEST_WAIT_MS 100     /* How often davis-latest -w looks for a new reading */
+#define METRICS_BACKLOG 8      /* Connections to the metrics socket waiting to be answered */
+#define METRICS_TIMEOUT_MS 1000 /* The longest the metrics server waits for a request, or to send the answer */
 #define DEFAULT_DEBUG_VALUE 0
 
 
@@ -62,6 +102,15 @@ typedef struct davis_data_s {
     float soil_moist3;
     float soil_temp4;
     float soil_moist4;
+    /* These are only in LOOP2 packets */
+    float wind_avg_10min;
+    float wind_avg_2min;
+    float wind_gust_10min;
+    float wind_gust_direction;
+    float dew_point;
+    float heat_index;
+    float wind_chill;
+    float thsw;
 } davis_data_t;
 
 #endif /* CONFIGS_HPP_INCLUDED */
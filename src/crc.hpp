@@ -0,0 +1,29 @@
+/* Copyright (c) 2013-2018 Ardexa Pty Ltd. All rights reserved.
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef CRC_HPP_INCLUDED
+#define CRC_HPP_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* The CRC used by the Davis is CRC-CCITT (polynomial 0x1021, initial value 0). Running the CRC over a whole
+   packet, including the 2 CRC bytes at the end (sent MSB first), gives 0 if the packet is intact */
+unsigned short crc16(const unsigned char *data, size_t length, unsigned short crc = 0);
+bool crc16_check(const unsigned char *data, size_t length);
+void crc16_append(unsigned char *data, size_t length);
+
+/* The CRC-32 of zlib and Ethernet (polynomial 0xedb88320, reflected), used to check what is written to disk */
+uint32_t crc32(const unsigned char *data, size_t length, uint32_t crc = 0);
+
+#endif /* CRC_HPP_INCLUDED */
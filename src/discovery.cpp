@@ -0,0 +1,190 @@
+/* Copyright (c) 2013-2018 Ardexa Pty Ltd. All rights reserved.
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+#include <iostream>
+#include <fstream>
+#include <limits.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include "discovery.hpp"
+
+/* Read the first line of a sysfs attribute. Returns an empty string if it doesn't exist */
+static string read_attribute(string path)
+{
+    ifstream reader(path.c_str());
+    string value;
+
+    getline(reader, value);
+    return trim_whitespace(value);
+}
+
+/* Find the serial number of the Davis USB adaptor that a /dev device is on, from sysfs. Returns an empty string if
+   the device doesn't exist, or isn't on a Davis adaptor */
+string sysfs_usb_serial(string devnode)
+{
+    char resolved[PATH_MAX];
+    string name = devnode.substr(devnode.rfind('/') + 1);
+    string link = "/sys/class/tty/" + name + "/device";
+
+    if (realpath(link.c_str(), resolved) == NULL) {
+        return string();
+    }
+
+    /* Go up from the tty's device to the USB device, which is the first one with a vendor ID */
+    string path(resolved);
+    while (path.length() > strlen("/sys/devices")) {
+        string vendor_id = read_attribute(path + "/idVendor");
+        if (not vendor_id.empty()) {
+            string product_id = read_attribute(path + "/idProduct");
+            if ((vendor_id != DAVIS_USBSERIAL_VENDOR) or
+                ((product_id != DAVIS_USBSERIAL_PRODUCT) and (product_id != DAVIS_USBSERIAL_PRODUCT2))) {
+                return string();
+            }
+            return read_attribute(path + "/serial");
+        }
+        path = path.substr(0, path.rfind('/'));
+    }
+    return string();
+}
+
+/* Constructor for the device_discovery class */
+device_discovery::device_discovery(bool debug)
+{
+    this->debug = debug;
+    this->monitor = NULL;
+    this->udev = udev_new();
+    if ((!this->udev) and debug) {
+        cout << "Can't create udev data type. USB adaptors can only be found from their /dev devices" << endl;
+    }
+}
+
+/* Destructor for the device_discovery class */
+device_discovery::~device_discovery()
+{
+    if (this->monitor) udev_monitor_unref(this->monitor);
+    if (this->udev) udev_unref(this->udev);
+}
+
+/* Enumerate the tty devices, and cache every Davis adaptor found */
+vector<usb_device_t> device_discovery::scan()
+{
+    vector<usb_device_t> found;
+
+    if (!this->udev) {
+        return found;
+    }
+
+    found = scan_usb_devices(this->udev, this->debug);
+    this->devices.clear();
+    for (size_t i = 0; i < found.size(); i++) {
+        if (not found[i].serial.empty()) {
+            this->devices[found[i].serial] = found[i].devnode;
+        }
+    }
+    return found;
+}
+
+/* Find the /dev device of the Davis adaptor with this serial number. The cached device is used if sysfs shows it is
+   still that adaptor. Otherwise the devices are enumerated again. Returns an empty string if it isn't plugged in */
+string device_discovery::find_serial(string serial)
+{
+    map<string, string>::iterator cached = this->devices.find(serial);
+    if ((cached != this->devices.end()) and (sysfs_usb_serial(cached->second) == serial)) {
+        return cached->second;
+    }
+
+    if (this->debug) cout << "Searching for the Davis USB adaptor with the serial number: " << serial << endl;
+    this->scan();
+    cached = this->devices.find(serial);
+    if (cached != this->devices.end()) {
+        return cached->second;
+    }
+    return string();
+}
+
+/* Listen for tty devices being added and removed. Returns a non-blocking file descriptor to wait on (it becomes
+   readable when there are events for receive_event()), or -1 if udev events aren't available */
+int device_discovery::start_monitor()
+{
+    if (!this->udev) {
+        return -1;
+    }
+
+    this->monitor = udev_monitor_new_from_netlink(this->udev, "udev");
+    if (!this->monitor) {
+        if (this->debug) cout << "Can't listen for udev events. Unplugged devices will be polled for" << endl;
+        return -1;
+    }
+    udev_monitor_filter_add_match_subsystem_devtype(this->monitor, "tty", NULL);
+    int filedesc = -1;
+    if (udev_monitor_enable_receiving(this->monitor) == 0) {
+        filedesc = udev_monitor_get_fd(this->monitor);
+    }
+    if (filedesc < 0) {
+        udev_monitor_unref(this->monitor);
+        this->monitor = NULL;
+        return -1;
+    }
+    fcntl(filedesc, F_SETFL, fcntl(filedesc, F_GETFL) | O_NONBLOCK);
+
+    return filedesc;
+}
+
+/* Get the next Davis adaptor that was plugged in or unplugged, and update the cache. Other tty devices are skipped.
+   Returns false when there are no more events waiting */
+bool device_discovery::receive_event(usb_event_t *event)
+{
+    if (!this->monitor) {
+        return false;
+    }
+
+    struct udev_device *tty;
+    while ((tty = udev_monitor_receive_device(this->monitor)) != NULL) {
+        const char *action = udev_device_get_action(tty);
+        const char *devnode = udev_device_get_devnode(tty);
+        usb_device_t usb_device;
+        bool found = false;
+
+        if (action and devnode and (strcmp(action, "add") == 0) and davis_usb_device(tty, &usb_device, this->debug)) {
+            event->added = true;
+            event->devnode = usb_device.devnode;
+            event->serial = usb_device.serial;
+            if (not usb_device.serial.empty()) {
+                this->devices[usb_device.serial] = usb_device.devnode;
+            }
+            found = true;
+        }
+        else if (action and devnode and (strcmp(action, "remove") == 0)) {
+            /* The adaptor has gone, so its serial number is found from the cache */
+            event->added = false;
+            event->devnode = devnode;
+            event->serial = "";
+            for (map<string, string>::iterator i = this->devices.begin(); i != this->devices.end(); ++i) {
+                if (i->second == event->devnode) {
+                    event->serial = i->first;
+                    this->devices.erase(i);
+                    break;
+                }
+            }
+            found = true;
+        }
+        udev_device_unref(tty);
+
+        if (found) {
+            if (this->debug) cout << "Device " << (event->added ? "added: " : "removed: ") << event->devnode << endl;
+            return true;
+        }
+    }
+    return false;
+}
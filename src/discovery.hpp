@@ -0,0 +1,58 @@
+/* Copyright (c) 2013-2018 Ardexa Pty Ltd. All rights reserved.
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+#ifndef DISCOVERY_HPP_INCLUDED
+#define DISCOVERY_HPP_INCLUDED
+
+#include <string>
+#include <vector>
+#include <map>
+#include <libudev.h>
+#include "utils.hpp"
+
+using namespace std;
+
+/* A Davis USB adaptor that has been plugged in ('added') or unplugged */
+typedef struct usb_event_s {
+    bool added;
+    string devnode;
+    string serial;
+} usb_event_t;
+
+/* This class finds the Davis USB adaptors, and keeps a map from each adaptor's serial number to its /dev device.
+   Before a cached device is used, it is checked against sysfs (a readlink and a small read, without udev), so the
+   tty devices are only enumerated again when an adaptor has moved. In daemon mode, a udev monitor reports the
+   adaptors as they are plugged in and unplugged, so they can be reopened straight away instead of polled for */
+class device_discovery
+{
+    public:
+        /* methods are public */
+        device_discovery(bool debug);
+        ~device_discovery();
+        vector<usb_device_t> scan();
+        string find_serial(string serial);
+        int start_monitor();
+        bool receive_event(usb_event_t *event);
+
+    private:
+        /* members are private */
+        struct udev *udev;
+        struct udev_monitor *monitor;
+        map<string, string> devices;
+        bool debug;
+};
+
+string sysfs_usb_serial(string devnode);
+
+#endif /* DISCOVERY_HPP_INCLUDED */
@@ -0,0 +1,262 @@
+/* Copyright (c) 2013-2018 Ardexa Pty Ltd. All rights reserved.
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+#include <string.h>
+#include <math.h>
+#include "encoder.hpp"
+#include "crc.hpp"
+#include "utils.hpp"
+
+/* Put a 2 byte value in the frame, LSB first */
+static void put_u16(unsigned char *frame, int offset, int value)
+{
+    frame[offset] = value & 0xFF;
+    frame[offset + 1] = (value >> 8) & 0xFF;
+}
+
+static bool is_dashed(float value)
+{
+    return value == (float) ERROR_VALUE_FLOAT;
+}
+
+/* Celsius to tenths of a degree Fahrenheit. 32767 is dashed */
+static int fahrenheit_tenths(float celsius)
+{
+    if (is_dashed(celsius)) return 32767;
+    return (int) lround((celsius * 9/5 + 32.0) * 10);
+}
+
+/* Celsius to whole degrees Fahrenheit, as used by the LOOP2 derived temperatures. 255 is dashed */
+static int fahrenheit_whole(float celsius)
+{
+    if (is_dashed(celsius)) return 255;
+    return (int) lround(celsius * 9/5 + 32.0);
+}
+
+/* Celsius to the 1 byte soil temperature, which is whole degrees Fahrenheit + 90. 255 is dashed */
+static int soil_temperature(float celsius)
+{
+    if (is_dashed(celsius)) return 255;
+    return (int) lround(celsius * 9/5 + 32.0 + 90);
+}
+
+/* A value that is sent as is, in 1 byte. 255 is dashed */
+static int byte_value(float value)
+{
+    if (is_dashed(value)) return 255;
+    return (int) lround(value);
+}
+
+/* Hectopascals to thousandths of an inch of mercury. 0 is dashed */
+static int barometer_value(float hectopascals)
+{
+    if (is_dashed(hectopascals)) return 0;
+    return (int) lround(hectopascals / 33.86 * 1000);
+}
+
+/* Metres/s to mph, with 'scale' steps to the mph */
+static int wind_value(float metres, int scale, int dashed)
+{
+    if (is_dashed(metres)) return dashed;
+    return (int) lround(metres / 0.44704 * scale);
+}
+
+/* The values that are in the same place in LOOP and LOOP2 packets */
+static void encode_common(const davis_data_t &davis_data, unsigned char *frame, int packet_type)
+{
+    memset(frame, 0, LOOP_PACKET_SIZE);
+    memcpy(frame, "LOO", 3);
+    frame[LOOP_TYPE_OFFSET] = packet_type;
+
+    put_u16(frame, 7, barometer_value(davis_data.barometer));
+    put_u16(frame, 9, fahrenheit_tenths(davis_data.inside_temperature));
+    frame[11] = byte_value(davis_data.inside_humidity);
+    put_u16(frame, 12, fahrenheit_tenths(davis_data.outside_temperature));
+    frame[14] = wind_value(davis_data.wind_speed, 1, 255);
+    put_u16(frame, 16, is_dashed(davis_data.wind_direction) ? 0 : (int) lround(davis_data.wind_direction));
+    frame[33] = byte_value(davis_data.outside_humidity);
+
+    /* The rain rate and storm rain are in 0.01 inch clicks. The logged rain is read from the storm rain, at 0.25 mm a click */
+    int clicks = is_dashed(davis_data.rain) ? 0 : (int) lround(davis_data.rain / 0.25);
+    put_u16(frame, 41, clicks);
+    put_u16(frame, 46, clicks);
+
+    frame[43] = is_dashed(davis_data.UV) ? 255 : (int) lround(davis_data.UV * 10);
+    put_u16(frame, 44, is_dashed(davis_data.solar_radiation) ? 32767 : (int) lround(davis_data.solar_radiation));
+
+    frame[95] = '\n';
+    frame[96] = '\r';
+}
+
+/* Build a whole LOOP packet, with its CRC */
+void encode_loop(const davis_data_t &davis_data, unsigned char *frame)
+{
+    encode_common(davis_data, frame, LOOP_TYPE);
+
+    /* Next archive record, and the 10 min avg wind speed in mph */
+    put_u16(frame, 5, 0);
+    frame[15] = wind_value(davis_data.wind_avg_10min, 1, 255);
+
+    /* Extra and leaf temperatures, and extra humidities, aren't logged */
+    memset(&frame[18], 255, 7);
+    memset(&frame[29], 255, 4);
+    memset(&frame[34], 255, 7);
+
+    frame[25] = soil_temperature(davis_data.soil_temp1);
+    frame[26] = soil_temperature(davis_data.soil_temp2);
+    frame[27] = soil_temperature(davis_data.soil_temp3);
+    frame[28] = soil_temperature(davis_data.soil_temp4);
+    frame[62] = byte_value(davis_data.soil_moist1);
+    frame[63] = byte_value(davis_data.soil_moist2);
+    frame[64] = byte_value(davis_data.soil_moist3);
+    frame[65] = byte_value(davis_data.soil_moist4);
+    memset(&frame[66], 255, 4);
+
+    /* Voltage = ((Data * 300)/512)/100.0 */
+    int battery = is_dashed(davis_data.console_battery) ? 0 : (int) lround(davis_data.console_battery * 100 * 512 / 300);
+    put_u16(frame, 87, battery);
+
+    /* Sunrise and sunset, as hour * 100 + minute */
+    put_u16(frame, 91, 600);
+    put_u16(frame, 93, 1800);
+
+    crc16_append(frame, LOOP_PACKET_SIZE - 2);
+}
+
+/* Build a whole LOOP2 packet, with its CRC */
+void encode_loop2(const davis_data_t &davis_data, unsigned char *frame)
+{
+    encode_common(davis_data, frame, LOOP2_TYPE);
+
+    /* Unused */
+    put_u16(frame, 5, 32767);
+    frame[15] = 255;
+    memset(&frame[26], 255, 4);
+    frame[32] = 255;
+    frame[34] = 255;
+
+    /* The averages are in 0.1 mph. The gust is in whole mph */
+    put_u16(frame, 18, wind_value(davis_data.wind_avg_10min, 10, 32767));
+    put_u16(frame, 20, wind_value(davis_data.wind_avg_2min, 10, 32767));
+    put_u16(frame, 22, wind_value(davis_data.wind_gust_10min, 1, 255));
+    put_u16(frame, 24, is_dashed(davis_data.wind_gust_direction) ? 0 : (int) lround(davis_data.wind_gust_direction));
+
+    put_u16(frame, 30, fahrenheit_whole(davis_data.dew_point));
+    put_u16(frame, 35, fahrenheit_whole(davis_data.heat_index));
+    put_u16(frame, 37, fahrenheit_whole(davis_data.wind_chill));
+    put_u16(frame, 39, fahrenheit_whole(davis_data.thsw));
+
+    crc16_append(frame, LOOP_PACKET_SIZE - 2);
+}
+
+/* The archive date stamp is: day + month*32 + (year - 2000)*512 */
+unsigned int archive_date_stamp(const struct tm &stamp)
+{
+    return stamp.tm_mday + (stamp.tm_mon + 1) * 32 + (stamp.tm_year - 100) * 512;
+}
+
+/* The archive time stamp is: (hour * 100) + minute */
+unsigned int archive_time_stamp(const struct tm &stamp)
+{
+    return stamp.tm_hour * 100 + stamp.tm_min;
+}
+
+/* Build a 52 byte Rev B archive record, written at 'stamp' */
+void encode_archive_record(const davis_data_t &davis_data, const struct tm &stamp, unsigned char *record)
+{
+    memset(record, 0, ARCHIVE_RECORD_SIZE);
+
+    put_u16(record, 0, archive_date_stamp(stamp));
+    put_u16(record, 2, archive_time_stamp(stamp));
+    put_u16(record, 4, fahrenheit_tenths(davis_data.outside_temperature));
+    put_u16(record, 6, fahrenheit_tenths(davis_data.outside_temperature));
+    put_u16(record, 8, fahrenheit_tenths(davis_data.outside_temperature));
+    put_u16(record, 10, is_dashed(davis_data.rain) ? 0 : (int) lround(davis_data.rain / 0.25));
+    put_u16(record, 14, barometer_value(davis_data.barometer));
+    put_u16(record, 16, is_dashed(davis_data.solar_radiation) ? 32767 : (int) lround(davis_data.solar_radiation));
+    put_u16(record, 20, fahrenheit_tenths(davis_data.inside_temperature));
+    record[22] = byte_value(davis_data.inside_humidity);
+    record[23] = byte_value(davis_data.outside_humidity);
+    record[24] = wind_value(davis_data.wind_speed, 1, 255);
+    record[25] = wind_value(davis_data.wind_speed, 1, 255);
+
+    /* The prevailing wind direction is a code from 0 (N) to 15 (NNW) */
+    if (is_dashed(davis_data.wind_direction)) {
+        record[26] = record[27] = 255;
+    }
+    else {
+        record[26] = record[27] = ((int) lround(davis_data.wind_direction / 22.5)) % 16;
+    }
+    record[28] = is_dashed(davis_data.UV) ? 255 : (int) lround(davis_data.UV * 10);
+    put_u16(record, 30, is_dashed(davis_data.solar_radiation) ? 0 : (int) lround(davis_data.solar_radiation));
+    record[32] = record[28];
+
+    /* Leaf temperatures and wetness, extra humidities and temperatures aren't logged */
+    memset(&record[34], 255, 4);
+    record[38] = soil_temperature(davis_data.soil_temp1);
+    record[39] = soil_temperature(davis_data.soil_temp2);
+    record[40] = soil_temperature(davis_data.soil_temp3);
+    record[41] = soil_temperature(davis_data.soil_temp4);
+    /* Rev B record */
+    record[42] = 0x00;
+    memset(&record[43], 255, 5);
+    record[48] = byte_value(davis_data.soil_moist1);
+    record[49] = byte_value(davis_data.soil_moist2);
+    record[50] = byte_value(davis_data.soil_moist3);
+    record[51] = byte_value(davis_data.soil_moist4);
+}
+
+/* Build a whole archive page from 'sequence' and ARCHIVE_RECORDS_PER_PAGE records, with its CRC */
+void encode_archive_page(int sequence, const unsigned char *records, unsigned char *page)
+{
+    page[0] = sequence & 0xFF;
+    memcpy(&page[1], records, ARCHIVE_RECORDS_PER_PAGE * ARCHIVE_RECORD_SIZE);
+    memset(&page[1 + ARCHIVE_RECORDS_PER_PAGE * ARCHIVE_RECORD_SIZE], 0, 4);
+    crc16_append(page, ARCHIVE_PAGE_SIZE - 2);
+}
+
+/* The simulated weather at time 't' (in seconds), for console 'index'. It changes smoothly over the day,
+   and each console is a little different */
+davis_data_t simulated_weather(double t, int index)
+{
+    davis_data_t davis_data;
+    double day = sin(2 * M_PI * fmod(t, 86400) / 86400);
+    double gusts = sin(t / 7.0) * sin(t / 31.0);
+
+    clear_davis_data(&davis_data);
+    davis_data.inside_temperature = 21.0 + 0.5 * day;
+    davis_data.outside_temperature = 15.0 + 8.0 * day + 0.1 * index;
+    davis_data.inside_humidity = 45;
+    davis_data.outside_humidity = round(60 - 20 * day);
+    davis_data.wind_speed = round(4.0 + 3.0 * gusts) * 0.44704;
+    davis_data.wind_direction = round(fmod(360.0 + 180.0 + 90.0 * sin(t / 300.0), 360.0));
+    davis_data.barometer = 1013.0 + 5.0 * sin(t / 3600.0);
+    davis_data.solar_radiation = round(max(0.0, 900.0 * day));
+    davis_data.UV = round(max(0.0, 80.0 * day)) / 10;
+    davis_data.rain = 0.25 * index;
+    davis_data.console_battery = 4.6;
+    davis_data.soil_temp1 = 12.0;
+    davis_data.soil_moist1 = 20;
+
+    davis_data.wind_avg_10min = 4.0 * 0.44704;
+    davis_data.wind_avg_2min = round(40 + 10 * gusts) / 10 * 0.44704;
+    davis_data.wind_gust_10min = 7.0 * 0.44704;
+    davis_data.wind_gust_direction = davis_data.wind_direction;
+    davis_data.dew_point = davis_data.outside_temperature - 5.0;
+    davis_data.heat_index = davis_data.outside_temperature;
+    davis_data.wind_chill = davis_data.outside_temperature - 1.0;
+    davis_data.thsw = davis_data.outside_temperature + 2.0;
+
+    return davis_data;
+}
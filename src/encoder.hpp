@@ -0,0 +1,37 @@
+/* Copyright (c) 2013-2018 Ardexa Pty Ltd. All rights reserved.
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+#ifndef ENCODER_HPP_INCLUDED
+#define ENCODER_HPP_INCLUDED
+
+#include <time.h>
+#include "configs.hpp"
+
+using namespace std;
+
+/* These functions do the reverse of the decoders. They build LOOP and LOOP2 packets, and archive records and pages,
+   from the values in a davis_data struct, as a Davis console would send them. They are used by the console
+   simulator and the benchmarks. The values are in the units that are logged: Celsius, m/s, hectopascals and mm,
+   with no calibration. Members set to ERROR_VALUE_FLOAT are sent as dashed (no data).
+
+   simulated_weather() makes up plausible values, that change smoothly with time */
+void encode_loop(const davis_data_t &davis_data, unsigned char *frame);
+void encode_loop2(const davis_data_t &davis_data, unsigned char *frame);
+void encode_archive_record(const davis_data_t &davis_data, const struct tm &stamp, unsigned char *record);
+void encode_archive_page(int sequence, const unsigned char *records, unsigned char *page);
+unsigned int archive_date_stamp(const struct tm &stamp);
+unsigned int archive_time_stamp(const struct tm &stamp);
+davis_data_t simulated_weather(double t, int index);
+
+#endif /* ENCODER_HPP_INCLUDED */
@@ -0,0 +1,156 @@
+/* Copyright (c) 2013-2018 Ardexa Pty Ltd. All rights reserved.
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+#ifndef FIELD_DECODER_HPP_INCLUDED
+#define FIELD_DECODER_HPP_INCLUDED
+
+#include <iostream>
+#include <float.h>
+#include "configs.hpp"
+
+using namespace std;
+
+/* The layout of a LOOP or LOOP2 packet is a table of these, one row for each value. A value is read from 'offset',
+   and is valid if it isn't 'dashed' (the Davis sends this when there is no data) and, once scaled, is within
+   'minimum' to 'maximum'. Otherwise ERROR_VALUE_FLOAT is stored. A 1 byte field can instead have a 256 entry
+   'table', which gives the value (or ERROR_VALUE_FLOAT) for each raw byte. Adding a value is adding a row */
+enum field_width_t { FIELD_U8, FIELD_U16, FIELD_S16 };
+
+/* What is done to a valid value, after it is scaled and checked, to apply the command line options */
+enum field_adjust_t {
+    ADJUST_NONE,
+    ADJUST_BAROMETER,       /* Multiplied by the barometer calibration (-b) */
+    ADJUST_WIND_SPEED,      /* Converted to km/h (-w) */
+    ADJUST_DIRECTION        /* Turned 180 degrees (-z) */
+};
+
+struct field_t {
+    const char *name;
+    const char *unit;
+    float davis_data_t::*member;
+    int offset;
+    field_width_t width;
+    float scale;
+    float bias;
+    float minimum;
+    float maximum;
+    int dashed;             /* -1 if there is no dashed value */
+    field_adjust_t adjust;
+    const float *table;     /* NULL if the value is scaled */
+};
+
+#define NO_DASHED -1
+#define NO_MINIMUM -FLT_MAX
+#define NO_MAXIMUM FLT_MAX
+
+/* This class decodes a packet using a table of N fields. The table is copied into a column for each of its
+   members, so the scaling and range checks are one loop over arrays of floats, with no branches, that the compiler
+   can vectorize. The raw values are read first, then scaled and checked, then the few that depend on the command
+   line options are adjusted, and finally they are stored in the davis_data struct */
+template <size_t N>
+class field_decoder
+{
+    public:
+        field_decoder(const field_t (&fields)[N])
+        {
+            this->adjusted_count = 0;
+            for (size_t i = 0; i < N; i++) {
+                const field_t &field = fields[i];
+                this->fields[i] = field;
+                this->offset[i] = field.offset;
+                this->table[i] = field.table;
+                this->high_mask[i] = (field.width == FIELD_U8) ? 0 : 0xFF00;
+                this->sign_bit[i] = (field.width == FIELD_S16) ? 0x8000 : 0;
+                if (field.adjust != ADJUST_NONE) this->adjusted[this->adjusted_count++] = i;
+                this->scale[i] = field.table ? 1.0 : field.scale;
+                this->bias[i] = field.table ? 0.0 : field.bias;
+                this->minimum[i] = field.table ? NO_MINIMUM : field.minimum;
+                this->maximum[i] = field.table ? NO_MAXIMUM : field.maximum;
+                this->dashed[i] = field.table ? NO_DASHED : field.dashed;
+            }
+        }
+
+        void decode(const unsigned char *frame, davis_data_t &davis_data, bool debug, bool wdspd_kmh, float barocal, bool winddir_180) const
+        {
+            int raw[N];
+            float input[N];
+            float value[N];
+
+            /* Read the raw values. The 2nd byte of a 1 byte field is masked off, and 2 byte signed fields are sign extended */
+            for (size_t i = 0; i < N; i++) {
+                const unsigned char *bytes = &frame[this->offset[i]];
+                raw[i] = bytes[0] | ((bytes[1] << 8) & this->high_mask[i]);
+                raw[i] = (raw[i] ^ this->sign_bit[i]) - this->sign_bit[i];
+                input[i] = this->table[i] ? this->table[i][raw[i]] : (float) raw[i];
+            }
+
+            /* Scale and check the values. With no branches, this loop can be vectorized */
+            for (size_t i = 0; i < N; i++) {
+                float scaled = input[i] * this->scale[i] + this->bias[i];
+                bool valid = (raw[i] != this->dashed[i]) & (scaled >= this->minimum[i]) & (scaled <= this->maximum[i]);
+                value[i] = valid ? scaled : (float) ERROR_VALUE_FLOAT;
+            }
+
+            /* Only a few fields are adjusted for the command line options */
+            for (size_t k = 0; k < this->adjusted_count; k++) {
+                size_t i = this->adjusted[k];
+                if (value[i] == (float) ERROR_VALUE_FLOAT) continue;
+                switch (this->fields[i].adjust) {
+                    case ADJUST_BAROMETER:
+                        value[i] = value[i] * barocal;
+                        break;
+                    case ADJUST_WIND_SPEED:
+                        if (wdspd_kmh) value[i] = value[i] * MS_TO_KMH;
+                        break;
+                    case ADJUST_DIRECTION:
+                        if (winddir_180) {
+                            value[i] = value[i] + 180.0;
+                            if (value[i] > 360.0) value[i] = value[i] - 360.0;
+                        }
+                        break;
+                    default:
+                        break;
+                }
+            }
+
+            for (size_t i = 0; i < N; i++) {
+                davis_data.*this->fields[i].member = value[i];
+            }
+
+            if (debug) {
+                for (size_t i = 0; i < N; i++) {
+                    const field_t &field = this->fields[i];
+                    cout << "Raw " << field.name << " offset " << field.offset << ": " << raw[i] << endl;
+                    cout << "\t" << field.name << " (" << (((field.adjust == ADJUST_WIND_SPEED) and wdspd_kmh) ? "km/h" : field.unit) << "): " << value[i] << endl;
+                    if (field.adjust == ADJUST_BAROMETER) cout << "\tBaro calibration value: " << barocal << endl;
+                }
+            }
+        }
+
+    private:
+        field_t fields[N];
+        int offset[N];
+        const float *table[N];
+        int high_mask[N];
+        int sign_bit[N];
+        size_t adjusted[N];
+        size_t adjusted_count;
+        float scale[N];
+        float bias[N];
+        float minimum[N];
+        float maximum[N];
+        int dashed[N];
+};
+
+#endif /* FIELD_DECODER_HPP_INCLUDED */
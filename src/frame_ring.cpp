@@ -0,0 +1,133 @@
+/* Copyright (c) 2013-2018 Ardexa Pty Ltd. All rights reserved.
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include "frame_ring.hpp"
+
+/* Constructor for the frame_ring class. The capacity is rounded up to a power of 2 */
+frame_ring::frame_ring(size_t capacity)
+    : head(0), tail(0)
+{
+    size_t size = 1;
+    while (size < capacity) size <<= 1;
+    this->slots.resize(size);
+    this->mask = size - 1;
+    this->capacity.set(size);
+    this->event_filedesc = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+}
+
+/* Destructor for the frame_ring class */
+frame_ring::~frame_ring()
+{
+    if (this->event_filedesc >= 0) {
+        close(this->event_filedesc);
+    }
+}
+
+/* Copy a packet into the next free slot, and wake the consumer. Called by the producer only. Returns false, and
+   counts a drop, if every slot is full */
+bool frame_ring::push(void *owner, const receive_stamp_t &stamp, const unsigned char *frame)
+{
+    size_t tail = this->tail.load(memory_order_relaxed);
+    size_t head = this->head.load(memory_order_acquire);
+
+    if (tail - head > this->mask) {
+        this->drops.add();
+        return false;
+    }
+
+    frame_slot_t &slot = this->slots[tail & this->mask];
+    slot.owner = owner;
+    slot.stamp = stamp;
+    memcpy(slot.frame, frame, LOOP_PACKET_SIZE);
+    this->tail.store(tail + 1, memory_order_release);
+
+    this->pushed.add();
+    size_t used = tail + 1 - head;
+    if (used > this->high_water.get()) {
+        this->high_water.set(used);
+    }
+    this->wake();
+    return true;
+}
+
+/* The oldest packet in the ring, or NULL if it is empty. Called by the consumer only */
+frame_slot_t *frame_ring::front()
+{
+    size_t head = this->head.load(memory_order_relaxed);
+    if (head == this->tail.load(memory_order_acquire)) {
+        return NULL;
+    }
+    return &this->slots[head & this->mask];
+}
+
+/* Free the slot returned by front(). Called by the consumer only */
+void frame_ring::pop()
+{
+    this->head.store(this->head.load(memory_order_relaxed) + 1, memory_order_release);
+}
+
+/* Wait up to 'timeout_ms' for wake() to be called, unless it already has been. Called by the consumer only */
+void frame_ring::wait(int timeout_ms)
+{
+    struct pollfd poll_filedesc;
+    uint64_t count;
+
+    poll_filedesc.fd = this->event_filedesc;
+    poll_filedesc.events = POLLIN;
+    if (poll(&poll_filedesc, 1, timeout_ms) > 0) {
+        ssize_t result = read(this->event_filedesc, &count, sizeof(count));
+        (void) result;
+    }
+}
+
+/* Wake the consumer from wait() */
+void frame_ring::wake()
+{
+    uint64_t one = 1;
+    ssize_t result = write(this->event_filedesc, &one, sizeof(one));
+    (void) result;
+}
+
+size_t frame_ring::get_capacity()
+{
+    return this->mask + 1;
+}
+
+unsigned long frame_ring::get_pushed()
+{
+    return this->pushed.get();
+}
+
+unsigned long frame_ring::get_drops()
+{
+    return this->drops.get();
+}
+
+size_t frame_ring::get_high_water()
+{
+    return this->high_water.get();
+}
+
+/* Add the counts to the metrics */
+void frame_ring::register_metrics(metrics_registry &registry)
+{
+    registry.add("davis_ring_slots", METRIC_GAUGE, "Packets the ring to the logging thread can hold", "", &this->capacity);
+    registry.add("davis_ring_queued_total", METRIC_COUNTER, "Packets passed to the logging thread", "", &this->pushed);
+    registry.add("davis_ring_dropped_total", METRIC_COUNTER, "Packets dropped because the ring was full", "", &this->drops);
+    registry.add("davis_ring_high_water", METRIC_GAUGE, "The most packets that have waited in the ring at once", "", &this->high_water);
+}
@@ -0,0 +1,78 @@
+/* Copyright (c) 2013-2018 Ardexa Pty Ltd. All rights reserved.
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+#ifndef FRAME_RING_HPP_INCLUDED
+#define FRAME_RING_HPP_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <vector>
+#include "configs.hpp"
+#include "timestamp.hpp"
+#include "metrics.hpp"
+
+using namespace std;
+
+/* A LOOP packet, the time it was received and the station it came from */
+typedef struct frame_slot_s {
+    void *owner;
+    receive_stamp_t stamp;
+    unsigned char frame[LOOP_PACKET_SIZE];
+} frame_slot_t;
+
+/* This class passes LOOP packets from the thread reading the serial devices to the thread that decodes and logs
+   them, so a slow disk never holds up the reads. It has one producer and one consumer, and no locks: the producer
+   only moves 'tail' and the consumer only moves 'head'. The slots are allocated once, and a packet that arrives
+   when they are all full is dropped (and counted) rather than waiting. The consumer is woken through an eventfd:
+
+        producer:   ring.push(station, stamp, frame);
+        consumer:   ring.wait(timeout_ms);
+                    while ((slot = ring.front()) != NULL) {
+                        ... use the slot ...
+                        ring.pop();
+                    }
+*/
+class frame_ring
+{
+    public:
+        /* methods are public */
+        frame_ring(size_t capacity);
+        ~frame_ring();
+        bool push(void *owner, const receive_stamp_t &stamp, const unsigned char *frame);
+        frame_slot_t *front();
+        void pop();
+        void wait(int timeout_ms);
+        void wake();
+        size_t get_capacity();
+        unsigned long get_pushed();
+        unsigned long get_drops();
+        size_t get_high_water();
+        void register_metrics(metrics_registry &registry);
+
+    private:
+        /* members are private */
+        vector<frame_slot_t> slots;
+        size_t mask;
+        int event_filedesc;
+        /* Each index is on its own cache line, so the two threads don't keep taking the line from each other */
+        alignas(64) atomic<size_t> head;
+        alignas(64) atomic<size_t> tail;
+        metric_counter capacity;
+        metric_counter pushed;
+        metric_counter drops;
+        metric_counter high_water;
+};
+
+#endif /* FRAME_RING_HPP_INCLUDED */
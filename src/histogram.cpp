@@ -0,0 +1,163 @@
+/* Copyright (c) 2013-2018 Ardexa Pty Ltd. All rights reserved.
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+
+#include <iomanip>
+#include <time.h>
+#include "histogram.hpp"
+
+static const char *stage_names[STAGE_COUNT] = {
+    "wakeup", "ack", "first_byte", "frame", "interval", "queue", "decode", "format", "write_daily", "write_latest"
+};
+
+/* The bucket of a value. The top bits of the value, after the highest set bit, pick the bucket within its power of 2 */
+static size_t bucket_index(uint64_t value)
+{
+    if (value < (1 << HISTOGRAM_SUB_BITS)) {
+        return value;
+    }
+    int exponent = 63 - __builtin_clzll(value);
+    if (exponent > HISTOGRAM_MAX_EXPONENT) {
+        return HISTOGRAM_BUCKETS - 1;
+    }
+    int shift = exponent - HISTOGRAM_SUB_BITS;
+    return ((size_t) (shift + 1) << HISTOGRAM_SUB_BITS) + ((value >> shift) & ((1 << HISTOGRAM_SUB_BITS) - 1));
+}
+
+/* The highest value that goes in a bucket */
+static int64_t bucket_highest(size_t index)
+{
+    if (index < (1 << HISTOGRAM_SUB_BITS)) {
+        return index;
+    }
+    int shift = (index >> HISTOGRAM_SUB_BITS) - 1;
+    uint64_t sub = index & ((1 << HISTOGRAM_SUB_BITS) - 1);
+    return (int64_t) ((((1 << HISTOGRAM_SUB_BITS) + sub + 1) << shift) - 1);
+}
+
+/* Count a value. Negative values (from a clock step) are counted as 0 */
+void latency_histogram::record(int64_t value_ns)
+{
+    uint64_t value = (value_ns > 0) ? value_ns : 0;
+
+    this->buckets[bucket_index(value)].add();
+    this->total.add();
+    this->sum.add(value);
+    if (value > this->maximum.get()) {
+        this->maximum.set(value);
+    }
+}
+
+/* Add the values of another histogram to this one */
+void latency_histogram::merge(const latency_histogram &other)
+{
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        this->buckets[i].add(other.buckets[i].get());
+    }
+    this->total.add(other.total.get());
+    this->sum.add(other.sum.get());
+    if (other.maximum.get() > this->maximum.get()) {
+        this->maximum.set(other.maximum.get());
+    }
+}
+
+uint64_t latency_histogram::count() const
+{
+    return this->total.get();
+}
+
+int64_t latency_histogram::max_ns() const
+{
+    return this->maximum.get();
+}
+
+double latency_histogram::mean_ns() const
+{
+    uint64_t count = this->total.get();
+    return (count > 0) ? (double) this->sum.get() / count : 0.0;
+}
+
+/* The value that 'percentile' percent of the values are no more than. As with an HDR histogram, this is the highest
+   value of the bucket it is in (but no more than the maximum) */
+int64_t latency_histogram::percentile_ns(double percentile) const
+{
+    uint64_t count = this->total.get();
+    if (count == 0) {
+        return 0;
+    }
+    uint64_t rank = (uint64_t) (percentile / 100.0 * count + 0.5);
+    if (rank < 1) rank = 1;
+    if (rank > count) rank = count;
+
+    uint64_t seen = 0;
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        seen += this->buckets[i].get();
+        if (seen >= rank) {
+            return min(bucket_highest(i), this->max_ns());
+        }
+    }
+    return this->max_ns();
+}
+
+/* Constructor for the stage_stats class. The run is timed from here */
+stage_stats::stage_stats()
+{
+    this->start_ns = monotonic_now_ns();
+}
+
+void stage_stats::record(stage_t stage, int64_t value_ns)
+{
+    this->stages[stage].record(value_ns);
+}
+
+/* Add the histograms of another stage_stats to these */
+void stage_stats::merge(const stage_stats &other)
+{
+    for (int i = 0; i < STAGE_COUNT; i++) {
+        this->stages[i].merge(other.stages[i]);
+    }
+    this->start_ns = min(this->start_ns, other.start_ns);
+}
+
+/* Print a table of the stages in microseconds, then the same as a line of JSON, for scripts. 'mode' is the mode
+   the program ran in, such as "daemon" */
+void stage_stats::print(ostream &out, string mode)
+{
+    ios::fmtflags flags = out.flags();
+    streamsize precision = out.precision();
+
+    out << fixed << setprecision(1);
+    out << "# Stage,Count,p50 (us),p99 (us),Max (us),Mean (us)" << endl;
+    for (int i = 0; i < STAGE_COUNT; i++) {
+        const latency_histogram &stage = this->stages[i];
+        if (stage.count() == 0) continue;
+        out << stage_names[i] << "," << stage.count() << "," << stage.percentile_ns(50.0) / 1000.0 << "," << stage.percentile_ns(99.0) / 1000.0;
+        out << "," << stage.max_ns() / 1000.0 << "," << stage.mean_ns() / 1000.0 << endl;
+    }
+
+    out << "{\"mode\":\"" << mode << "\",\"seconds\":" << (monotonic_now_ns() - this->start_ns) / 1e9 << ",\"stages\":{";
+    bool first = true;
+    for (int i = 0; i < STAGE_COUNT; i++) {
+        const latency_histogram &stage = this->stages[i];
+        if (stage.count() == 0) continue;
+        out << (first ? "" : ",") << "\"" << stage_names[i] << "\":{\"count\":" << stage.count();
+        out << ",\"p50_us\":" << stage.percentile_ns(50.0) / 1000.0 << ",\"p99_us\":" << stage.percentile_ns(99.0) / 1000.0;
+        out << ",\"max_us\":" << stage.max_ns() / 1000.0 << ",\"mean_us\":" << stage.mean_ns() / 1000.0 << "}";
+        first = false;
+    }
+    out << "}}" << endl;
+
+    out.flags(flags);
+    out.precision(precision);
+}
@@ -0,0 +1,86 @@
+/* Copyright (c) 2013-2018 Ardexa Pty Ltd. All rights reserved.
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+
+#ifndef HISTOGRAM_HPP_INCLUDED
+#define HISTOGRAM_HPP_INCLUDED
+
+#include <string>
+#include <iostream>
+#include <stdint.h>
+#include "metrics.hpp"
+#include "timestamp.hpp"
+
+using namespace std;
+
+#define HISTOGRAM_SUB_BITS 4      /* Each power of 2 is split into 16 buckets, so a value is known to within 6% */
+#define HISTOGRAM_MAX_EXPONENT 40 /* Values up to 2^41 ns (about 36 minutes). Longer ones are counted as that */
+#define HISTOGRAM_BUCKETS (((HISTOGRAM_MAX_EXPONENT - HISTOGRAM_SUB_BITS + 2) << HISTOGRAM_SUB_BITS))
+
+/* This class counts durations (in nanoseconds) in log-linear buckets, as an HDR histogram does: the values below
+   16 ns have a bucket each, and each power of 2 above that is split into 16. So the percentiles are within 6%, and
+   recording a value is a few instructions with nothing allocated. Like a metric_counter, a histogram is only
+   recorded by one thread, and can be read by any */
+class latency_histogram
+{
+    public:
+        /* methods are public */
+        void record(int64_t value_ns);
+        void merge(const latency_histogram &other);
+        uint64_t count() const;
+        int64_t max_ns() const;
+        double mean_ns() const;
+        int64_t percentile_ns(double percentile) const;
+
+    private:
+        /* members are private */
+        metric_counter buckets[HISTOGRAM_BUCKETS];
+        metric_counter total;
+        metric_counter sum;
+        metric_counter maximum;
+};
+
+/* The stages of a poll cycle, from waking the console to the lines in the logs */
+enum stage_t {
+    STAGE_WAKEUP,           /* The first LF sent, to the LF CR answer */
+    STAGE_ACK,              /* The LPS command sent, to its ACK */
+    STAGE_FIRST_BYTE,       /* The LPS command sent, to the first byte of the first LOOP packet */
+    STAGE_FRAME,            /* The first byte of a packet, to the whole packet */
+    STAGE_INTERVAL,         /* One packet to the next */
+    STAGE_QUEUE,            /* A packet waiting for the logging thread (daemon mode) */
+    STAGE_DECODE,           /* extract_results() */
+    STAGE_FORMAT,           /* format_result(), and the date-time */
+    STAGE_WRITE_DAILY,      /* Writing the daily log */
+    STAGE_WRITE_LATEST,     /* Writing 'latest.csv' */
+    STAGE_COUNT
+};
+
+/* A histogram of each stage. In daemon mode, each station has one. The serial stages are recorded by the thread
+   reading the devices, and the others by the logging thread */
+class stage_stats
+{
+    public:
+        /* methods are public */
+        stage_stats();
+        void record(stage_t stage, int64_t value_ns);
+        void merge(const stage_stats &other);
+        void print(ostream &out, string mode);
+
+    private:
+        /* members are private */
+        latency_histogram stages[STAGE_COUNT];
+        int64_t start_ns;
+};
+
+#endif /* HISTOGRAM_HPP_INCLUDED */
@@ -0,0 +1,305 @@
+/* Copyright (c) 2013-2018 Ardexa Pty Ltd. All rights reserved.
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+
+#include <stddef.h>
+#include <string.h>
+#include "journal.hpp"
+#include "binary_log.hpp"
+#include "timestamp.hpp"
+
+#define JOURNAL_READ_SIZE 16384     /* The size of the reads when checking a batch */
+
+/* A file named in the journal. Once a batch of it has been checked, the older records of it are ignored */
+typedef struct journal_target_s {
+    uint16_t file;
+    uint32_t date;
+    bool resolved;
+} journal_target_t;
+
+/* The CRC-32 that covers a record */
+static uint32_t journal_record_crc(const journal_record_t *record)
+{
+    return crc32((const unsigned char *) record, offsetof(journal_record_t, record_crc));
+}
+
+/* Returns true if a record was written in full */
+static bool journal_record_valid(const journal_record_t *record)
+{
+    return (record->magic == JOURNAL_MAGIC) and (record->file <= JOURNAL_BINARY) and (record->record_crc == journal_record_crc(record));
+}
+
+/* Constructor for the log_journal class */
+log_journal::log_journal()
+{
+    this->filedesc = -1;
+    this->size = 0;
+    /* A flush adds a record for each file, so after this nothing is allocated */
+    this->waiting.reserve(JOURNAL_BINARY + 1);
+}
+
+/* Destructor */
+log_journal::~log_journal()
+{
+    this->close();
+}
+
+/* Open (or create) the journal of the logs starting with 'prefix' in 'directory'. Returns true on success */
+bool log_journal::open(string directory, string prefix)
+{
+    struct stat st_file;
+
+    this->close();
+    string fullpath = directory + prefix + JOURNAL_SUFFIX;
+    this->filedesc = ::open(fullpath.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    if (this->filedesc < 0) {
+        if (g_debug > 0) cout << "Cannot open the journal: " << fullpath << endl;
+        return false;
+    }
+    this->size = (fstat(this->filedesc, &st_file) == 0) ? st_file.st_size : 0;
+    return true;
+}
+
+/* Close the journal. Records not yet committed are dropped */
+void log_journal::close()
+{
+    if (this->filedesc >= 0) ::close(this->filedesc);
+    this->filedesc = -1;
+    this->waiting.clear();
+}
+
+bool log_journal::is_open()
+{
+    return this->filedesc >= 0;
+}
+
+/* Add the record of a batch that has been written to a file. It is written to the journal by commit() */
+void log_journal::add(journal_file_t file, uint32_t date, uint64_t offset, const char *batch, size_t length)
+{
+    journal_record_t record;
+
+    if (this->filedesc < 0) {
+        return;
+    }
+    memset(&record, 0, sizeof(record));
+    record.magic = JOURNAL_MAGIC;
+    record.file = file;
+    record.date = date;
+    record.length = length;
+    record.offset = offset;
+    record.crc = crc32((const unsigned char *) batch, length);
+    record.record_crc = journal_record_crc(&record);
+    this->waiting.push_back(record);
+}
+
+/* Write the records that have been added, in one write. Returns the bytes written, or -1 on error */
+ssize_t log_journal::commit()
+{
+    size_t done = 0;
+    size_t length = this->waiting.size() * sizeof(journal_record_t);
+
+    if ((this->filedesc < 0) or (length == 0)) {
+        return 0;
+    }
+    const char *data = (const char *) this->waiting.data();
+    while (done < length) {
+        ssize_t result = write(this->filedesc, data + done, length - done);
+        if (result < 0) {
+            if (errno == EINTR) continue;
+            if (g_debug > 0) cout << "Error writing to the journal" << endl;
+            break;
+        }
+        done += result;
+    }
+    this->size += done;
+    this->waiting.clear();
+
+    return (done == length) ? (ssize_t) done : -1;
+}
+
+/* Returns true once the journal should be emptied */
+bool log_journal::is_full()
+{
+    return this->size >= JOURNAL_MAX_SIZE;
+}
+
+/* Empty the journal. Only call this once the files it covers have been synced */
+void log_journal::reset()
+{
+    if ((this->filedesc >= 0) and (ftruncate(this->filedesc, 0) == 0)) {
+        this->size = 0;
+    }
+}
+
+/* The full path of a file named in the journal */
+string journal_filename(string directory, string prefix, journal_file_t file, uint32_t date)
+{
+    char name[DATESIZE];
+
+    if (file == JOURNAL_LATEST) {
+        return directory + "latest.csv";
+    }
+    date_string(date, name, sizeof(name));
+    return directory + prefix + name + ((file == JOURNAL_BINARY) ? ".bin" : ".log");
+}
+
+/* Cut a file back to the end of its last whole line (if 'record_size' is 0) or record (after 'header_size'
+   bytes). Only the end of the file is read. Returns the new size, or -1 on error */
+off_t trim_torn_tail(int filedesc, off_t header_size, size_t record_size)
+{
+    struct stat st_file;
+    char buffer[4096];
+
+    if (fstat(filedesc, &st_file) != 0) {
+        return -1;
+    }
+    off_t size = st_file.st_size;
+    off_t keep = size;
+
+    if (record_size > 0) {
+        keep = (size < header_size) ? 0 : header_size + ((size - header_size) / record_size) * record_size;
+    }
+    else {
+        /* Look back from the end for the last newline. A tail of zeros is cut off as well */
+        off_t end = size;
+        keep = 0;
+        while (end > 0) {
+            off_t start = (end > (off_t) sizeof(buffer)) ? end - sizeof(buffer) : 0;
+            ssize_t length = pread(filedesc, buffer, end - start, start);
+            if (length != end - start) {
+                return -1;
+            }
+            const char *newline = (const char *) memrchr(buffer, '\n', length);
+            if (newline != NULL) {
+                keep = start + (newline - buffer) + 1;
+                break;
+            }
+            end = start;
+        }
+    }
+
+    if (keep < size) {
+        if (ftruncate(filedesc, keep) != 0) {
+            return -1;
+        }
+        if (g_debug > 0) cout << "Removed a partly written tail of " << (size - keep) << " bytes" << endl;
+    }
+    return keep;
+}
+
+/* Check that the batch of a record is all in the file with the right CRC. If so, anything after it is cut off.
+   Returns 1 if the batch was found, 0 if not, or -1 if the file doesn't exist */
+static int recover_batch(string filename, const journal_record_t *record, int *truncated)
+{
+    struct stat st_file;
+    unsigned char buffer[JOURNAL_READ_SIZE];
+
+    int filedesc = open(filename.c_str(), O_RDWR | O_CLOEXEC);
+    if (filedesc < 0) {
+        return -1;
+    }
+    uint64_t end = record->offset + record->length;
+    if ((fstat(filedesc, &st_file) != 0) or ((uint64_t) st_file.st_size < end)) {
+        close(filedesc);
+        return 0;
+    }
+
+    uint32_t crc = 0;
+    uint64_t pos = record->offset;
+    while (pos < end) {
+        size_t wanted = (end - pos < sizeof(buffer)) ? end - pos : sizeof(buffer);
+        ssize_t length = pread(filedesc, buffer, wanted, pos);
+        if (length <= 0) break;
+        crc = crc32(buffer, length, crc);
+        pos += length;
+    }
+    if ((pos != end) or (crc != record->crc)) {
+        close(filedesc);
+        return 0;
+    }
+
+    if ((uint64_t) st_file.st_size > end) {
+        if (g_debug > 0) cout << "Removed " << (st_file.st_size - end) << " bytes written after the last batch in the journal, from: " << filename << endl;
+        if (ftruncate(filedesc, end) == 0) (*truncated)++;
+    }
+    close(filedesc);
+    return 1;
+}
+
+/* Check the end of each file named in the last records of the journal of the logs starting with 'prefix' in
+   'directory', and cut off anything after the last batch that is intact. Returns the number of files cut */
+int recover_journal(string directory, string prefix)
+{
+    struct stat st_file;
+    int truncated = 0;
+
+    string fullpath = directory + prefix + JOURNAL_SUFFIX;
+    int filedesc = open(fullpath.c_str(), O_RDWR | O_CLOEXEC);
+    if (filedesc < 0) {
+        return 0;
+    }
+    if (fstat(filedesc, &st_file) != 0) {
+        close(filedesc);
+        return 0;
+    }
+
+    /* A record that was only partly written is dropped */
+    off_t whole = st_file.st_size - st_file.st_size % sizeof(journal_record_t);
+    if ((whole != st_file.st_size) and (ftruncate(filedesc, whole) != 0)) {
+        close(filedesc);
+        return 0;
+    }
+    size_t count = whole / sizeof(journal_record_t);
+    if (count > JOURNAL_RECOVERY_RECORDS) count = JOURNAL_RECOVERY_RECORDS;
+    vector<journal_record_t> records(count);
+    size_t length = count * sizeof(journal_record_t);
+    if ((count > 0) and (pread(filedesc, records.data(), length, whole - length) != (ssize_t) length)) {
+        count = 0;
+    }
+    close(filedesc);
+
+    /* From the newest record back, check the latest batch of each file */
+    vector<journal_target_t> targets;
+    for (size_t i = count; i-- > 0; ) {
+        const journal_record_t *record = &records[i];
+        if (not journal_record_valid(record)) continue;
+
+        size_t target = 0;
+        while ((target < targets.size()) and ((targets[target].file != record->file) or (targets[target].date != record->date))) target++;
+        if (target == targets.size()) {
+            journal_target_t new_target = { record->file, record->date, false };
+            targets.push_back(new_target);
+        }
+        if (targets[target].resolved) continue;
+
+        string filename = journal_filename(directory, prefix, (journal_file_t) record->file, record->date);
+        if (recover_batch(filename, record, &truncated) != 0) {
+            targets[target].resolved = true;
+        }
+    }
+
+    /* If none of the batches of a file are intact, the best that can be done is to cut it back to a whole line */
+    for (size_t i = 0; i < targets.size(); i++) {
+        if (targets[i].resolved) continue;
+        string filename = journal_filename(directory, prefix, (journal_file_t) targets[i].file, targets[i].date);
+        int file_filedesc = open(filename.c_str(), O_RDWR | O_CLOEXEC);
+        if (file_filedesc < 0) continue;
+        if (g_debug > 0) cout << "No intact batch in the journal for: " << filename << endl;
+        if (targets[i].file == JOURNAL_BINARY) trim_torn_tail(file_filedesc, BINARY_HEADER_SIZE, sizeof(binary_record_t));
+        else trim_torn_tail(file_filedesc, 0, 0);
+        close(file_filedesc);
+    }
+
+    return truncated;
+}
@@ -0,0 +1,91 @@
+/* Copyright (c) 2013-2018 Ardexa Pty Ltd. All rights reserved.
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+
+#ifndef JOURNAL_HPP_INCLUDED
+#define JOURNAL_HPP_INCLUDED
+
+#include <string>
+#include <vector>
+#include <iostream>
+#include <stdint.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "configs.hpp"
+#include "crc.hpp"
+
+using namespace std;
+
+/* The log_writer appends a batch of lines to each file, with O_APPEND, each time it flushes. After a power cut,
+   the end of a file can be a batch that was only partly written (or filled with zeros), which breaks anything
+   reading the CSV. Rather than calling fdatasync() for each batch, each write is followed by a record in the
+   journal '<prefix>journal', in the same directory, giving the file, where the batch starts, its length and its
+   CRC-32. Each record has a CRC-32 of its own, so a record that was only partly written is seen.
+
+   When the logs are opened, recover_journal() reads the last JOURNAL_RECOVERY_RECORDS records. For each file they
+   name, it finds the latest batch that is all on disk with the right CRC, and truncates anything after it. So
+   recovery only reads the end of the journal and the last batch of each file, however big they are. The journal is
+   emptied once it reaches JOURNAL_MAX_SIZE, after the files it covers have been synced */
+
+#define JOURNAL_SUFFIX "journal"
+#define JOURNAL_MAGIC 0x4c4e524a            /* "JRNL" */
+#define JOURNAL_RECOVERY_RECORDS 256
+#define JOURNAL_MAX_SIZE (1024 * 1024)
+
+typedef enum journal_file_e {
+    JOURNAL_DAILY = 0,                      /* The daily log '<prefix>YYYY-MM-DD.log' */
+    JOURNAL_LATEST,                         /* 'latest.csv' */
+    JOURNAL_BINARY                          /* The binary log '<prefix>YYYY-MM-DD.bin' */
+} journal_file_t;
+
+typedef struct journal_record_s {
+    uint32_t magic;
+    uint16_t file;                          /* A journal_file_t */
+    uint16_t reserved;
+    uint32_t date;                          /* The day of a daily file, as YYYYMMDD */
+    uint32_t length;                        /* Of the batch */
+    uint64_t offset;                        /* Where the batch starts in the file */
+    uint32_t crc;                           /* CRC-32 of the batch */
+    uint32_t record_crc;                    /* CRC-32 of the record, up to this field */
+} journal_record_t;
+
+/* This class appends the records to the journal */
+class log_journal
+{
+    public:
+        /* methods are public */
+        log_journal();
+        ~log_journal();
+        bool open(string directory, string prefix);
+        void close();
+        bool is_open();
+        void add(journal_file_t file, uint32_t date, uint64_t offset, const char *batch, size_t length);
+        ssize_t commit();
+        bool is_full();
+        void reset();
+
+    private:
+        /* members are private */
+        int filedesc;
+        off_t size;
+        vector<journal_record_t> waiting;
+};
+
+string journal_filename(string directory, string prefix, journal_file_t file, uint32_t date);
+int recover_journal(string directory, string prefix);
+off_t trim_torn_tail(int filedesc, off_t header_size, size_t record_size);
+
+#endif /* JOURNAL_HPP_INCLUDED */
@@ -0,0 +1,111 @@
+/* Copyright (c) 2013-2018 Ardexa Pty Ltd. All rights reserved.
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/* davis-latest prints the latest reading of a running ardexa-davis (started with --shm), as a line of the daily
+   log, such as:
+
+        davis-latest -n ardexa-davis -H
+
+   The reading is read from shared memory, so it is as fresh as the last LOOP packet, and nothing is parsed. It
+   exits with 2 if there is no reading, and 3 if it is older than -m seconds. */
+
+#include <iostream>
+#include <unistd.h>
+#include <getopt.h>
+#include "configs.hpp"
+#include "utils.hpp"
+#include "timestamp.hpp"
+#include "shared_latest.hpp"
+
+using namespace std;
+
+/* Global variables. */
+int g_debug = DEFAULT_DEBUG_VALUE;
+
+static const char *usage_string = "Usage: davis-latest [-n name] [-H] [-w] [-m seconds] [-s]\n";
+
+/* The main function */
+int main(int argc, char *argv[])
+{
+    int opt;
+    string name = DEFAULT_SHM_NAME;
+    bool header = false, wait = false, status = false;
+    long max_age = -1;
+
+    while ((opt = getopt(argc, argv, "n:Hwm:s")) != -1) {
+        switch (opt) {
+            case 'n':
+                name = optarg;
+                break;
+            case 'H':
+                header = true;
+                break;
+            case 'w':
+                wait = true;
+                break;
+            case 'm':
+                if ((not convert_long(optarg, &max_age)) or (max_age < 0)) {
+                    cout << "The maximum age must be a number of seconds: " << optarg << endl;
+                    return 1;
+                }
+                break;
+            case 's':
+                status = true;
+                break;
+            default:
+                cout << usage_string;
+                return 1;
+        }
+    }
+
+    const shared_latest_t *segment = open_shared_latest(name);
+    if (segment == NULL) {
+        cout << "No reading has been published as: " << name << endl;
+        return 2;
+    }
+
+    /* With -w, wait for the next reading rather than printing the one already there */
+    shared_latest_t latest;
+    bool valid = read_shared_latest(segment, &latest);
+    if (wait) {
+        uint64_t count = latest.count;
+        while (valid and (latest.count == count)) {
+            usleep(LATEST_WAIT_MS * 1000);
+            valid = read_shared_latest(segment, &latest);
+        }
+    }
+    close_shared_latest(segment);
+    if ((not valid) or (latest.count == 0)) {
+        cout << "No reading has been published as: " << name << endl;
+        return 2;
+    }
+
+    bool wdspd_kmh = latest.flags & SHARED_LATEST_KMH;
+    bool loop2 = latest.flags & SHARED_LATEST_LOOP2;
+    int32_t utc_offset;
+    char datetime[DATETIME_SIZE];
+    char line[LINE_SIZE];
+    datetime_formatter formatter;
+    formatter.format(datetime, latest.realtime_ms * 1000000, &utc_offset);
+    format_result(line, sizeof(line), latest.davis_data, loop2, datetime);
+
+    int64_t age_ms = stamp_now().realtime_ns / 1000000 - latest.realtime_ms;
+    if (header) cout << header_line(wdspd_kmh, loop2) << endl;
+    cout << line << endl;
+    if (status) cout << "# PID: " << latest.pid << " Readings: " << latest.count << " Age (ms): " << age_ms << endl;
+
+    if ((max_age >= 0) and (age_ms > max_age * 1000)) {
+        return 3;
+    }
+    return 0;
+}
@@ -0,0 +1,291 @@
+/* Copyright (c) 2013-2018 Ardexa Pty Ltd. All rights reserved.
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "log_index.hpp"
+#include <algorithm>
+#include <fstream>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+/* Read 'count' digits as a number. Returns -1 if any of them isn't a digit */
+static int parse_digits(const char *text, int count)
+{
+    int value = 0;
+    for (int i = 0; i < count; i++) {
+        if ((text[i] < '0') or (text[i] > '9')) return -1;
+        value = value * 10 + (text[i] - '0');
+    }
+    return value;
+}
+
+/* Days since 1970-01-01 of a date in the proleptic Gregorian calendar */
+static int64_t days_from_civil(int year, int month, int day)
+{
+    year -= (month <= 2);
+    int64_t era = (year >= 0 ? year : year - 399) / 400;
+    int64_t year_of_era = year - era * 400;
+    int64_t day_of_year = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    int64_t day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+    return era * 146097 + day_of_era - 719468;
+}
+
+/* Parse the timestamp at the start of a log line, such as "2017-01-30T15:30:45+1000" or "2017-01-30T15:30:45.250+1000",
+   into milliseconds since the epoch (UTC). Returns false if the line doesn't start with a timestamp */
+bool parse_log_timestamp(const char *line, size_t length, int64_t *timestamp_ms)
+{
+    /* The shortest is "YYYY-MM-DDTHH:MM:SS+hhmm" */
+    if ((length < 24) or (line[4] != '-') or (line[7] != '-') or (line[10] != 'T') or (line[13] != ':') or (line[16] != ':')) {
+        return false;
+    }
+
+    int year = parse_digits(line, 4);
+    int month = parse_digits(&line[5], 2);
+    int day = parse_digits(&line[8], 2);
+    int hour = parse_digits(&line[11], 2);
+    int minute = parse_digits(&line[14], 2);
+    int second = parse_digits(&line[17], 2);
+    if ((year < 0) or (month < 1) or (day < 1) or (hour < 0) or (minute < 0) or (second < 0)) {
+        return false;
+    }
+
+    /* Optional milliseconds */
+    size_t pos = 19;
+    int millis = 0;
+    if (line[pos] == '.') {
+        if ((length < 28) or ((millis = parse_digits(&line[pos + 1], 3)) < 0)) return false;
+        pos += 4;
+    }
+
+    /* UTC offset */
+    if ((pos + 5 > length) or ((line[pos] != '+') and (line[pos] != '-'))) {
+        return false;
+    }
+    int offset_hours = parse_digits(&line[pos + 1], 2);
+    int offset_minutes = parse_digits(&line[pos + 3], 2);
+    if ((offset_hours < 0) or (offset_minutes < 0)) {
+        return false;
+    }
+    int64_t offset = (offset_hours * 3600 + offset_minutes * 60) * (line[pos] == '-' ? -1 : 1);
+
+    int64_t seconds = days_from_civil(year, month, day) * 86400 + hour * 3600 + minute * 60 + second - offset;
+    *timestamp_ms = seconds * 1000 + millis;
+    return true;
+}
+
+/* The CRC of the INDEX_CHECK_SIZE bytes of the log before 'indexed_size' */
+static uint32_t index_tail_crc(const char *log, size_t indexed_size)
+{
+    size_t start = (indexed_size > INDEX_CHECK_SIZE) ? indexed_size - INDEX_CHECK_SIZE : 0;
+    return crc32((const unsigned char *) &log[start], indexed_size - start);
+}
+
+/* Read the index of a log, if there is one. Returns false if it is missing, or doesn't match the log */
+static bool read_log_index(string index_filename, const char *log, size_t log_size, uint64_t log_inode, index_header_t *header, vector<index_entry_t> *entries)
+{
+    ifstream reader(index_filename.c_str(), ios::binary);
+    if (not reader) {
+        return false;
+    }
+    reader.read((char *) header, sizeof(index_header_t));
+    if ((not reader) or (memcmp(header->magic, INDEX_MAGIC, sizeof(header->magic)) != 0) or (header->version != INDEX_VERSION) or
+        (header->stride != INDEX_STRIDE) or (header->indexed_size > log_size) or (header->log_inode != log_inode) or
+        (header->tail_crc != index_tail_crc(log, header->indexed_size))) {
+        return false;
+    }
+
+    index_entry_t entry;
+    while (reader.read((char *) &entry, sizeof(entry))) {
+        entries->push_back(entry);
+    }
+    return true;
+}
+
+/* Write the index to a temporary file and rename it, so a reader never sees half an index */
+static void write_log_index(string index_filename, const index_header_t *header, const vector<index_entry_t> &entries)
+{
+    string temp_filename = index_filename + ".tmp";
+    ofstream writer(temp_filename.c_str(), ios::binary | ios::trunc);
+    if (not writer) {
+        /* The directory may not be writable (such as when not run as root). The index is still used for this query */
+        return;
+    }
+    writer.write((const char *) header, sizeof(index_header_t));
+    if (not entries.empty()) {
+        writer.write((const char *) &entries[0], entries.size() * sizeof(index_entry_t));
+    }
+    writer.close();
+    if (writer) {
+        rename(temp_filename.c_str(), index_filename.c_str());
+    }
+    else {
+        remove(temp_filename.c_str());
+    }
+}
+
+/* Bring the index of a log up to date, and return its entries. 'log' is the mapped log file, and 'log_inode' its
+   inode. Returns false if the log has no lines with a timestamp */
+bool update_log_index(string log_filename, const char *log, size_t log_size, uint64_t log_inode, vector<index_entry_t> *entries)
+{
+    index_header_t header;
+    string index_filename = log_filename + INDEX_SUFFIX;
+
+    entries->clear();
+    if (not read_log_index(index_filename, log, log_size, log_inode, &header, entries)) {
+        entries->clear();
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, INDEX_MAGIC, sizeof(header.magic));
+        header.version = INDEX_VERSION;
+        header.stride = INDEX_STRIDE;
+        header.log_inode = log_inode;
+    }
+
+    /* Index the lines added since the index was written. Only whole lines are indexed */
+    if (header.indexed_size < log_size) {
+        size_t pos = header.indexed_size;
+        while (pos < log_size) {
+            const char *end = (const char *) memchr(&log[pos], '\n', log_size - pos);
+            if (end == NULL) break;
+            size_t length = end - &log[pos];
+            int64_t timestamp_ms;
+
+            if ((log[pos] != '#') and parse_log_timestamp(&log[pos], length, &timestamp_ms)) {
+                if (header.lines_indexed % INDEX_STRIDE == 0) {
+                    index_entry_t entry = { timestamp_ms, pos };
+                    entries->push_back(entry);
+                }
+                header.lines_indexed++;
+            }
+            pos += length + 1;
+        }
+
+        if (pos != header.indexed_size) {
+            header.indexed_size = pos;
+            header.tail_crc = index_tail_crc(log, pos);
+            write_log_index(index_filename, &header, *entries);
+        }
+    }
+
+    return not entries->empty();
+}
+
+/* Reset the column statistics */
+void clear_column_stats(column_stats_t *stats)
+{
+    stats->count = 0;
+    stats->min = HUGE_VAL;
+    stats->max = -HUGE_VAL;
+    stats->sum = 0.0;
+}
+
+/* Add the statistics from part of the query to the total */
+void merge_column_stats(column_stats_t *total, const column_stats_t *part)
+{
+    total->count += part->count;
+    total->min = min(total->min, part->min);
+    total->max = max(total->max, part->max);
+    total->sum += part->sum;
+}
+
+/* Add the values of the lines in a log between 'start_ms' and 'end_ms' (inclusive) to 'stats'. 'columns' are the
+   numbers of the columns wanted (where 0 is the first column after the DateTime). Error values are not counted.
+   Returns the number of lines in the range */
+int query_log_file(string log_filename, int64_t start_ms, int64_t end_ms, const vector<int> &columns, vector<column_stats_t> *stats)
+{
+    struct stat st_file;
+    vector<index_entry_t> entries;
+    int lines = 0;
+
+    int filedesc = open(log_filename.c_str(), O_RDONLY);
+    if (filedesc < 0) {
+        return 0;
+    }
+    if ((fstat(filedesc, &st_file) != 0) or (st_file.st_size == 0)) {
+        close(filedesc);
+        return 0;
+    }
+    size_t log_size = st_file.st_size;
+    void *mapped = mmap(NULL, log_size, PROT_READ, MAP_PRIVATE, filedesc, 0);
+    close(filedesc);
+    if (mapped == MAP_FAILED) {
+        return 0;
+    }
+    const char *log = (const char *) mapped;
+
+    if (not update_log_index(log_filename, log, log_size, st_file.st_ino, &entries)) {
+        munmap(mapped, log_size);
+        return 0;
+    }
+
+    /* Start from the last indexed line before the range */
+    size_t pos = 0;
+    index_entry_t key = { start_ms, 0 };
+    vector<index_entry_t>::iterator found = lower_bound(entries.begin(), entries.end(), key,
+        [](const index_entry_t &a, const index_entry_t &b) { return a.timestamp_ms < b.timestamp_ms; });
+    if (found != entries.begin()) {
+        pos = (found - 1)->offset;
+    }
+
+    /* The largest column wanted. Columns past it don't need to be parsed */
+    int last_column = *max_element(columns.begin(), columns.end());
+    vector<double> values(last_column + 1);
+
+    while (pos < log_size) {
+        const char *line = &log[pos];
+        const char *end = (const char *) memchr(line, '\n', log_size - pos);
+        if (end == NULL) break;
+        pos = end - log + 1;
+
+        int64_t timestamp_ms;
+        if ((line[0] == '#') or (not parse_log_timestamp(line, end - line, &timestamp_ms))) continue;
+        if (timestamp_ms < start_ms) continue;
+        if (timestamp_ms > end_ms) break;
+        lines++;
+
+        /* Split the values after the DateTime */
+        const char *field = (const char *) memchr(line, ',', end - line);
+        int column = 0;
+        while ((field != NULL) and (column <= last_column)) {
+            field++;
+            values[column++] = strtod(field, NULL);
+            field = (const char *) memchr(field, ',', end - field);
+        }
+
+        for (size_t i = 0; i < columns.size(); i++) {
+            if (columns[i] >= column) continue;
+            double value = values[columns[i]];
+            if (fabs(value - ERROR_VALUE_FLOAT) < 0.001) continue;
+
+            column_stats_t *column_stats = &(*stats)[i];
+            column_stats->count++;
+            column_stats->sum += value;
+            if (value < column_stats->min) column_stats->min = value;
+            if (value > column_stats->max) column_stats->max = value;
+        }
+    }
+
+    munmap(mapped, log_size);
+    return lines;
+}
+
+/* Returns the header line of a log (without the leading "# "), or an empty string */
+string read_log_header(string log_filename)
+{
+    string header;
+    ifstream reader(log_filename.c_str());
+
+    if (reader and getline(reader, header) and (header.compare(0, 2, "# ") == 0)) {
+        return header.substr(2);
+    }
+    return string();
+}
@@ -0,0 +1,73 @@
+/* Copyright (c) 2013-2018 Ardexa Pty Ltd. All rights reserved.
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef LOG_INDEX_HPP_INCLUDED
+#define LOG_INDEX_HPP_INCLUDED
+
+#include <string>
+#include <vector>
+#include <iostream>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <math.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "configs.hpp"
+#include "crc.hpp"
+
+using namespace std;
+
+/* Each daily log 'davis_YYYY-MM-DD.log' can have a sidecar index 'davis_YYYY-MM-DD.log.idx'. The index has the
+   timestamp and file offset of every INDEX_STRIDE'th line, so a query can seek close to the start of its time
+   range instead of reading the whole file. The index records how much of the log it covers, so when the log
+   grows, only the new lines are indexed. It also records the log's inode and a CRC of the last bytes it covers, so
+   an index is made again if the log was replaced, or cut short (by journal recovery) and written to again */
+
+#define INDEX_MAGIC "DAVISIDX"
+#define INDEX_VERSION 2
+#define INDEX_STRIDE 64
+#define INDEX_CHECK_SIZE 256        /* The bytes of the log, before the end of what is indexed, in 'tail_crc' */
+#define INDEX_SUFFIX ".idx"
+
+typedef struct index_header_s {
+    char magic[8];
+    uint32_t version;
+    uint32_t stride;
+    uint64_t indexed_size;      /* Bytes of the log covered by the index */
+    uint64_t lines_indexed;     /* Data lines (not counting the header) in those bytes */
+    uint64_t log_inode;         /* Of the log that was indexed */
+    uint32_t tail_crc;          /* CRC-32 of the INDEX_CHECK_SIZE bytes of the log before 'indexed_size' */
+    uint32_t reserved;
+} index_header_t;
+
+typedef struct index_entry_s {
+    int64_t timestamp_ms;
+    uint64_t offset;
+} index_entry_t;
+
+typedef struct column_stats_s {
+    uint64_t count;
+    double min;
+    double max;
+    double sum;
+} column_stats_t;
+
+bool parse_log_timestamp(const char *line, size_t length, int64_t *timestamp_ms);
+bool update_log_index(string log_filename, const char *log, size_t log_size, uint64_t log_inode, vector<index_entry_t> *entries);
+int query_log_file(string log_filename, int64_t start_ms, int64_t end_ms, const vector<int> &columns, vector<column_stats_t> *stats);
+void clear_column_stats(column_stats_t *stats);
+void merge_column_stats(column_stats_t *total, const column_stats_t *part);
+string read_log_header(string log_filename);
+
+#endif /* LOG_INDEX_HPP_INCLUDED */
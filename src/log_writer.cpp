@@ -0,0 +1,368 @@
+/* Copyright (c) 2013-2018 Ardexa Pty Ltd. All rights reserved.
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "log_writer.hpp"
+
+/* Constructor for the log_writer class. 'prefix' is the start of the daily file names, such as "davis_" */
+log_writer::log_writer(string directory, string prefix, string header, bool log_to_latest)
+{
+    /* Add an ending '/' to the directory path, if it doesn't exist */
+    if (*directory.rbegin() != '/') {
+        directory += "/";
+    }
+    this->directory = directory;
+    this->prefix = prefix;
+    this->header = header;
+    this->log_to_latest = log_to_latest;
+    this->flush_records = DEFAULT_FLUSH_RECORDS;
+    this->flush_ms = DEFAULT_FLUSH_MS;
+    this->sync = false;
+    this->binary = false;
+    this->blocks = false;
+    this->daily_filedesc = -1;
+    this->latest_filedesc = -1;
+    this->binary_filedesc = -1;
+    this->daily_size = 0;
+    this->latest_size = 0;
+    this->binary_size = 0;
+    this->date = 0;
+    this->day_start_ms = 0;
+    this->day_end_ms = 0;
+    this->retry_ms = 0;
+    this->records_waiting = 0;
+    this->oldest_waiting_ms = 0;
+    this->stats = NULL;
+}
+
+/* Destructor. Anything still buffered is written */
+log_writer::~log_writer()
+{
+    this->flush();
+    this->close_files();
+}
+
+/* Set when the buffered lines are written. A 'flush_records' of 1 writes every line straight away */
+void log_writer::set_durability(int flush_records, int flush_ms, bool sync)
+{
+    this->flush_records = (flush_records < 1) ? 1 : flush_records;
+    this->flush_ms = (flush_ms < 0) ? 0 : flush_ms;
+    this->sync = sync;
+}
+
+/* Also write each record to a daily binary log, with this calibration in its header */
+void log_writer::enable_binary(float barocal, bool wdspd_kmh, bool winddir_180, bool loop2)
+{
+    this->binary = true;
+    make_binary_header(&this->binary_header, barocal, wdspd_kmh, winddir_180, loop2);
+}
+
+/* Also write each record to a daily block log, compressed, with this calibration in each block */
+void log_writer::enable_blocks(float barocal, bool wdspd_kmh, bool winddir_180, bool loop2)
+{
+    this->blocks = true;
+    this->block_log.set_calibration(barocal, wdspd_kmh, winddir_180, loop2);
+}
+
+/* Add a line of 'length' chars (without a newline) to the logs. 'timestamp_ms' decides which daily file it goes in.
+   Once the buffers have grown to hold 'flush_records' lines, nothing is allocated. Returns 0 on success */
+int log_writer::append(const char *line, size_t length, const davis_data_t &davis_data, int64_t timestamp_ms, int32_t utc_offset)
+{
+    int result = 0;
+
+    /* Start a new daily file if this line is from a different day, or try the files that couldn't be opened again.
+       Without the daily log, the line is lost, but if only one of the other files couldn't be opened, the line still
+       goes to the rest */
+    if ((timestamp_ms < this->day_start_ms) or (timestamp_ms >= this->day_end_ms)) {
+        result = this->rotate(timestamp_ms);
+    }
+    else if ((this->retry_ms > 0) and (monotonic_now_ms() >= this->retry_ms)) {
+        result = this->open_files();
+    }
+    if (this->daily_filedesc < 0) {
+        return 2;
+    }
+
+    this->daily_buffer.append(line, length);
+    this->daily_buffer += '\n';
+    if (this->log_to_latest and (this->latest_filedesc >= 0)) {
+        this->latest_buffer.append(line, length);
+        this->latest_buffer += '\n';
+    }
+    if (this->binary and (this->binary_filedesc >= 0)) {
+        binary_record_t record;
+        make_binary_record(&record, davis_data, timestamp_ms, utc_offset);
+        this->binary_buffer.append((const char *) &record, sizeof(record));
+    }
+    if (this->blocks and (this->block_log.get_filedesc() >= 0)) {
+        /* This only writes when a block is full */
+        ssize_t written = this->block_log.append(davis_data, timestamp_ms, utc_offset);
+        if (written > 0) this->bytes_written.add(written);
+        if (written < 0) this->write_errors.add();
+    }
+
+    if (this->records_waiting == 0) {
+        this->oldest_waiting_ms = monotonic_now_ms();
+    }
+    this->records_waiting++;
+    this->lines.add();
+
+    int flushed = (this->records_waiting >= this->flush_records) ? this->flush() : this->flush_if_due();
+    return (result != 0) ? result : flushed;
+}
+
+int log_writer::append(const string &line, const davis_data_t &davis_data, int64_t timestamp_ms, int32_t utc_offset)
+{
+    return this->append(line.data(), line.length(), davis_data, timestamp_ms, utc_offset);
+}
+
+/* Write the buffered lines if the oldest has waited long enough. Call this regularly, even when no lines are
+   being added, so the lines don't wait forever. Returns 0 on success */
+int log_writer::flush_if_due()
+{
+    if ((this->records_waiting > 0) and (monotonic_now_ms() - this->oldest_waiting_ms >= this->flush_ms)) {
+        return this->flush();
+    }
+    return 0;
+}
+
+/* Write all the buffered lines. Returns 0 on success */
+int log_writer::flush()
+{
+    int result = 0;
+
+    if (this->records_waiting == 0) {
+        return 0;
+    }
+    int64_t start_ns = monotonic_now_ns();
+
+    if (this->write_buffer(this->daily_filedesc, this->daily_buffer, JOURNAL_DAILY, &this->daily_size) != 0) result = 2;
+    int64_t daily_ns = monotonic_now_ns();
+    if (this->write_buffer(this->latest_filedesc, this->latest_buffer, JOURNAL_LATEST, &this->latest_size) != 0) result = 3;
+    if (this->stats) {
+        this->stats->record(STAGE_WRITE_DAILY, daily_ns - start_ns);
+        if (this->log_to_latest) this->stats->record(STAGE_WRITE_LATEST, monotonic_now_ns() - daily_ns);
+    }
+    if (this->write_buffer(this->binary_filedesc, this->binary_buffer, JOURNAL_BINARY, &this->binary_size) != 0) result = 3;
+    if (this->blocks) {
+        ssize_t written = this->block_log.flush();
+        if (written > 0) this->bytes_written.add(written);
+        if (written < 0) result = 3;
+    }
+
+    /* The batches are recorded once they have been written. When the journal is full, it is emptied, but only
+       once the batches it records are on disk */
+    ssize_t journaled = this->journal.commit();
+    if (journaled > 0) this->bytes_written.add(journaled);
+    if (journaled < 0) result = 3;
+    bool empty_journal = this->journal.is_full();
+    if (this->sync or empty_journal) {
+        if (this->daily_filedesc >= 0) fdatasync(this->daily_filedesc);
+        if (this->latest_filedesc >= 0) fdatasync(this->latest_filedesc);
+        if (this->binary_filedesc >= 0) fdatasync(this->binary_filedesc);
+        if (this->block_log.get_filedesc() >= 0) fdatasync(this->block_log.get_filedesc());
+    }
+    if (empty_journal) {
+        this->journal.reset();
+    }
+
+    this->records_waiting = 0;
+    this->writes.add();
+    this->write_ns.add(monotonic_now_ns() - start_ns);
+    if (result != 0) this->write_errors.add();
+    return result;
+}
+
+/* Number of bytes written to all the files */
+uint64_t log_writer::get_bytes_written()
+{
+    return this->bytes_written.get();
+}
+
+/* Time the writes of the daily log and 'latest.csv', in 'stats' */
+void log_writer::set_stats(stage_stats *stats)
+{
+    this->stats = stats;
+}
+
+/* Add the counts to the metrics. 'labels' tells the logs apart */
+void log_writer::register_metrics(metrics_registry &registry, string labels)
+{
+    registry.add("davis_log_lines_total", METRIC_COUNTER, "Lines logged", labels, &this->lines);
+    registry.add("davis_log_writes_total", METRIC_COUNTER, "Times the buffered lines were written", labels, &this->writes);
+    registry.add("davis_log_write_errors_total", METRIC_COUNTER, "Writes that failed", labels, &this->write_errors);
+    registry.add("davis_log_write_seconds_total", METRIC_COUNTER, "Time spent writing the logs, including fdatasync()", labels, &this->write_ns, 1e-9);
+    registry.add("davis_log_bytes_written_total", METRIC_COUNTER, "Bytes written to the logs", labels, &this->bytes_written);
+}
+
+/* Close the files of the current day, and open those for the day of 'timestamp_ms'. Returns 0 on success, 2 if the
+   daily log couldn't be opened, or 3 if only 'latest.csv', the binary log or the block log couldn't */
+int log_writer::rotate(int64_t timestamp_ms)
+{
+    /* Anything buffered belongs to the old files */
+    this->flush();
+    this->close_files();
+
+    /* Work out the date, and the start and end of the day, in local time */
+    this->date = local_day(timestamp_ms, &this->day_start_ms, &this->day_end_ms);
+    return this->open_files();
+}
+
+/* Open the files of the current day that aren't open. If any can't be, they are tried again (by append()) after
+   STATION_REOPEN_TIME, leaving the others open. Returns 0 on success, 2 if the daily log couldn't be opened, or 3
+   if only 'latest.csv', the binary log or the block log couldn't */
+int log_writer::open_files()
+{
+    int result = 0;
+    char date[DATESIZE];
+    bool is_new = false;
+    /* If the log directory or the daily file does not exist, then 'latest.csv' is renamed and a new one created */
+    bool rotate_latest = false;
+
+    date_string(this->date, date, sizeof(date));
+    this->retry_ms = 0;
+
+    /* Check and create the directory if necessary */
+    if (not check_directory(this->directory)) {
+        if (g_debug > 0) cout << "Directory doesn't exist. Creating it: " << this->directory << endl;
+        rotate_latest = true;
+        if (not create_directory(this->directory)) {
+            this->retry_ms = monotonic_now_ms() + STATION_REOPEN_TIME * 1000;
+            this->write_errors.add();
+            return 2;
+        }
+    }
+
+    /* The first time the files are opened, cut off anything that was only partly written before a crash */
+    if (not this->journal.is_open()) {
+        recover_journal(this->directory, this->prefix);
+        this->journal.open(this->directory, this->prefix);
+    }
+
+    if (this->daily_filedesc < 0) {
+        this->daily_filedesc = this->open_file(this->prefix + date + ".log", &is_new, &this->daily_size, 0, 0);
+        if (this->daily_filedesc < 0) {
+            result = 2;
+        }
+        else if (is_new) {
+            this->daily_buffer += this->header + "\n";
+            rotate_latest = true;
+        }
+    }
+
+    if (this->log_to_latest and (this->latest_filedesc < 0)) {
+        if (rotate_latest) {
+            string fullpath = this->directory + "latest.csv";
+            string newpath = this->directory + "latest.csv.OLD";
+            rename(fullpath.c_str(), newpath.c_str());
+        }
+        this->latest_filedesc = this->open_file("latest.csv", &is_new, &this->latest_size, 0, 0);
+        if (this->latest_filedesc < 0) {
+            if (result == 0) result = 3;
+        }
+        else if (is_new) {
+            this->latest_buffer += this->header + "\n";
+        }
+    }
+
+    if (this->binary and (this->binary_filedesc < 0)) {
+        this->binary_filedesc = this->open_file(this->prefix + date + ".bin", &is_new, &this->binary_size, BINARY_HEADER_SIZE, sizeof(binary_record_t));
+        if (this->binary_filedesc < 0) {
+            if (result == 0) result = 3;
+        }
+        /* A new file needs the header, padded out to BINARY_HEADER_SIZE */
+        else if (is_new) {
+            string header_block(BINARY_HEADER_SIZE, '\0');
+            memcpy(&header_block[0], &this->binary_header, sizeof(this->binary_header));
+            this->binary_buffer += header_block;
+        }
+    }
+
+    if (this->blocks and (this->block_log.get_filedesc() < 0)) {
+        if (not this->block_log.open(this->directory + this->prefix + date + BLOCK_SUFFIX)) {
+            if (result == 0) result = 3;
+        }
+    }
+
+    if (result != 0) {
+        this->retry_ms = monotonic_now_ms() + STATION_REOPEN_TIME * 1000;
+        this->write_errors.add();
+    }
+    return result;
+}
+
+/* Open a file in the logging directory for appending. If it ends part way through a line (or a record of
+   'record_size' bytes, after 'header_size'), that part is cut off. 'is_new' is set if it is empty, and 'size' to its
+   size. Returns the file descriptor, or -1 on error */
+int log_writer::open_file(string filename, bool *is_new, off_t *size, off_t header_size, size_t record_size)
+{
+    string fullpath = this->directory + filename;
+
+    if (g_debug > 1) cout << "Full filename: " << fullpath << endl;
+    int filedesc = open(fullpath.c_str(), O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    if (filedesc < 0) {
+        if (g_debug > 0) cout << "Cannot open logging file: " << fullpath << endl;
+        return -1;
+    }
+    *size = trim_torn_tail(filedesc, header_size, record_size);
+    if (*size < 0) *size = 0;
+    *is_new = (*size == 0);
+
+    return filedesc;
+}
+
+/* Write and empty a buffer, and add it to the journal as 'file'. 'size' is the size of the file. Returns 0 on success */
+int log_writer::write_buffer(int filedesc, string &buffer, journal_file_t file, off_t *size)
+{
+    size_t done = 0;
+
+    if (buffer.empty()) {
+        return 0;
+    }
+    if (filedesc < 0) {
+        buffer.clear();
+        return 2;
+    }
+
+    while (done < buffer.length()) {
+        ssize_t result = write(filedesc, buffer.data() + done, buffer.length() - done);
+        if (result < 0) {
+            if (errno == EINTR) continue;
+            if (g_debug > 0) cout << "Error writing to a logging file" << endl;
+            break;
+        }
+        done += result;
+    }
+    this->bytes_written.add(done);
+    bool complete = (done == buffer.length());
+    if (complete) {
+        this->journal.add(file, this->date, *size, buffer.data(), buffer.length());
+    }
+    *size += done;
+    buffer.clear();
+
+    return complete ? 0 : 2;
+}
+
+/* Close all the files */
+void log_writer::close_files()
+{
+    if (this->daily_filedesc >= 0) close(this->daily_filedesc);
+    if (this->latest_filedesc >= 0) close(this->latest_filedesc);
+    if (this->binary_filedesc >= 0) close(this->binary_filedesc);
+    ssize_t sealed = this->block_log.seal();
+    if (sealed > 0) this->bytes_written.add(sealed);
+    this->block_log.close();
+    this->daily_filedesc = -1;
+    this->latest_filedesc = -1;
+    this->binary_filedesc = -1;
+}
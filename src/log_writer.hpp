@@ -0,0 +1,104 @@
+/* Copyright (c) 2013-2018 Ardexa Pty Ltd. All rights reserved.
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef LOG_WRITER_HPP_INCLUDED
+#define LOG_WRITER_HPP_INCLUDED
+
+#include <string>
+#include <iostream>
+#include <stdint.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "configs.hpp"
+#include "utils.hpp"
+#include "binary_log.hpp"
+#include "block_store.hpp"
+#include "journal.hpp"
+#include "timestamp.hpp"
+#include "metrics.hpp"
+#include "histogram.hpp"
+
+using namespace std;
+
+/* This class writes the daily log files, and 'latest.csv'. The files are kept open between lines (rather than
+   opened for each one), and the lines are buffered and written in groups. The buffer is written when 'flush_records' lines are waiting, or the
+   oldest has waited 'flush_ms' milliseconds. If 'sync' is set, fdatasync() is called after each write, so the
+   lines are on disk, not just in the page cache.
+
+   The day of each line is taken from its timestamp, so records from the archive go into the right file. When the
+   day changes, a new daily file is started and 'latest.csv' is moved to 'latest.csv.OLD'.
+
+   Each batch written is recorded in the journal (see journal.hpp), and when the files are first opened, any
+   partly written batch at their end (from a crash or power cut) is cut off */
+class log_writer
+{
+    public:
+        /* methods are public */
+        log_writer(string directory, string prefix, string header, bool log_to_latest);
+        ~log_writer();
+        void set_durability(int flush_records, int flush_ms, bool sync);
+        void enable_binary(float barocal, bool wdspd_kmh, bool winddir_180, bool loop2);
+        void enable_blocks(float barocal, bool wdspd_kmh, bool winddir_180, bool loop2);
+        int append(const char *line, size_t length, const davis_data_t &davis_data, int64_t timestamp_ms, int32_t utc_offset);
+        int append(const string &line, const davis_data_t &davis_data, int64_t timestamp_ms, int32_t utc_offset);
+        int flush();
+        int flush_if_due();
+        uint64_t get_bytes_written();
+        void register_metrics(metrics_registry &registry, string labels);
+        void set_stats(stage_stats *stats);
+
+    private:
+        /* members are private */
+        int rotate(int64_t timestamp_ms);
+        int open_files();
+        int open_file(string filename, bool *is_new, off_t *size, off_t header_size, size_t record_size);
+        int write_buffer(int filedesc, string &buffer, journal_file_t file, off_t *size);
+        void close_files();
+        string directory;
+        string prefix;
+        string header;
+        bool log_to_latest;
+        int flush_records;
+        int flush_ms;
+        bool sync;
+        bool binary;
+        binary_header_t binary_header;
+        bool blocks;
+        block_writer block_log;
+        int daily_filedesc;
+        int latest_filedesc;
+        int binary_filedesc;
+        off_t daily_size;
+        off_t latest_size;
+        off_t binary_size;
+        log_journal journal;
+        uint32_t date;                  /* Of the daily files, as YYYYMMDD */
+        string daily_buffer;
+        string latest_buffer;
+        string binary_buffer;
+        int64_t day_start_ms;
+        int64_t day_end_ms;
+        int64_t retry_ms;               /* When to try again the files that couldn't be opened (0 if none) */
+        int records_waiting;
+        int64_t oldest_waiting_ms;
+        metric_counter lines;
+        metric_counter writes;
+        metric_counter write_errors;
+        metric_counter write_ns;
+        metric_counter bytes_written;
+        stage_stats *stats;
+};
+
+#endif /* LOG_WRITER_HPP_INCLUDED */
@@ -0,0 +1,166 @@
+/* Copyright (c) 2013-2018 Ardexa Pty Ltd. All rights reserved.
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "loop_parser.hpp"
+#include "crc.hpp"
+
+/* Every LOOP and LOOP2 packet starts with these 3 chars */
+static const unsigned char loop_header[] = { 'L', 'O', 'O' };
+
+/* Constructor for the loop_parser class */
+loop_parser::loop_parser()
+{
+    this->reset();
+}
+
+/* Throw away any partial packet. Use this after a new command is sent */
+void loop_parser::reset()
+{
+    this->fill = 0;
+    this->ready = false;
+}
+
+/* Consume bytes from 'data' until a whole packet has been assembled, or 'data' is used up.
+   Returns the number of bytes consumed. If a packet was completed, frame_ready() will be true
+   until the next call to feed() */
+size_t loop_parser::feed(const unsigned char *data, size_t length)
+{
+    size_t used = 0;
+
+    /* The previous packet has been handed over, so start on the next one */
+    if (this->ready) {
+        this->ready = false;
+        this->fill = 0;
+    }
+
+    while (used < length) {
+        /* Look for the header one char at a time, so a packet can start anywhere in the data */
+        if (this->fill < sizeof(loop_header)) {
+            if (data[used] == loop_header[this->fill]) {
+                this->buffer[this->fill++] = data[used];
+            }
+            else {
+                if (this->fill > 0) {
+                    /* A partial header, such as "LO" followed by rubbish */
+                    this->resyncs.add();
+                    this->skipped.add(this->fill);
+                    this->fill = 0;
+                    /* The char that broke the header may be the start of the next one */
+                    if (data[used] == loop_header[0]) {
+                        this->buffer[this->fill++] = data[used];
+                        used++;
+                        continue;
+                    }
+                }
+                this->skipped.add();
+            }
+            used++;
+            continue;
+        }
+
+        /* The header has been found, so copy as much of the rest of the packet as is available */
+        size_t wanted = LOOP_PACKET_SIZE - this->fill;
+        size_t available = length - used;
+        size_t count = (wanted < available) ? wanted : available;
+        memcpy(&this->buffer[this->fill], &data[used], count);
+        this->fill += count;
+        used += count;
+
+        if (this->fill == LOOP_PACKET_SIZE) {
+            /* A whole packet must end with a LF and a CR, before the CRC */
+            if ((this->buffer[LOOP_PACKET_SIZE - 4] == '\n') and (this->buffer[LOOP_PACKET_SIZE - 3] == '\r')) {
+                if (crc16_check(this->buffer, LOOP_PACKET_SIZE)) {
+                    this->frames.add();
+                    this->ready = true;
+                    return used;
+                }
+                /* The packet has been corrupted */
+                this->crc_errors.add();
+            }
+            /* The header was a false match, or the packet is corrupt. Start again after it, with what has already been received */
+            this->resyncs.add();
+            this->resync(1);
+        }
+    }
+
+    return used;
+}
+
+/* Discard the first 'start' bytes of the buffer, then find the next possible header in what remains */
+void loop_parser::resync(size_t start)
+{
+    size_t i, j;
+
+    for (i = start; i < this->fill; i++) {
+        /* Check as much of the header as is available at offset 'i' */
+        for (j = 0; (j < sizeof(loop_header)) and (i + j < this->fill); j++) {
+            if (this->buffer[i + j] != loop_header[j]) break;
+        }
+        if ((j == sizeof(loop_header)) or (i + j == this->fill)) break;
+    }
+
+    this->skipped.add(i);
+    memmove(this->buffer, &this->buffer[i], this->fill - i);
+    this->fill -= i;
+}
+
+/* True if feed() has just completed a packet */
+bool loop_parser::frame_ready()
+{
+    return this->ready;
+}
+
+/* The number of bytes of the packet being assembled, or 0 if none of it has arrived yet */
+size_t loop_parser::partial()
+{
+    return this->ready ? 0 : this->fill;
+}
+
+/* The completed packet. Only valid while frame_ready() is true */
+const unsigned char *loop_parser::frame()
+{
+    return this->buffer;
+}
+
+/* Number of whole packets assembled, with a valid CRC */
+unsigned long loop_parser::get_frames()
+{
+    return this->frames.get();
+}
+
+/* Number of times a partial or false packet was thrown away */
+unsigned long loop_parser::get_resyncs()
+{
+    return this->resyncs.get();
+}
+
+/* Number of packets thrown away because the CRC was wrong */
+unsigned long loop_parser::get_crc_errors()
+{
+    return this->crc_errors.get();
+}
+
+/* Number of bytes that were not part of a packet */
+unsigned long loop_parser::get_skipped()
+{
+    return this->skipped.get();
+}
+
+/* Add the counts to the metrics. 'labels' tells the parsers apart */
+void loop_parser::register_metrics(metrics_registry &registry, string labels)
+{
+    registry.add("davis_frames_total", METRIC_COUNTER, "LOOP and LOOP2 packets received with a valid CRC", labels, &this->frames);
+    registry.add("davis_crc_errors_total", METRIC_COUNTER, "Packets thrown away because the CRC was wrong", labels, &this->crc_errors);
+    registry.add("davis_resyncs_total", METRIC_COUNTER, "Times a partial or false packet was thrown away", labels, &this->resyncs);
+    registry.add("davis_bytes_skipped_total", METRIC_COUNTER, "Bytes received that were not part of a packet", labels, &this->skipped);
+}
@@ -0,0 +1,65 @@
+/* Copyright (c) 2013-2018 Ardexa Pty Ltd. All rights reserved.
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef LOOP_PARSER_HPP_INCLUDED
+#define LOOP_PARSER_HPP_INCLUDED
+
+#include <stddef.h>
+#include <string.h>
+#include "configs.hpp"
+#include "metrics.hpp"
+
+using namespace std;
+
+/* This class assembles whole LOOP packets from a stream of bytes. The bytes can be fed in chunks of any size,
+   and a partial packet is kept until the rest of it arrives. Anything that isn't part of a packet (the ACK
+   after a command, the wakeup response, or line noise) is skipped. Packets with a bad CRC are dropped. Usage:
+
+        while (length > 0) {
+            size_t used = parser.feed(data, length);
+            data += used;
+            length -= used;
+            if (parser.frame_ready()) {
+                ... parser.frame() is a LOOP_PACKET_SIZE byte packet ...
+            }
+        }
+*/
+class loop_parser
+{
+    public:
+        /* methods are public */
+        loop_parser();
+        void reset();
+        size_t feed(const unsigned char *data, size_t length);
+        bool frame_ready();
+        size_t partial();
+        const unsigned char *frame();
+        unsigned long get_frames();
+        unsigned long get_resyncs();
+        unsigned long get_skipped();
+        unsigned long get_crc_errors();
+        void register_metrics(metrics_registry &registry, string labels);
+
+    private:
+        /* members are private */
+        void resync(size_t start);
+        unsigned char buffer[LOOP_PACKET_SIZE];
+        size_t fill;
+        bool ready;
+        metric_counter frames;
+        metric_counter resyncs;
+        metric_counter skipped;
+        metric_counter crc_errors;
+};
+
+#endif /* LOOP_PARSER_HPP_INCLUDED */
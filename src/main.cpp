@@ -16,23 +16,472 @@
 #include <termios.h>
 #include <string.h>
 #include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <sys/epoll.h>
+#include <thread>
+#include <atomic>
+#include <set>
 #include "utils.hpp"
 #include "configs.hpp"
 #include "arguments.hpp"
+#include "serial.hpp"
+#include "loop_parser.hpp"
+#include "archive.hpp"
+#include "binary_log.hpp"
+#include "block_store.hpp"
+#include "log_writer.hpp"
+#include "timestamp.hpp"
+#include "station.hpp"
+#include "frame_ring.hpp"
+#include "shared_latest.hpp"
+#include "metrics.hpp"
+#include "histogram.hpp"
 
 using namespace std;
 
 /* Global variables. */ 
 int g_debug = DEFAULT_DEBUG_VALUE;
+volatile sig_atomic_t g_stop = 0;
+volatile sig_atomic_t g_print_stats = 0;
 
+/* Signal handler for the daemon. Stop gracefully so the LPS can be cancelled and the PID file removed */
+static void stop_handler(int signum)
+{
+    g_stop = 1;
+}
+
+/* Signal handler for SIGUSR1. The daemon prints the time taken by each stage so far */
+static void stats_handler(int signum)
+{
+    g_print_stats = 1;
+}
+
+/* Print the time taken by each stage, over all the stations */
+static void print_stage_stats(vector<station *> &stations)
+{
+    stage_stats total;
+    for (size_t i = 0; i < stations.size(); i++) {
+        total.merge(stations[i]->get_stats());
+    }
+    total.print(cout, "daemon");
+}
+
+/* Set up the writer for the daily logs and 'latest.csv', as requested on the command line (for a single reading) */
+static void setup_writer(log_writer &writer, arguments &arguments_list)
+{
+    writer.set_durability(arguments_list.flush_records, arguments_list.flush_ms, arguments_list.sync);
+    if (arguments_list.binary) {
+        writer.enable_binary(arguments_list.barocal, arguments_list.wdspd_kmh, arguments_list.winddir_180, arguments_list.loop2);
+    }
+    if (arguments_list.blocks) {
+        writer.enable_blocks(arguments_list.barocal, arguments_list.wdspd_kmh, arguments_list.winddir_180, arguments_list.loop2);
+    }
+}
+
+/* Write the results to the daily log file and to 'latest.csv'. If requested, also write them to the daily binary log.
+   The line is stamped with the time the packet was received, not the time it is written */
+static void log_result(arguments &arguments_list, log_writer &writer, datetime_formatter &formatter, stage_stats &stats, const davis_data_t &davis_data, const receive_stamp_t &stamp)
+{
+    int32_t utc_offset;
+    char datetime[DATETIME_SIZE];
+    char line[LINE_SIZE];
+    int64_t start_ns = monotonic_now_ns();
+
+    formatter.format(datetime, stamp.realtime_ns, &utc_offset);
+    size_t length = format_result(line, sizeof(line), davis_data, arguments_list.loop2, datetime);
+    stats.record(STAGE_FORMAT, monotonic_now_ns() - start_ns);
+
+    writer.append(line, length, davis_data, stamp.realtime_ns / 1000000, utc_offset);
+}
+
+/* The LPS command. If LOOP2 packets are requested, the Davis alternates between LOOP and LOOP2 packets */
+static string lps_command(arguments &arguments_list, int count)
+{
+    int bitmask = arguments_list.loop2 ? LPS_LOOP_LOOP2 : LPS_LOOP;
+    return "LPS " + to_string(bitmask) + " " + to_string(count) + "\r";
+}
+
+/* Take a single reading from the Davis, log it and exit. This is the mode used when the program is scheduled
+   at regular intervals (via cron or an Ardexa RUN scenario) */
+static int run_once(arguments &arguments_list, string device)
+{
+    int result = 0;
+    char buffer[BUFSIZE];
+    loop_parser parser;
+    davis_data_t davis_data;
+    datetime_formatter formatter;
+    stage_stats stats;
+    receive_stamp_t received = stamp_now();
+    log_writer writer(arguments_list.get_log_directory(), "davis_", header_line(arguments_list.wdspd_kmh, arguments_list.loop2), true);
+    capture_writer *capture = NULL;
+
+    setup_writer(writer, arguments_list);
+    writer.set_stats(&stats);
+
+    int modem_filedesc = open_davis(device);
+    if (modem_filedesc < 0) {
+        return 3;
+    }
+
+    /* With --capture, the packets also go to the daily capture */
+    if (arguments_list.capture) {
+        capture = new capture_writer(arguments_list.get_log_directory(), "davis_", device);
+        capture->set_durability(arguments_list.flush_records, arguments_list.flush_ms);
+    }
+
+    /* A bit for each packet type that is needed, and a bit for each packet type received */
+    int types_needed = (1 << LOOP_TYPE);
+    if (arguments_list.loop2) types_needed |= (1 << LOOP2_TYPE);
+    int types_received = 0;
+    clear_davis_data(&davis_data);
+
+    /* This will wake up the Davis console and get it to send 30 LPS (over a 50 sec or so time) */
+    int64_t command_ns = monotonic_now_ns();
+    bool awake = wake_davis(modem_filedesc, arguments_list.get_debug());
+    if (awake) {
+        stats.record(STAGE_WAKEUP, monotonic_now_ns() - command_ns);
+        send_command(modem_filedesc, lps_command(arguments_list, 30), arguments_list.get_debug());
+        command_ns = monotonic_now_ns();
+    }
+
+    /* Give up after 2 timeouts. Since a read can return part of a packet, keep reading while data is arriving, until
+       the packets are received or too many have been seen. The loop_parser puts split packets back together */
+    int timeouts = 0, packets = 0;
+    int64_t frame_start_ns = 0, last_packet_ns = 0;
+    bool ack_pending = true, first_byte_pending = true;
+    while (awake and (timeouts < 2) and (packets < ONESHOT_MAX_PACKETS) and (types_received != types_needed)) {
+        result = read_available(modem_filedesc, (unsigned char *) buffer, sizeof(buffer), arguments_list.read_timeout_ms);
+        if (arguments_list.get_debug()) cout << "Chars received = " << result << endl;
+        if (result < 0) {
+            if (arguments_list.get_debug()) cout << "Read error. The Davis may have been unplugged" << endl;
+            break;
+        }
+        if (result == 0) {
+            if (arguments_list.get_debug()) cout << "Read timeout. Chars read: " << result << endl;
+            timeouts++;
+            continue;
+        }
+        receive_stamp_t stamp = stamp_now();
+        if (ack_pending) {
+            if (buffer[0] == ACK) stats.record(STAGE_ACK, stamp.monotonic_ns - command_ns);
+            ack_pending = false;
+        }
+
+        /* A packet is timed from the read that brought its first byte */
+        const unsigned char *data = (const unsigned char *) buffer;
+        size_t remaining = result;
+        while ((remaining > 0) and (types_received != types_needed)) {
+            bool starting = (parser.partial() == 0);
+            size_t used = parser.feed(data, remaining);
+            data += used;
+            remaining -= used;
+            if (starting and ((parser.partial() > 0) or parser.frame_ready())) {
+                frame_start_ns = stamp.monotonic_ns;
+                if (first_byte_pending) stats.record(STAGE_FIRST_BYTE, stamp.monotonic_ns - command_ns);
+                first_byte_pending = false;
+            }
+            if (parser.frame_ready()) {
+                packets++;
+                stats.record(STAGE_FRAME, stamp.monotonic_ns - frame_start_ns);
+                if (last_packet_ns > 0) stats.record(STAGE_INTERVAL, stamp.monotonic_ns - last_packet_ns);
+                last_packet_ns = stamp.monotonic_ns;
+                if (capture) capture->append(parser.frame(), stamp.realtime_ns, formatter.utc_offset(stamp.realtime_ns));
+                int64_t decode_ns = monotonic_now_ns();
+                int packet_type = extract_results(parser.frame(), &davis_data, arguments_list.get_debug(), arguments_list.wdspd_kmh, arguments_list.barocal, arguments_list.winddir_180);
+                stats.record(STAGE_DECODE, monotonic_now_ns() - decode_ns);
+                if (packet_type >= 0) {
+                    types_received |= (1 << packet_type);
+                    received = stamp;
+                }
+            }
+        }
+    }
+
+    /* If no LOOP packet was received, a line of error values will be logged, with the current time */
+    if (types_received != types_needed) {
+        if (arguments_list.get_debug()) cout << "Not all LOOP packets were received" << endl;
+        if (types_received == 0) received = stamp_now();
+    }
+    /* Write the line to the log file */
+    log_result(arguments_list, writer, formatter, stats, davis_data, received);
+
+    /* The reading is left in shared memory for davis-latest, until the next one replaces it */
+    if ((types_received != 0) and (not arguments_list.shm_name.empty())) {
+        shared_latest latest;
+        if (latest.create(arguments_list.shm_name, arguments_list.wdspd_kmh, arguments_list.loop2)) {
+            latest.publish(davis_data, received.realtime_ns / 1000000, formatter.utc_offset(received.realtime_ns));
+        }
+    }
+
+    /* This is to cancel any remaining LPS events */
+    result = write(modem_filedesc, "\r", 1);
+    if (arguments_list.get_debug()) cout << "CR WRITTEN" << endl;
+    close(modem_filedesc);
+
+    writer.flush();
+    /* The capture writes what is left when it is deleted */
+    delete capture;
+    if (arguments_list.stats) {
+        stats.print(cout, "once");
+    }
+
+    return 0;
+}
+
+/* Pass the adaptors that have been plugged in or unplugged to the stations. With '-t all', a new Davis adaptor
+   becomes a new station */
+static void device_events(arguments &arguments_list, vector<station *> &stations, int epoll_filedesc, device_discovery &discovery, frame_ring &ring, metrics_registry &registry)
+{
+    usb_event_t event;
+    int64_t now_ms = monotonic_now_ms();
+
+    while (discovery.receive_event(&event)) {
+        bool claimed = false;
+        for (size_t i = 0; i < stations.size(); i++) {
+            if (stations[i]->on_device_event(event, now_ms)) claimed = true;
+        }
+        if (event.added and (not claimed) and (arguments_list.get_device() == "all") and (not event.serial.empty())) {
+            string directory = arguments_list.get_log_directory();
+            if (*directory.rbegin() != '/') directory += "/";
+            station_config_t config = station_from_arguments(arguments_list, "usb:" + event.serial, directory + event.serial);
+            config.shm_name = station_shm_name(arguments_list, config.directory);
+            stations.push_back(new station(config, arguments_list, epoll_filedesc, &discovery, &ring));
+            stations.back()->set_reopen_time(STATION_MONITORED_REOPEN_TIME);
+            stations.back()->register_metrics(registry);
+        }
+    }
+}
+
+/* The logging thread of run_daemon(). It empties the frame ring, decodes and logs each packet, and writes the
+   waiting lines when they are due. When 'stopping' is set, it logs what is left in the ring, writes every waiting
+   line and returns. It only touches the stations that packets came from, so the event loop can add stations */
+static void run_sink(frame_ring *ring, atomic<bool> *stopping)
+{
+    set<station *> seen;
+    frame_slot_t *slot;
+
+    while (true) {
+        bool last = stopping->load();
+        while ((slot = ring->front()) != NULL) {
+            station *owner = (station *) slot->owner;
+            owner->handle_frame(*slot);
+            ring->pop();
+            seen.insert(owner);
+        }
+        for (set<station *>::iterator it = seen.begin(); it != seen.end(); ++it) {
+            (*it)->flush_logs(last);
+        }
+        if (last) {
+            break;
+        }
+        ring->wait(STATION_POLL_MS);
+    }
+}
+
+/* Keep the serial sessions open and stream LOOP (and LOOP2) packets continuously, from one or more consoles. Each
+   Davis sends a LOOP packet every 2.5 seconds, and a new LPS command is sent whenever a burst is finished or the
+   console goes quiet. A line is logged when at least 'interval' seconds have passed since the last one. All the
+   consoles are driven from one epoll loop, so one process can log dozens of them. The packets are logged by a
+   second thread, which the loop hands them to through a frame_ring, so a slow disk doesn't delay the reads */
+static int run_daemon(arguments &arguments_list, vector<station_config_t> &configs, device_discovery &discovery)
+{
+    bool debug = arguments_list.get_debug();
+    vector<station *> stations;
+    struct epoll_event events[STATION_MAX_EVENTS];
+    frame_ring ring(FRAME_RING_SIZE);
+    atomic<bool> stopping(false);
+    metrics_registry registry;
+    metrics_server server(&registry);
+
+    /* Don't use SA_RESTART, so that epoll_wait() is interrupted by the signal */
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = stop_handler;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGTERM, &action, NULL);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGHUP, &action, NULL);
+    action.sa_handler = stats_handler;
+    sigaction(SIGUSR1, &action, NULL);
+
+    int epoll_filedesc = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_filedesc < 0) {
+        perror("epoll_create1");
+        return 3;
+    }
+
+    for (size_t i = 0; i < configs.size(); i++) {
+        stations.push_back(new station(configs[i], arguments_list, epoll_filedesc, &discovery, &ring));
+        stations.back()->register_metrics(registry);
+    }
+    ring.register_metrics(registry);
+
+    /* The signals are blocked while the other threads are started, so they are always delivered to this one */
+    sigset_t signals, previous;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGHUP);
+    sigaddset(&signals, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &signals, &previous);
+    if ((not arguments_list.metrics_address.empty()) and (not server.start(arguments_list.metrics_address))) {
+        pthread_sigmask(SIG_SETMASK, &previous, NULL);
+        for (size_t i = 0; i < stations.size(); i++) delete stations[i];
+        close(epoll_filedesc);
+        return 3;
+    }
+    thread sink(run_sink, &ring, &stopping);
+    pthread_sigmask(SIG_SETMASK, &previous, NULL);
+
+    /* Adaptors being plugged in and unplugged are reported by udev. The monitor is the one epoll entry without a station */
+    int monitor_filedesc = discovery.start_monitor();
+    if (monitor_filedesc >= 0) {
+        struct epoll_event event;
+        memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN;
+        event.data.ptr = NULL;
+        if (epoll_ctl(epoll_filedesc, EPOLL_CTL_ADD, monitor_filedesc, &event) == 0) {
+            for (size_t i = 0; i < stations.size(); i++) stations[i]->set_reopen_time(STATION_MONITORED_REOPEN_TIME);
+        }
+    }
+
+    while (!g_stop) {
+        if (g_print_stats) {
+            g_print_stats = 0;
+            print_stage_stats(stations);
+        }
+
+        /* Let each station do what is due, and wait no longer than the earliest of the next */
+        int64_t now_ms = monotonic_now_ms();
+        int64_t due_ms = now_ms + STATION_POLL_MS;
+        for (size_t i = 0; i < stations.size(); i++) {
+            stations[i]->on_timer(now_ms);
+            due_ms = min(due_ms, stations[i]->next_due_ms());
+        }
+
+        int timeout = (int) max((int64_t) 0, due_ms - monotonic_now_ms());
+        int count = epoll_wait(epoll_filedesc, events, STATION_MAX_EVENTS, timeout);
+        if (count < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait");
+            break;
+        }
+        for (int i = 0; i < count; i++) {
+            if (events[i].data.ptr == NULL) {
+                device_events(arguments_list, stations, epoll_filedesc, discovery, ring, registry);
+            }
+            else {
+                ((station *) events[i].data.ptr)->on_event(events[i].events);
+            }
+        }
+    }
+
+    /* Stop the consoles, then let the logging thread finish what is in the ring */
+    server.stop();
+    for (size_t i = 0; i < stations.size(); i++) {
+        stations[i]->stop();
+    }
+    stopping.store(true);
+    ring.wake();
+    sink.join();
+
+    if (arguments_list.stats) {
+        print_stage_stats(stations);
+    }
+    for (size_t i = 0; i < stations.size(); i++) {
+        if (debug) stations[i]->print_statistics();
+        delete stations[i];
+    }
+    if (debug or (ring.get_drops() > 0)) {
+        cout << "Frame ring: " << ring.get_capacity() << " slots. Packets queued: " << ring.get_pushed();
+        cout << " Dropped: " << ring.get_drops() << " High water mark: " << ring.get_high_water() << endl;
+    }
+    close(epoll_filedesc);
+
+    return 0;
+}
+
+/* Work out the consoles to log in daemon mode: those in the stations file, every Davis USB adaptor found (-t all),
+   or the single device. Returns false if there are none */
+static bool find_stations(arguments &arguments_list, vector<station_config_t> &configs, device_discovery &discovery)
+{
+    bool debug = arguments_list.get_debug();
+    string device = arguments_list.get_device();
+    string directory = arguments_list.get_log_directory();
+
+    if (not arguments_list.stations_file.empty()) {
+        return read_stations(arguments_list.stations_file, arguments_list, configs);
+    }
+
+    /* Each adaptor logs to a directory named after its serial number, and is found by it when it is plugged in again */
+    if (device == "all") {
+        vector<usb_device_t> found = discovery.scan();
+        if (*directory.rbegin() != '/') directory += "/";
+        for (size_t i = 0; i < found.size(); i++) {
+            if (found[i].serial.empty()) {
+                string name = found[i].devnode.substr(found[i].devnode.rfind('/') + 1);
+                configs.push_back(station_from_arguments(arguments_list, found[i].devnode, directory + name));
+            }
+            else {
+                configs.push_back(station_from_arguments(arguments_list, "usb:" + found[i].serial, directory + found[i].serial));
+            }
+            configs.back().shm_name = station_shm_name(arguments_list, configs.back().directory);
+        }
+        if (configs.empty()) {
+            cout << "Davis weather station USB Serial device not found. Check by running \'lsusb\'" << endl;
+            return false;
+        }
+        return true;
+    }
+
+    if (device.empty()) {
+        device = find_usb_device(debug);
+        if (device.empty()) {
+            return false;
+        }
+    }
+    configs.push_back(station_from_arguments(arguments_list, device, directory));
+    return true;
+}
+
+/* Download the records from the Davis archive, log them and exit */
+static int run_archive(arguments &arguments_list, string device)
+{
+    int modem_filedesc = open_davis(device);
+    if (modem_filedesc < 0) {
+        return 3;
+    }
+
+    int logged = download_archive(modem_filedesc, arguments_list.archive_since, arguments_list);
+    close(modem_filedesc);
+
+    if (logged < 0) {
+        return 4;
+    }
+    return 0;
+}
 
 /* The main function */
 int main(int argc, char *argv[])
 {
     int result = 0;
-    struct termios newtio;
-    char buffer[BUFSIZE];
-    string line, device;
+    string device;
+
+    /* This class object defines the initial configuration parameters */
+    arguments arguments_list;
+    result = arguments_list.initialize(argc, argv);
+    if (result != 0) {
+        return 1;
+    }
+
+    /* Converting a binary or block log doesn't need the Davis, so it doesn't need root either */
+    if (not arguments_list.bin2csv.empty()) {
+        if (is_block_log(arguments_list.bin2csv)) {
+            return blocks_to_csv(arguments_list.bin2csv, cout);
+        }
+        return binary_to_csv(arguments_list.bin2csv, cout);
+    }
 
 	/* If not run as root, exit */
 	if (check_root() == false) {
@@ -41,15 +490,20 @@ int main(int argc, char *argv[])
 	}
 
 	/* Check for existence of PID file */
-	if (!check_pid_file()) {
+	if (!check_pid_file(arguments_list.pid_file)) {
 		return 2;
 	}
 
-    /* This class object defines the initial configuration parameters */
-    arguments arguments_list;
-    result = arguments_list.initialize(argc, argv);
-    if (result != 0) {
-        return 1;
+    if (arguments_list.daemon) {
+        vector<station_config_t> configs;
+        device_discovery discovery(arguments_list.get_debug());
+        if (not find_stations(arguments_list, configs, discovery)) {
+            remove_pid_file(arguments_list.pid_file);
+            return 2;
+        }
+        result = run_daemon(arguments_list, configs, discovery);
+        remove_pid_file(arguments_list.pid_file);
+        return result;
     }
 
     device = arguments_list.get_device();
@@ -62,78 +516,9 @@ int main(int argc, char *argv[])
         }
     }
 
-    /* Open the Davis weather station device for read and write. Writing is needed to send commands to the Davis,
-       that will then return the required information */
-    int modem_filedesc = open(device.c_str(),  O_RDWR | O_NOCTTY );
-    if (modem_filedesc < 0) {
-        perror(device.c_str());
-        cout << "Error opening Davis serial line" << endl;
-        return 3;
-    }
-
-    memset(&newtio, '\0', sizeof(newtio));
-    /* These are the modem control signals:
-    CS8 = 8 data bits
-    CLOCAL - Ignore modem control lines.
-    CREAD - Enable receiver.
-    ICANON - Input is made available line by line. ***DON'T WANT THIS***.... so set newtio.c_lflag = 0;
-    CRTSCTS - (not in POSIX) Enable RTS/CTS (hardware) flow control.
-    IGNPAR - Ignore framing errors and parity errors.  */
-
-    newtio.c_cflag = BAUDRATE | CRTSCTS | CS8 | CLOCAL | CREAD;
-    newtio.c_iflag = IGNPAR;
-    newtio.c_oflag = 0;
-    newtio.c_lflag = 0;
-    newtio.c_cc[VTIME] = TIMEOUT;
-    /* If (say) 97 chars are received, this is not a complete loop
-    If 99 chars are received (with an ACK at the start (so 100 chars)
-    Then wait for a maximum of 200 chars before returning
-    Which means about 3 LOOPS maximum, before it returns */
-    newtio.c_cc[VMIN] = MINCHARS;
-    /* clean the modem line and activate the settings for the port */
-    tcflush(modem_filedesc, TCIFLUSH);
-    tcsetattr(modem_filedesc, TCSANOW, &newtio);
-
-    /* This will wake up the Davis console and get it to send 30 LPS (over a 50 sec or so time)
-    The LF (linefeeds) are to wakeup the Davis */
-    for (int i = 0; i < 2; i++) {
-        result = write(modem_filedesc, "\n", 1);
-        if (arguments_list.get_debug()) cout << "LF WRITTEN" << endl;
-        sleep(1);
-    }
-    result = write(modem_filedesc, "LPS 0 30\r", 9);
-    if (arguments_list.get_debug()) cout << "LPS 0 30 WRITTEN" << endl;
-
-    /* Only 2 goes at the loop */
-    for (int loop = 2; loop > 0; loop--) {
-        memset(buffer, '\0', sizeof(buffer));
-        result = read(modem_filedesc, buffer, sizeof(buffer));
-        /* 100 is the length of a LOOP command (99 chars) plus an ACK */
-        if (result > LOOP_LENGTH) {
-            line = extract_results(buffer, result, arguments_list.get_debug(), arguments_list.wdspd_kmh, arguments_list.barocal, arguments_list.winddir_180);
-            break;
-        }
-        /* This else is just for debugging */
-        else {
-            if (arguments_list.get_debug()) cout << "Too few characters received or read timeout. Chars read: " << result << endl;
-        }
+    if (arguments_list.archive) {
+        return run_archive(arguments_list, device);
     }
 
-	 string current_date = get_current_date();
-	 string filename = "davis_" + current_date + ".log";
-
-    /* Write the line to the log file */
-    if (arguments_list.wdspd_kmh) {
-        log_line(arguments_list.get_log_directory(), filename, line, HEADER_LINE, true);
-    } 
-    else {
-        log_line(arguments_list.get_log_directory(), filename, line, HEADER_LINE_KMH, true);
-    }
-
-    /* This is to cancel any remaining LPS events */
-    result = write(modem_filedesc, "\r", 1);
-    if (arguments_list.get_debug()) cout << "CR WRITTEN" << endl;
-    close(modem_filedesc);
-
-    return 0;
+    return run_once(arguments_list, device);
 }
@@ -0,0 +1,232 @@
+/* Copyright (c) 2013-2018 Ardexa Pty Ltd. All rights reserved.
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <set>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "configs.hpp"
+#include "metrics.hpp"
+
+/* A label, such as device="/dev/ttyUSB0", with the value escaped as the text format needs */
+string metric_label(string name, string value)
+{
+    string label = name + "=\"";
+    for (size_t i = 0; i < value.length(); i++) {
+        if (value[i] == '\\') label += "\\\\";
+        else if (value[i] == '"') label += "\\\"";
+        else if (value[i] == '\n') label += "\\n";
+        else label += value[i];
+    }
+    return label + "\"";
+}
+
+/* Add a metric. 'labels' is a comma separated list made with metric_label(), or empty. Metrics with the same name
+   are exported together, with the help and type of the first */
+void metrics_registry::add(string name, metric_type_t type, string help, string labels, const metric_counter *counter, double scale)
+{
+    metric_entry_t entry;
+
+    entry.name = name;
+    entry.type = type;
+    entry.help = help;
+    entry.labels = labels;
+    entry.counter = counter;
+    entry.scale = scale;
+
+    lock_guard<mutex> guard(this->lock);
+    this->entries.push_back(entry);
+}
+
+/* The metrics in the Prometheus text format */
+string metrics_registry::render()
+{
+    ostringstream text;
+    set<string> done;
+
+    lock_guard<mutex> guard(this->lock);
+    text << setprecision(12);
+    for (size_t i = 0; i < this->entries.size(); i++) {
+        const metric_entry_t &first = this->entries[i];
+        if (not done.insert(first.name).second) {
+            continue;
+        }
+        text << "# HELP " << first.name << " " << first.help << "\n";
+        text << "# TYPE " << first.name << " " << ((first.type == METRIC_COUNTER) ? "counter" : "gauge") << "\n";
+        for (size_t j = i; j < this->entries.size(); j++) {
+            const metric_entry_t &entry = this->entries[j];
+            if (entry.name != first.name) continue;
+            text << entry.name;
+            if (not entry.labels.empty()) text << "{" << entry.labels << "}";
+            if (entry.scale == 1.0) text << " " << entry.counter->get() << "\n";
+            else text << " " << (double) entry.counter->get() * entry.scale << "\n";
+        }
+    }
+    return text.str();
+}
+
+/* Constructor for the metrics_server class. Nothing is served until start() is called */
+metrics_server::metrics_server(metrics_registry *registry)
+    : stopping(false)
+{
+    this->registry = registry;
+    this->listen_filedesc = -1;
+}
+
+/* Destructor for the metrics_server class */
+metrics_server::~metrics_server()
+{
+    this->stop();
+}
+
+/* Listen on 'address', and start serving the metrics. Returns false (after printing the reason) if it can't */
+bool metrics_server::start(string address)
+{
+    int filedesc;
+
+    if (address.compare(0, 5, "unix:") == 0) {
+        struct sockaddr_un unix_address;
+        memset(&unix_address, 0, sizeof(unix_address));
+        unix_address.sun_family = AF_UNIX;
+        this->unix_path = address.substr(5);
+        if (this->unix_path.empty() or (this->unix_path.length() >= sizeof(unix_address.sun_path))) {
+            cout << "Invalid metrics socket: " << address << endl;
+            return false;
+        }
+        strcpy(unix_address.sun_path, this->unix_path.c_str());
+        /* A socket left by a previous run would stop bind() */
+        unlink(this->unix_path.c_str());
+        filedesc = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if ((filedesc < 0) or (bind(filedesc, (struct sockaddr *) &unix_address, sizeof(unix_address)) != 0)) {
+            perror(this->unix_path.c_str());
+            if (filedesc >= 0) close(filedesc);
+            this->unix_path.clear();
+            return false;
+        }
+    }
+    else {
+        struct sockaddr_in inet_address;
+        memset(&inet_address, 0, sizeof(inet_address));
+        inet_address.sin_family = AF_INET;
+        string host = "127.0.0.1", port = address;
+        size_t colon = address.rfind(':');
+        if (colon != string::npos) {
+            host = address.substr(0, colon);
+            port = address.substr(colon + 1);
+        }
+        char *end = NULL;
+        long number = strtol(port.c_str(), &end, 10);
+        if (port.empty() or (*end != '\0') or (number < 1) or (number > 65535) or (inet_pton(AF_INET, host.c_str(), &inet_address.sin_addr) != 1)) {
+            cout << "Invalid metrics address: " << address << endl;
+            return false;
+        }
+        inet_address.sin_port = htons(number);
+        filedesc = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        int reuse = 1;
+        if (filedesc >= 0) setsockopt(filedesc, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        if ((filedesc < 0) or (bind(filedesc, (struct sockaddr *) &inet_address, sizeof(inet_address)) != 0)) {
+            perror(address.c_str());
+            if (filedesc >= 0) close(filedesc);
+            return false;
+        }
+    }
+
+    if (listen(filedesc, METRICS_BACKLOG) != 0) {
+        perror("listen");
+        close(filedesc);
+        return false;
+    }
+    this->listen_filedesc = filedesc;
+    this->worker = thread(&metrics_server::run, this);
+    return true;
+}
+
+/* Stop serving, and remove the Unix socket */
+void metrics_server::stop()
+{
+    if (this->worker.joinable()) {
+        this->stopping.store(true);
+        this->worker.join();
+    }
+    if (this->listen_filedesc >= 0) {
+        close(this->listen_filedesc);
+        this->listen_filedesc = -1;
+    }
+    if (not this->unix_path.empty()) {
+        unlink(this->unix_path.c_str());
+        this->unix_path.clear();
+    }
+}
+
+/* The server's thread. It wakes every STATION_POLL_MS to see if it should stop */
+void metrics_server::run()
+{
+    struct pollfd poll_filedesc;
+
+    poll_filedesc.fd = this->listen_filedesc;
+    poll_filedesc.events = POLLIN;
+    while (not this->stopping.load()) {
+        if (poll(&poll_filedesc, 1, STATION_POLL_MS) <= 0) {
+            continue;
+        }
+        int filedesc = accept4(this->listen_filedesc, NULL, NULL, SOCK_CLOEXEC);
+        if (filedesc >= 0) {
+            /* A client that stops reading can't hold up the server for long */
+            struct timeval timeout;
+            timeout.tv_sec = METRICS_TIMEOUT_MS / 1000;
+            timeout.tv_usec = (METRICS_TIMEOUT_MS % 1000) * 1000;
+            setsockopt(filedesc, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+            this->serve(filedesc);
+            close(filedesc);
+        }
+    }
+}
+
+/* Answer one connection. The request (if any arrives within METRICS_TIMEOUT_MS) is read and ignored: whatever is
+   asked for, the answer is the metrics */
+void metrics_server::serve(int filedesc)
+{
+    struct pollfd poll_filedesc;
+    char request[BUFSIZE];
+
+    poll_filedesc.fd = filedesc;
+    poll_filedesc.events = POLLIN;
+    if (poll(&poll_filedesc, 1, METRICS_TIMEOUT_MS) > 0) {
+        ssize_t result = recv(filedesc, request, sizeof(request), MSG_DONTWAIT);
+        (void) result;
+    }
+
+    string body = this->registry->render();
+    string response = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " + to_string(body.length()) + "\r\n\r\n" + body;
+    size_t done = 0;
+    while (done < response.length()) {
+        ssize_t result = send(filedesc, response.data() + done, response.length() - done, MSG_NOSIGNAL);
+        if (result < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        done += result;
+    }
+}
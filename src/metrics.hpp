@@ -0,0 +1,99 @@
+/* Copyright (c) 2013-2018 Ardexa Pty Ltd. All rights reserved.
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+
+#ifndef METRICS_HPP_INCLUDED
+#define METRICS_HPP_INCLUDED
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <stdint.h>
+
+using namespace std;
+
+/* A counter or gauge that is only changed by one thread, and can be read by any. A change is a relaxed load and
+   store, not a locked read-modify-write, so it costs the same as adding to a plain variable */
+class metric_counter
+{
+    public:
+        /* methods are public */
+        metric_counter() : value(0) {}
+        void add(uint64_t amount = 1) { this->value.store(this->value.load(memory_order_relaxed) + amount, memory_order_relaxed); }
+        void set(uint64_t amount) { this->value.store(amount, memory_order_relaxed); }
+        uint64_t get() const { return this->value.load(memory_order_relaxed); }
+
+    private:
+        /* members are private */
+        atomic<uint64_t> value;
+};
+
+enum metric_type_t { METRIC_COUNTER, METRIC_GAUGE };
+
+/* A metric in the registry. The value is read from 'counter' when it is exported, and multiplied by 'scale' (so
+   nanoseconds can be exported as seconds) */
+typedef struct metric_entry_s {
+    string name;
+    metric_type_t type;
+    string help;
+    string labels;
+    const metric_counter *counter;
+    double scale;
+} metric_entry_t;
+
+/* This class lists the metrics of the serial, decode and logging paths, by name and labels, and exports them in
+   the Prometheus text format. The metrics are owned by the objects that count them, and only read here. Adding
+   metrics and exporting them are locked, since stations can be added while the daemon runs */
+class metrics_registry
+{
+    public:
+        /* methods are public */
+        void add(string name, metric_type_t type, string help, string labels, const metric_counter *counter, double scale = 1.0);
+        string render();
+
+    private:
+        /* members are private */
+        mutex lock;
+        vector<metric_entry_t> entries;
+};
+
+/* This class serves the metrics to anyone connecting to a local Unix socket ("unix:/path") or TCP port
+   ("[address:]port", on 127.0.0.1 if no address is given). Each connection gets a HTTP response with the metrics,
+   so it can be scraped by Prometheus or read with curl. It runs in its own thread, so it never holds up the
+   serial reads or the logging */
+class metrics_server
+{
+    public:
+        /* methods are public */
+        metrics_server(metrics_registry *registry);
+        ~metrics_server();
+        bool start(string address);
+        void stop();
+
+    private:
+        /* members are private */
+        void run();
+        void serve(int filedesc);
+        metrics_registry *registry;
+        int listen_filedesc;
+        string unix_path;
+        thread worker;
+        atomic<bool> stopping;
+};
+
+string metric_label(string name, string value);
+
+#endif /* METRICS_HPP_INCLUDED */
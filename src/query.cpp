@@ -0,0 +1,243 @@
+/* Copyright (c) 2013-2018 Ardexa Pty Ltd. All rights reserved.
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/* davis-query reports the count, min, max, mean and sum of columns of the daily logs over a time range, such as:
+
+        davis-query -s 2026-03-02T14:00 -e 2026-03-02T15:00 -c "Wind Speed"
+
+   Each daily log in the range is given to a worker thread, which uses the log's sidecar index to seek to the
+   start of the range. With -k, the compressed block logs are read instead, and the blocks outside the range are
+   skipped by their headers. */
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <getopt.h>
+#include "configs.hpp"
+#include "utils.hpp"
+#include "log_index.hpp"
+#include "block_store.hpp"
+
+using namespace std;
+
+/* Global variables. */
+int g_debug = DEFAULT_DEBUG_VALUE;
+
+static const char *usage_string = "Usage: davis-query [-d directory] [-p prefix] -s YYYY-MM-DDTHH:MM[:SS] -e YYYY-MM-DDTHH:MM[:SS] [-c column[,column...]] [-j threads] [-k]\n";
+
+/* Convert a local time given on the command line to milliseconds since the epoch */
+static bool parse_query_time(string text, int64_t *timestamp_ms)
+{
+    struct tm timeinfo;
+
+    memset(&timeinfo, 0, sizeof(timeinfo));
+    const char *end = strptime(text.c_str(), "%Y-%m-%dT%H:%M", &timeinfo);
+    if ((end != NULL) and (*end == ':')) {
+        end = strptime(end, ":%S", &timeinfo);
+    }
+    if ((end == NULL) or (*end != '\0')) {
+        return false;
+    }
+    timeinfo.tm_isdst = -1;
+    *timestamp_ms = (int64_t) mktime(&timeinfo) * 1000;
+    return true;
+}
+
+/* Split a comma separated string */
+static vector<string> split_list(string text)
+{
+    vector<string> items;
+    stringstream stream(text);
+    string item;
+
+    while (getline(stream, item, ',')) {
+        items.push_back(trim_whitespace(item));
+    }
+    return items;
+}
+
+/* Find the number of a column from its name (or the start of it, ignoring case), or its number */
+static int find_column(const vector<string> &names, string wanted)
+{
+    long number;
+    if (convert_long(wanted, &number)) {
+        return ((number >= 0) and (number < (long) names.size())) ? (int) number : -1;
+    }
+
+    transform(wanted.begin(), wanted.end(), wanted.begin(), ::tolower);
+    for (size_t i = 0; i < names.size(); i++) {
+        string name = names[i];
+        transform(name.begin(), name.end(), name.begin(), ::tolower);
+        if (name.compare(0, wanted.length(), wanted) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* The main function */
+int main(int argc, char *argv[])
+{
+    int opt;
+    string directory = DEFAULT_LOG_DIRECTORY;
+    string prefix = "davis_";
+    string start_raw, end_raw, columns_raw;
+    int64_t start_ms, end_ms;
+    long threads = thread::hardware_concurrency();
+    bool blocks = false;
+
+    while ((opt = getopt(argc, argv, "d:p:s:e:c:j:k")) != -1) {
+        switch (opt) {
+            case 'd':
+                directory = optarg;
+                break;
+            case 'p':
+                prefix = optarg;
+                break;
+            case 's':
+                start_raw = optarg;
+                break;
+            case 'e':
+                end_raw = optarg;
+                break;
+            case 'c':
+                columns_raw = optarg;
+                break;
+            case 'j':
+                if ((not convert_long(optarg, &threads)) or (threads < 1)) {
+                    cout << "The number of threads must be a positive integer: " << optarg << endl;
+                    return 1;
+                }
+                break;
+            case 'k':
+                blocks = true;
+                break;
+            default:
+                cout << usage_string;
+                return 1;
+        }
+    }
+
+    if ((not parse_query_time(start_raw, &start_ms)) or (not parse_query_time(end_raw, &end_ms)) or (end_ms < start_ms)) {
+        cout << "The start and end times must be in the format YYYY-MM-DDTHH:MM[:SS], and the end after the start" << endl;
+        cout << usage_string;
+        return 1;
+    }
+    if (*directory.rbegin() != '/') {
+        directory += "/";
+    }
+
+    /* The daily logs that could have lines in the range. A day either side is included, since the files
+       are named by the local date when they were written. The days are counted on the calendar, since with
+       daylight saving a day isn't always 24 hours. Each is taken at noon, away from the changes */
+    vector<string> filenames;
+    struct tm day, last;
+    char date[DATESIZE], last_date[DATESIZE];
+    time_t seconds = (time_t) (end_ms / 1000);
+    localtime_r(&seconds, &last);
+    last.tm_mday++;
+    last.tm_hour = 12;
+    last.tm_isdst = -1;
+    mktime(&last);
+    strftime(last_date, sizeof(last_date), "%Y-%m-%d", &last);
+    seconds = (time_t) (start_ms / 1000);
+    localtime_r(&seconds, &day);
+    day.tm_mday--;
+    day.tm_hour = 12;
+    for (;; day.tm_mday++) {
+        day.tm_isdst = -1;
+        mktime(&day);
+        strftime(date, sizeof(date), "%Y-%m-%d", &day);
+        if (strcmp(date, last_date) > 0) break;
+        string filename = directory + prefix + date + (blocks ? BLOCK_SUFFIX : ".log");
+        if (check_file(filename) and (find(filenames.begin(), filenames.end(), filename) == filenames.end())) {
+            filenames.push_back(filename);
+        }
+    }
+    if (filenames.empty()) {
+        cout << "No logs found in: " << directory << endl;
+        return 2;
+    }
+
+    /* The column names come from the header of the first log */
+    vector<string> names = split_list(blocks ? read_block_header_line(filenames[0]) : read_log_header(filenames[0]));
+    if (not names.empty()) {
+        names.erase(names.begin());
+    }
+    vector<int> columns;
+    if (columns_raw.empty()) {
+        for (size_t i = 0; i < names.size(); i++) columns.push_back(i);
+    }
+    else {
+        vector<string> wanted = split_list(columns_raw);
+        for (size_t i = 0; i < wanted.size(); i++) {
+            int column = find_column(names, wanted[i]);
+            if (column < 0) {
+                cout << "Unknown column: " << wanted[i] << endl;
+                return 1;
+            }
+            columns.push_back(column);
+        }
+    }
+    if (columns.empty()) {
+        cout << "No columns found in the header of: " << filenames[0] << endl;
+        return 2;
+    }
+
+    /* Each worker takes the next daily log, and keeps its own statistics, which are added up at the end */
+    if (threads > (long) filenames.size()) threads = filenames.size();
+    atomic<size_t> next_file(0);
+    vector< vector<column_stats_t> > partial(threads, vector<column_stats_t>(columns.size()));
+    vector<int> lines(threads, 0);
+    vector<thread> workers;
+
+    for (long worker = 0; worker < threads; worker++) {
+        for (size_t i = 0; i < columns.size(); i++) clear_column_stats(&partial[worker][i]);
+        workers.push_back(thread([&, worker]() {
+            size_t file;
+            while ((file = next_file.fetch_add(1)) < filenames.size()) {
+                if (blocks) {
+                    lines[worker] += query_block_file(filenames[file], start_ms, end_ms, columns, &partial[worker]);
+                }
+                else {
+                    lines[worker] += query_log_file(filenames[file], start_ms, end_ms, columns, &partial[worker]);
+                }
+            }
+        }));
+    }
+
+    vector<column_stats_t> total(columns.size());
+    int total_lines = 0;
+    for (size_t i = 0; i < columns.size(); i++) clear_column_stats(&total[i]);
+    for (long worker = 0; worker < threads; worker++) {
+        workers[worker].join();
+        total_lines += lines[worker];
+        for (size_t i = 0; i < columns.size(); i++) merge_column_stats(&total[i], &partial[worker][i]);
+    }
+
+    cout << "# Lines in range: " << total_lines << endl;
+    cout << "# Column,Count,Min,Max,Mean,Sum" << endl;
+    for (size_t i = 0; i < columns.size(); i++) {
+        cout << names[columns[i]] << "," << total[i].count;
+        if (total[i].count > 0) {
+            cout << fixed << setprecision(2) << "," << total[i].min << "," << total[i].max << "," << total[i].sum / total[i].count << "," << total[i].sum << endl;
+        }
+        else {
+            cout << ",,,," << endl;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,414 @@
+/* Copyright (c) 2013-2018 Ardexa Pty Ltd. All rights reserved.
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+
+/* davis-reprocess makes the daily logs again from the captures written with --capture, such as:
+
+        davis-reprocess -d /opt/ardexa/davis -o /tmp/davis -s 2026-03-01 -e 2026-03-31 -b 1.002 -2
+
+   The packets are decoded by the same code as the daemon's, with the calibration and options given here, so the
+   logs can be corrected after a wrong calibration or a fix to the decoder. Each day is a task, and the worker
+   threads take the next task when they finish one, biggest first, so they all stay busy until the end. A day's
+   logs are written to a directory of their own, then renamed into the output directory, so a reader sees the old
+   file or the whole new one, never a part of it. If the directory has subdirectories of captures (the layout of
+   '-t all'), they are reprocessed as well, into subdirectories of the output directory with the same names.
+
+   The times in the logs are formatted in the local time zone, as the daemon formats them, so run it with the
+   time zone of the station (TZ=...). Packets captured in a different time zone are counted, and reported. Each task
+   only writes the logs of its own day, so in another time zone, the lines that would fall on the day before or
+   after are left out (and counted), rather than replacing the logs of that day with a part of them. */
+
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <getopt.h>
+#include <dirent.h>
+#include <limits.h>
+#include "configs.hpp"
+#include "utils.hpp"
+#include "capture.hpp"
+#include "log_index.hpp"
+#include "log_writer.hpp"
+#include "timestamp.hpp"
+#include "histogram.hpp"
+
+#define REPROCESS_FLUSH_RECORDS 4096    /* Lines written at once. The logs are only renamed into place at the end */
+#define REPROCESS_FLUSH_MS 60000
+
+using namespace std;
+
+/* Global variables. */
+int g_debug = DEFAULT_DEBUG_VALUE;
+
+static const char *usage_string = "Usage: davis-reprocess -o directory [-d directory] [-p prefix] [-s YYYY-MM-DD] [-e YYYY-MM-DD] [-b barocal] [-w] [-z] [-2] [-i seconds] [-B] [-K] [-j threads]\n";
+
+/* How the packets are decoded and logged */
+typedef struct reprocess_options_s {
+    string prefix;
+    float barocal;
+    bool wdspd_kmh;
+    bool winddir_180;
+    bool loop2;
+    float interval;
+    bool binary;
+    bool blocks;
+} reprocess_options_t;
+
+/* A day's capture, where its logs go, and the counts once it is done */
+typedef struct reprocess_task_s {
+    string capture;
+    string output;
+    string date;
+    off_t size;
+    long packets;
+    long skipped;           /* Records that were only partly written */
+    long lines;
+    long other_zone;        /* Packets captured with a different UTC offset to the one used here */
+    long outside;           /* Lines left out, since they aren't on the capture's day in this time zone */
+    int result;
+} reprocess_task_t;
+
+/* Returns true if 'text' is a date, YYYY-MM-DD */
+static bool valid_date(string text)
+{
+    struct tm timeinfo;
+
+    memset(&timeinfo, 0, sizeof(timeinfo));
+    const char *end = strptime(text.c_str(), "%Y-%m-%d", &timeinfo);
+    return (text.length() == 10) and (end != NULL) and (*end == '\0');
+}
+
+/* Add a task for each capture in 'directory' from the days 'first' to 'last' (either can be empty) */
+static void find_captures(string directory, string output, string prefix, string first, string last, vector<reprocess_task_t> &tasks)
+{
+    DIR *dir = opendir(directory.c_str());
+    struct dirent *entry;
+    struct stat st_file;
+    string suffix = CAPTURE_SUFFIX;
+
+    if (dir == NULL) return;
+    while ((entry = readdir(dir)) != NULL) {
+        string name = entry->d_name;
+        if ((name.length() != prefix.length() + 10 + suffix.length()) or (name.compare(0, prefix.length(), prefix) != 0) or
+            (name.compare(name.length() - suffix.length(), suffix.length(), suffix) != 0)) {
+            continue;
+        }
+        string date = name.substr(prefix.length(), 10);
+        if ((not valid_date(date)) or ((not first.empty()) and (date < first)) or ((not last.empty()) and (date > last))) {
+            continue;
+        }
+        if ((stat((directory + name).c_str(), &st_file) != 0) or (not S_ISREG(st_file.st_mode))) {
+            continue;
+        }
+
+        reprocess_task_t task;
+        task.capture = directory + name;
+        task.output = output;
+        task.date = date;
+        task.size = st_file.st_size;
+        task.packets = task.skipped = task.lines = task.other_zone = task.outside = 0;
+        task.result = 0;
+        tasks.push_back(task);
+    }
+    closedir(dir);
+}
+
+/* Move the logs written to 'temporary' into 'output', replacing any already there, then remove 'temporary'
+   (and the journal in it). The index davis-query made of a replaced daily log is removed, so it is made again. If
+   'output' is empty, the logs are thrown away. Returns false if a log couldn't be moved */
+static bool move_logs(string temporary, string output)
+{
+    DIR *dir = opendir(temporary.c_str());
+    struct dirent *entry;
+    bool moved = true;
+
+    if (dir == NULL) return false;
+    while ((entry = readdir(dir)) != NULL) {
+        string name = entry->d_name;
+        if ((name == ".") or (name == "..")) continue;
+        size_t dot = name.rfind('.');
+        string suffix = (dot == string::npos) ? "" : name.substr(dot);
+        if ((not output.empty()) and ((suffix == ".log") or (suffix == ".bin") or (suffix == BLOCK_SUFFIX))) {
+            if (rename((temporary + name).c_str(), (output + name).c_str()) != 0) {
+                perror((output + name).c_str());
+                moved = false;
+            }
+            else if (suffix == ".log") {
+                unlink((output + name + INDEX_SUFFIX).c_str());
+            }
+        }
+        else {
+            unlink((temporary + name).c_str());
+        }
+    }
+    closedir(dir);
+    rmdir(temporary.c_str());
+    return moved;
+}
+
+/* The start and end of the local day 'date' (YYYY-MM-DD) */
+static void day_range(string date, int64_t *start_ms, int64_t *end_ms)
+{
+    struct tm timeinfo;
+
+    memset(&timeinfo, 0, sizeof(timeinfo));
+    strptime(date.c_str(), "%Y-%m-%d", &timeinfo);
+    timeinfo.tm_hour = 12;
+    timeinfo.tm_isdst = -1;
+    local_day((int64_t) mktime(&timeinfo) * 1000, start_ms, end_ms);
+}
+
+/* Decode a day's capture and write its logs, as the daemon would have, with the packets arriving when they were
+   captured. Returns 0 on success, and sets the counts of the task */
+static int reprocess_day(reprocess_task_t *task, const reprocess_options_t &options)
+{
+    capture_reader reader;
+    char temporary[PATH_MAX];
+
+    if (not reader.open(task->capture)) {
+        return 2;
+    }
+    snprintf(temporary, sizeof(temporary), "%s.reprocess.%s.XXXXXX", task->output.c_str(), task->date.c_str());
+    if (mkdtemp(temporary) == NULL) {
+        perror(temporary);
+        return 2;
+    }
+
+    int result = 0;
+    {
+        log_writer writer(temporary, options.prefix, header_line(options.wdspd_kmh, options.loop2), false);
+        datetime_formatter formatter;
+        davis_data_t davis_data;
+        char datetime[DATETIME_SIZE];
+        char line[LINE_SIZE];
+        int64_t next_log_ms = 0;
+        int64_t day_start_ms, day_end_ms;
+        /* When LOOP and LOOP2 packets alternate, a line is logged after the LOOP2 packet, as the daemon does */
+        int log_type = options.loop2 ? LOOP2_TYPE : LOOP_TYPE;
+
+        writer.set_durability(REPROCESS_FLUSH_RECORDS, REPROCESS_FLUSH_MS, false);
+        if (options.binary) writer.enable_binary(options.barocal, options.wdspd_kmh, options.winddir_180, options.loop2);
+        if (options.blocks) writer.enable_blocks(options.barocal, options.wdspd_kmh, options.winddir_180, options.loop2);
+        clear_davis_data(&davis_data);
+        day_range(task->date, &day_start_ms, &day_end_ms);
+
+        const capture_record_t *records = reader.get_records();
+        for (size_t i = 0; i < reader.get_count(); i++) {
+            if (not reader.valid(i)) {
+                task->skipped++;
+                continue;
+            }
+            task->packets++;
+            int packet_type = extract_results(records[i].frame, &davis_data, false, options.wdspd_kmh, options.barocal, options.winddir_180);
+            int64_t timestamp_ms = records[i].realtime_ns / 1000000;
+            if ((packet_type == log_type) and (timestamp_ms >= next_log_ms)) {
+                /* The packet is still decoded, since a LOOP2 line has the values of the LOOP packet before it */
+                if ((timestamp_ms < day_start_ms) or (timestamp_ms >= day_end_ms)) {
+                    task->outside++;
+                    continue;
+                }
+                int32_t utc_offset;
+                formatter.format(datetime, records[i].realtime_ns, &utc_offset);
+                if (utc_offset != records[i].utc_offset) task->other_zone++;
+                size_t length = format_result(line, sizeof(line), davis_data, options.loop2, datetime);
+                if (writer.append(line, length, davis_data, timestamp_ms, utc_offset) != 0) result = 3;
+                task->lines++;
+                next_log_ms = timestamp_ms + (int64_t) (options.interval * 1000);
+            }
+        }
+        if (writer.flush() != 0) result = 3;
+    }
+
+    if (result != 0) {
+        cout << "Could not write the logs for: " << task->capture << endl;
+        move_logs(string(temporary) + "/", "");
+        return result;
+    }
+    if (not move_logs(string(temporary) + "/", task->output)) {
+        return 3;
+    }
+    return 0;
+}
+
+/* The main function */
+int main(int argc, char *argv[])
+{
+    int opt;
+    string directory = DEFAULT_LOG_DIRECTORY;
+    string output, first, last;
+    string barocal_raw = "1.0", interval_raw = "0";
+    long threads = thread::hardware_concurrency();
+    reprocess_options_t options;
+
+    options.prefix = "davis_";
+    options.wdspd_kmh = false;
+    options.winddir_180 = false;
+    options.loop2 = false;
+    options.binary = false;
+    options.blocks = false;
+
+    while ((opt = getopt(argc, argv, "d:o:p:s:e:b:wz2i:BKj:")) != -1) {
+        switch (opt) {
+            case 'd':
+                directory = optarg;
+                break;
+            case 'o':
+                output = optarg;
+                break;
+            case 'p':
+                options.prefix = optarg;
+                break;
+            case 's':
+                first = optarg;
+                break;
+            case 'e':
+                last = optarg;
+                break;
+            case 'b':
+                barocal_raw = optarg;
+                break;
+            case 'w':
+                options.wdspd_kmh = true;
+                break;
+            case 'z':
+                options.winddir_180 = true;
+                break;
+            case '2':
+                options.loop2 = true;
+                break;
+            case 'i':
+                interval_raw = optarg;
+                break;
+            case 'B':
+                options.binary = true;
+                break;
+            case 'K':
+                options.blocks = true;
+                break;
+            case 'j':
+                if ((not convert_long(optarg, &threads)) or (threads < 1)) {
+                    cout << "The number of threads must be a positive integer: " << optarg << endl;
+                    return 1;
+                }
+                break;
+            default:
+                cout << usage_string;
+                return 1;
+        }
+    }
+
+    if (output.empty()) {
+        cout << "An output directory is needed. It can be the logging directory itself, to replace the logs, but only while the daemon is stopped" << endl;
+        cout << usage_string;
+        return 1;
+    }
+    if (((not first.empty()) and (not valid_date(first))) or ((not last.empty()) and (not valid_date(last)))) {
+        cout << "The first and last days must be in the format YYYY-MM-DD" << endl;
+        cout << usage_string;
+        return 1;
+    }
+    try {
+        size_t idx_barocal, idx_interval;
+        options.barocal = stof(barocal_raw, &idx_barocal);
+        options.interval = stof(interval_raw, &idx_interval);
+        if ((idx_barocal != barocal_raw.length()) or (idx_interval != interval_raw.length()) or (options.interval < 0.0)) {
+            throw invalid_argument("trailing characters");
+        }
+    }
+    catch (const std::exception& e) {
+        cout << "The barometer calibration and interval must be numbers: " << barocal_raw << " " << interval_raw << endl;
+        return 1;
+    }
+    if (*directory.rbegin() != '/') directory += "/";
+    if (*output.rbegin() != '/') output += "/";
+
+    /* The captures in the directory, and in each of its subdirectories */
+    vector<reprocess_task_t> tasks;
+    find_captures(directory, output, options.prefix, first, last, tasks);
+    DIR *dir = opendir(directory.c_str());
+    if (dir != NULL) {
+        struct dirent *entry;
+        struct stat st_file;
+        while ((entry = readdir(dir)) != NULL) {
+            string name = entry->d_name;
+            if ((name[0] != '.') and (stat((directory + name).c_str(), &st_file) == 0) and S_ISDIR(st_file.st_mode)) {
+                find_captures(directory + name + "/", output + name + "/", options.prefix, first, last, tasks);
+            }
+        }
+        closedir(dir);
+    }
+    if (tasks.empty()) {
+        cout << "No captures found in: " << directory << endl;
+        return 2;
+    }
+    for (size_t i = 0; i < tasks.size(); i++) {
+        if ((not check_directory(tasks[i].output)) and (not create_directory(tasks[i].output))) {
+            cout << "Cannot create the output directory: " << tasks[i].output << endl;
+            return 2;
+        }
+    }
+
+    /* The tasks are listed by directory and day, but handed out biggest first, so a big day taken last doesn't
+       leave the other threads waiting for it */
+    sort(tasks.begin(), tasks.end(), [](const reprocess_task_t &a, const reprocess_task_t &b) {
+        return (a.output != b.output) ? (a.output < b.output) : (a.date < b.date);
+    });
+    vector<size_t> order(tasks.size());
+    for (size_t i = 0; i < order.size(); i++) order[i] = i;
+    stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return tasks[a].size > tasks[b].size; });
+
+    /* Each worker takes the next day from the list */
+    if (threads > (long) tasks.size()) threads = tasks.size();
+    if (threads < 1) threads = 1;
+    atomic<size_t> next_task(0);
+    vector<thread> workers;
+    int64_t start_ns = monotonic_now_ns();
+
+    for (long worker = 0; worker < threads; worker++) {
+        workers.push_back(thread([&]() {
+            size_t task;
+            while ((task = next_task.fetch_add(1)) < order.size()) {
+                tasks[order[task]].result = reprocess_day(&tasks[order[task]], options);
+            }
+        }));
+    }
+    for (long worker = 0; worker < threads; worker++) {
+        workers[worker].join();
+    }
+    double seconds = (monotonic_now_ns() - start_ns) / 1e9;
+
+    int result = 0;
+    long packets = 0, lines = 0, other_zone = 0, outside = 0;
+    cout << "# Capture,Packets,Skipped,Lines,Outside" << endl;
+    for (size_t i = 0; i < tasks.size(); i++) {
+        cout << tasks[i].capture << "," << tasks[i].packets << "," << tasks[i].skipped << "," << tasks[i].lines << "," << tasks[i].outside << (tasks[i].result ? ",FAILED" : "") << endl;
+        packets += tasks[i].packets;
+        lines += tasks[i].lines;
+        other_zone += tasks[i].other_zone;
+        outside += tasks[i].outside;
+        if (tasks[i].result != 0) result = 2;
+    }
+    cout << "# Days: " << tasks.size() << " Packets: " << packets << " Lines: " << lines << " Threads: " << threads;
+    cout << " Seconds: " << seconds << " Packets per second: " << (long) (packets / (seconds > 0.0 ? seconds : 1.0)) << endl;
+    if (other_zone > 0) {
+        cout << "# " << other_zone << " lines were captured with a different UTC offset. Run with the station's time zone (TZ=...)" << endl;
+    }
+    if (outside > 0) {
+        cout << "# " << outside << " lines were left out, since in this time zone they aren't on the day of their capture" << endl;
+    }
+
+    return result;
+}
@@ -0,0 +1,179 @@
+/* Copyright (c) 2013-2018 Ardexa Pty Ltd. All rights reserved.
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "serial.hpp"
+#include "timestamp.hpp"
+
+/* Open the Davis weather station device for read and write. Writing is needed to send commands to the Davis,
+   that will then return the required information. The device is non-blocking, and every wait for the Davis has a
+   deadline (see read_available()), so nothing can hang for longer than asked. Returns the file descriptor, or
+   -1 on error */
+int open_davis(string device)
+{
+    struct termios newtio;
+
+    int modem_filedesc = open(device.c_str(),  O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (modem_filedesc < 0) {
+        perror(device.c_str());
+        cout << "Error opening Davis serial line" << endl;
+        return -1;
+    }
+
+    memset(&newtio, '\0', sizeof(newtio));
+    /* These are the modem control signals:
+    CS8 = 8 data bits
+    CLOCAL - Ignore modem control lines.
+    CREAD - Enable receiver.
+    ICANON - Input is made available line by line. ***DON'T WANT THIS***.... so set newtio.c_lflag = 0;
+    CRTSCTS - (not in POSIX) Enable RTS/CTS (hardware) flow control.
+    IGNPAR - Ignore framing errors and parity errors.
+    VMIN and VTIME are 0, since the waiting is done with poll() */
+
+    newtio.c_cflag = BAUDRATE | CRTSCTS | CS8 | CLOCAL | CREAD;
+    newtio.c_iflag = IGNPAR;
+    newtio.c_oflag = 0;
+    newtio.c_lflag = 0;
+    newtio.c_cc[VTIME] = 0;
+    newtio.c_cc[VMIN] = 0;
+    /* clean the modem line and activate the settings for the port */
+    tcflush(modem_filedesc, TCIFLUSH);
+    tcsetattr(modem_filedesc, TCSANOW, &newtio);
+
+    return modem_filedesc;
+}
+
+/* Wait until the device has data, or the (monotonic) 'deadline_ms' has passed. Returns 1 if there is data, 0 on a
+   timeout, or -1 on error. An unplugged adaptor is an error: its tty hangs up, and poll() reports POLLHUP (with
+   POLLIN) from then on */
+static int wait_readable(int modem_filedesc, int64_t deadline_ms)
+{
+    struct pollfd waiting;
+    waiting.fd = modem_filedesc;
+    waiting.events = POLLIN;
+
+    while (true) {
+        int64_t remaining = deadline_ms - monotonic_now_ms();
+        waiting.revents = 0;
+        int result = poll(&waiting, 1, (remaining > 0) ? (int) remaining : 0);
+        if (result > 0) {
+            if (waiting.revents & (POLLHUP | POLLERR | POLLNVAL)) return -1;
+            if (waiting.revents & POLLIN) return 1;
+            return -1;
+        }
+        if ((result < 0) and (errno != EINTR)) return -1;
+        if (remaining <= 0) return 0;
+    }
+}
+
+/* Read whatever arrives within 'timeout_ms', up to 'length' bytes. Returns the number of bytes read, 0 if nothing
+   arrived in time, or -1 on error (including a hang up, when read() returns 0 although poll() said there was data) */
+int read_available(int modem_filedesc, unsigned char *buffer, int length, int timeout_ms)
+{
+    int64_t deadline_ms = monotonic_now_ms() + timeout_ms;
+
+    while (true) {
+        int ready = wait_readable(modem_filedesc, deadline_ms);
+        if (ready <= 0) {
+            return ready;
+        }
+        int result = read(modem_filedesc, buffer, length);
+        if (result > 0) {
+            return result;
+        }
+        if ((result == 0) or ((errno != EAGAIN) and (errno != EWOULDBLOCK) and (errno != EINTR))) {
+            return -1;
+        }
+    }
+}
+
+/* This will wake up the Davis console. As the Davis protocol describes, a LF is sent and the console answers with
+   LF CR when it is awake. If it doesn't answer within WAKE_TIMEOUT_MS, the LF is sent again, up to WAKE_ATTEMPTS
+   times. Returns false if the console didn't wake up */
+bool wake_davis(int modem_filedesc, bool debug)
+{
+    unsigned char buffer[BUFSIZE];
+
+    for (int attempt = 0; attempt < WAKE_ATTEMPTS; attempt++) {
+        tcflush(modem_filedesc, TCIFLUSH);
+        int result = write(modem_filedesc, "\n", 1);
+        if (debug) {
+            if (result == 1) cout << "LF WRITTEN" << endl;
+            else cout << "LF could not be written" << endl;
+        }
+
+        int64_t deadline_ms = monotonic_now_ms() + WAKE_TIMEOUT_MS;
+        unsigned char previous = 0;
+        int received;
+        while ((received = read_available(modem_filedesc, buffer, sizeof(buffer), (int) max((int64_t) 0, deadline_ms - monotonic_now_ms()))) > 0) {
+            for (int i = 0; i < received; i++) {
+                if ((previous == '\n') and (buffer[i] == '\r')) {
+                    if (debug) cout << "The Davis is awake" << endl;
+                    return true;
+                }
+                previous = buffer[i];
+            }
+        }
+        if (received < 0) {
+            break;
+        }
+    }
+
+    if (debug) cout << "The Davis did not answer the wakeup" << endl;
+    return false;
+}
+
+/* Write a command string to the Davis. Returns false if it could not all be written */
+bool send_command(int modem_filedesc, string command, bool debug)
+{
+    int result = write(modem_filedesc, command.c_str(), command.length());
+    if (result != (int) command.length()) {
+        if (debug) cout << "Could not write command: " << trim_whitespace(command) << endl;
+        return false;
+    }
+    if (debug) cout << trim_whitespace(command) << " WRITTEN" << endl;
+    return true;
+}
+
+/* Read 'length' bytes into 'buffer', waiting no more than 'timeout_ms' for all of them. Returns the number of bytes
+   read, which is less than 'length' on a timeout */
+int read_bytes(int modem_filedesc, unsigned char *buffer, int length, int timeout_ms)
+{
+    int total = 0;
+    int64_t deadline_ms = monotonic_now_ms() + timeout_ms;
+
+    while (total < length) {
+        int result = read_available(modem_filedesc, &buffer[total], length - total, (int) max((int64_t) 0, deadline_ms - monotonic_now_ms()));
+        if (result <= 0) {
+            break;
+        }
+        total += result;
+    }
+
+    return total;
+}
+
+/* Wait for an ACK from the Davis. Returns false if something else, or nothing, is received */
+bool wait_for_ack(int modem_filedesc, bool debug)
+{
+    unsigned char response = 0;
+
+    if (read_bytes(modem_filedesc, &response, 1, ACK_TIMEOUT_MS) != 1) {
+        if (debug) cout << "No ACK received" << endl;
+        return false;
+    }
+    if (response != ACK) {
+        if (debug) cout << "Expected an ACK, received: " << (int) response << endl;
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,41 @@
+/* Copyright (c) 2013-2018 Ardexa Pty Ltd. All rights reserved.
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#ifndef SERIAL_HPP_INCLUDED
+#define SERIAL_HPP_INCLUDED
+
+#include <string>
+#include <iostream>
+#include <fcntl.h>
+#include <termios.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <algorithm>
+#include "configs.hpp"
+#include "utils.hpp"
+
+using namespace std;
+
+int open_davis(string device);
+bool wake_davis(int modem_filedesc, bool debug);
+bool send_command(int modem_filedesc, string command, bool debug);
+int read_available(int modem_filedesc, unsigned char *buffer, int length, int timeout_ms);
+int read_bytes(int modem_filedesc, unsigned char *buffer, int length, int timeout_ms);
+bool wait_for_ack(int modem_filedesc, bool debug);
+
+#endif /* SERIAL_HPP_INCLUDED */
@@ -0,0 +1,153 @@
+/* Copyright (c) 2013-2018 Ardexa Pty Ltd. All rights reserved.
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+
+#include <iostream>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "shared_latest.hpp"
+
+/* Constructor for the shared_latest class. Nothing is published until create() is called */
+shared_latest::shared_latest()
+{
+    this->segment = NULL;
+}
+
+/* Destructor for the shared_latest class. The segment is left in place, so readers still have the last reading */
+shared_latest::~shared_latest()
+{
+    if (this->segment) {
+        munmap(this->segment, sizeof(shared_latest_t));
+    }
+}
+
+/* The name of a segment, as shm_open() needs it: it starts with '/', and has no other '/' */
+string shared_latest_path(string name)
+{
+    if (name.empty() or (name[0] != '/')) name = "/" + name;
+    return name;
+}
+
+/* Create (or take over) the segment called 'name', readable by anyone. Returns false if it can't be created */
+bool shared_latest::create(string name, bool wdspd_kmh, bool loop2)
+{
+    string path = shared_latest_path(name);
+    int filedesc = shm_open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (filedesc < 0) {
+        perror(path.c_str());
+        return false;
+    }
+    fchmod(filedesc, 0644);
+    if (ftruncate(filedesc, sizeof(shared_latest_t)) != 0) {
+        perror(path.c_str());
+        close(filedesc);
+        return false;
+    }
+    void *memory = mmap(NULL, sizeof(shared_latest_t), PROT_READ | PROT_WRITE, MAP_SHARED, filedesc, 0);
+    close(filedesc);
+    if (memory == MAP_FAILED) {
+        perror(path.c_str());
+        return false;
+    }
+
+    /* A reader that finds a segment being set up sees an odd sequence number, or the wrong magic, and waits */
+    this->segment = (shared_latest_t *) memory;
+    uint64_t sequence = this->segment->sequence.load(memory_order_relaxed);
+    this->segment->sequence.store(sequence | 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    this->segment->magic = SHARED_LATEST_MAGIC;
+    this->segment->version = SHARED_LATEST_VERSION;
+    this->segment->size = sizeof(shared_latest_t);
+    this->segment->flags = (wdspd_kmh ? SHARED_LATEST_KMH : 0) | (loop2 ? SHARED_LATEST_LOOP2 : 0);
+    this->segment->pid = getpid();
+    this->segment->sequence.store((sequence | 1) + 1, memory_order_release);
+    return true;
+}
+
+/* Publish a reading. Called by the one thread that logs this station, so there is only ever one writer */
+void shared_latest::publish(const davis_data_t &davis_data, int64_t realtime_ms, int32_t utc_offset)
+{
+    if (not this->segment) {
+        return;
+    }
+    uint64_t sequence = this->segment->sequence.load(memory_order_relaxed);
+    this->segment->sequence.store(sequence + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    this->segment->davis_data = davis_data;
+    this->segment->realtime_ms = realtime_ms;
+    this->segment->utc_offset = utc_offset;
+    this->segment->count++;
+    this->segment->sequence.store(sequence + 2, memory_order_release);
+}
+
+/* Map the segment called 'name', read only. Returns NULL if there is no such segment, or it isn't one of ours */
+const shared_latest_t *open_shared_latest(string name)
+{
+    string path = shared_latest_path(name);
+    int filedesc = shm_open(path.c_str(), O_RDONLY, 0);
+    if (filedesc < 0) {
+        return NULL;
+    }
+    struct stat status;
+    if ((fstat(filedesc, &status) != 0) or (status.st_size < (off_t) sizeof(shared_latest_t))) {
+        close(filedesc);
+        return NULL;
+    }
+    void *memory = mmap(NULL, sizeof(shared_latest_t), PROT_READ, MAP_SHARED, filedesc, 0);
+    close(filedesc);
+    if (memory == MAP_FAILED) {
+        return NULL;
+    }
+    return (const shared_latest_t *) memory;
+}
+
+void close_shared_latest(const shared_latest_t *segment)
+{
+    munmap((void *) segment, sizeof(shared_latest_t));
+}
+
+/* Take a consistent copy of the segment. The copy is retried while the reading is being written. Returns false if
+   the segment doesn't have the expected layout, or the writer never finished (it died part way through) */
+bool read_shared_latest(const shared_latest_t *segment, shared_latest_t *copy)
+{
+    for (int tries = 0; ; tries++) {
+        if (tries >= SHARED_LATEST_RETRIES) {
+            return false;
+        }
+        uint64_t before = segment->sequence.load(memory_order_acquire);
+        if (before & 1) {
+            sched_yield();
+            continue;
+        }
+        copy->magic = segment->magic;
+        copy->version = segment->version;
+        copy->size = segment->size;
+        copy->flags = segment->flags;
+        copy->pid = segment->pid;
+        copy->utc_offset = segment->utc_offset;
+        copy->count = segment->count;
+        copy->realtime_ms = segment->realtime_ms;
+        copy->davis_data = segment->davis_data;
+        atomic_thread_fence(memory_order_acquire);
+        if (segment->sequence.load(memory_order_relaxed) == before) {
+            copy->sequence.store(before, memory_order_relaxed);
+            break;
+        }
+    }
+    return (copy->magic == SHARED_LATEST_MAGIC) and (copy->version == SHARED_LATEST_VERSION) and (copy->size == sizeof(shared_latest_t));
+}
@@ -0,0 +1,69 @@
+/* Copyright (c) 2013-2018 Ardexa Pty Ltd. All rights reserved.
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+
+#ifndef SHARED_LATEST_HPP_INCLUDED
+#define SHARED_LATEST_HPP_INCLUDED
+
+#include <string>
+#include <atomic>
+#include <stdint.h>
+#include "configs.hpp"
+
+using namespace std;
+
+#define SHARED_LATEST_MAGIC 0x53564144  /* "DAVS", little endian */
+#define SHARED_LATEST_VERSION 1
+#define SHARED_LATEST_KMH 0x01          /* The wind speeds are in km/h (-w) */
+#define SHARED_LATEST_LOOP2 0x02        /* The LOOP2 values are sent (-2) */
+#define SHARED_LATEST_RETRIES 1000      /* A reader gives up if the reading is still being written after this many tries */
+
+/* The POSIX shared memory segment holding the latest reading, as it was decoded. The reading is written under a
+   seqlock: 'sequence' is odd while it is being written, and goes up by 2 each time. A reader copies the segment,
+   and uses the copy if 'sequence' was even and didn't change meanwhile (read_shared_latest() does this). Nothing
+   else is locked, so a reader can never hold up the logging */
+typedef struct shared_latest_s {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;              /* sizeof(shared_latest_t), so a reader can check the layout */
+    uint32_t flags;             /* SHARED_LATEST_KMH and SHARED_LATEST_LOOP2 */
+    int32_t pid;                /* The process writing the segment */
+    int32_t utc_offset;         /* In seconds, at the time of the reading */
+    atomic<uint64_t> sequence;
+    uint64_t count;             /* Readings published since the segment was created */
+    int64_t realtime_ms;        /* When the reading was received, in milliseconds since the epoch (UTC) */
+    davis_data_t davis_data;
+} shared_latest_t;
+
+/* This class creates a segment, and publishes each reading to it */
+class shared_latest
+{
+    public:
+        /* methods are public */
+        shared_latest();
+        ~shared_latest();
+        bool create(string name, bool wdspd_kmh, bool loop2);
+        void publish(const davis_data_t &davis_data, int64_t realtime_ms, int32_t utc_offset);
+
+    private:
+        /* members are private */
+        shared_latest_t *segment;
+};
+
+string shared_latest_path(string name);
+const shared_latest_t *open_shared_latest(string name);
+void close_shared_latest(const shared_latest_t *segment);
+bool read_shared_latest(const shared_latest_t *segment, shared_latest_t *copy);
+
+#endif /* SHARED_LATEST_HPP_INCLUDED */
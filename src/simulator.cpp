@@ -0,0 +1,562 @@
+/* Copyright (c) 2013-2018 Ardexa Pty Ltd. All rights reserved.
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+/* davis-sim creates pseudo-terminals that behave like Davis Vantage consoles, so that ardexa-davis can be run
+   (and benchmarked) without a weather station. Each console answers the wakeup, LPS, LOOP and DMPAFT commands with
+   CRC-valid packets built from simulated weather. Faults can be injected: line noise, packets split over many
+   reads, latency and dropped bytes. Many consoles can be run at once, all from a single poll() loop */
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <random>
+#include <math.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <getopt.h>
+#include "configs.hpp"
+#include "utils.hpp"
+#include "crc.hpp"
+#include "encoder.hpp"
+#include "timestamp.hpp"
+
+using namespace std;
+
+#define SIM_ARCHIVE_INTERVAL 300    /* In seconds. The simulated archive has a record every 5 minutes */
+#define SIM_SPLIT_GAP 0.002         /* In seconds. The time between the pieces of a split packet */
+#define SIM_MAX_NOISE 16            /* The most bytes of noise added before a packet */
+#define SIM_MAX_COMMAND 64
+
+/* Global variables */
+int g_debug = DEFAULT_DEBUG_VALUE;
+volatile sig_atomic_t g_stop = 0;
+
+static void stop_handler(int signum)
+{
+    g_stop = 1;
+}
+
+/* The command line options */
+struct sim_options_t {
+    int consoles;
+    double rate;            /* LOOP packets a second, for each console */
+    double noise;           /* Chance of noise before a packet, or a damaged archive page */
+    double drop;            /* Chance of a byte being dropped from a packet */
+    int split;              /* If not 0, packets are sent in pieces of up to this many bytes */
+    double latency;         /* In seconds. The delay before each response */
+    int archive_records;
+    double duration;        /* In seconds. 0 runs until stopped */
+    string link;
+    unsigned int seed;
+};
+
+/* What a console is doing with the bytes it receives */
+enum console_state_t {
+    STATE_COMMAND,          /* Waiting for a command, or streaming LOOP packets */
+    STATE_DMP_REQUEST,      /* Waiting for the DMPAFT date and time */
+    STATE_DMP_START,        /* Waiting for the ACK to start sending pages */
+    STATE_DMP_PAGES         /* Waiting for the ACK, NAK or ESC after each page */
+};
+
+/* Bytes waiting to be sent, and the time they are due */
+struct pending_t {
+    double due;
+    string bytes;
+};
+
+struct console_t {
+    int master;
+    int slave;
+    string name;
+    string link;
+    console_state_t state;
+    string command;
+    deque<pending_t> output;
+    /* The LPS command being answered */
+    int lps_mask;
+    long packets_remaining;
+    double next_packet;
+    unsigned long sequence;
+    /* The DMPAFT download being answered */
+    unsigned char request[6];
+    int request_fill;
+    int first_page;
+    int pages;
+    int page;
+    /* Statistics */
+    unsigned long commands;
+    unsigned long packets;
+    unsigned long pages_sent;
+    unsigned long naks;
+    unsigned long bytes;
+};
+
+static sim_options_t options;
+static mt19937 generator;
+static double start_time;
+
+static bool chance(double probability)
+{
+    if (probability <= 0.0) return false;
+    return uniform_real_distribution<double>(0.0, 1.0)(generator) < probability;
+}
+
+static int random_int(int low, int high)
+{
+    return uniform_int_distribution<int>(low, high)(generator);
+}
+
+/* Queue bytes to be sent after the latency. If 'faults' is set, the bytes can be split, dropped or have noise added */
+static void queue_bytes(console_t &console, string bytes, bool faults)
+{
+    double due = monotonic_now_ns() / 1e9 + options.latency;
+    if (not console.output.empty()) {
+        due = max(due, console.output.back().due);
+    }
+
+    if (faults) {
+        if (chance(options.drop)) {
+            bytes.erase(random_int(0, bytes.length() - 1), 1);
+        }
+        if (chance(options.noise)) {
+            string noise;
+            int length = random_int(1, SIM_MAX_NOISE);
+            for (int i = 0; i < length; i++) noise += (char) random_int(0, 255);
+            bytes = noise + bytes;
+        }
+    }
+
+    if ((not faults) or (options.split <= 0)) {
+        console.output.push_back({due, bytes});
+        return;
+    }
+
+    /* Send the bytes in random sized pieces, a little apart, so they arrive in separate reads */
+    size_t position = 0;
+    while (position < bytes.length()) {
+        size_t length = random_int(1, options.split);
+        console.output.push_back({due, bytes.substr(position, length)});
+        position += length;
+        due += SIM_SPLIT_GAP;
+    }
+}
+
+/* Queue the next LOOP or LOOP2 packet. With an LPS bitmask of 3, the console alternates between them */
+static void send_packet(console_t &console, int index)
+{
+    unsigned char frame[LOOP_PACKET_SIZE];
+    davis_data_t davis_data = simulated_weather(time(NULL), index);
+    bool loop2 = (console.lps_mask == 2) or ((console.lps_mask == 3) and (console.sequence % 2 == 1));
+
+    if (loop2) encode_loop2(davis_data, frame);
+    else encode_loop(davis_data, frame);
+
+    queue_bytes(console, string((char *) frame, LOOP_PACKET_SIZE), true);
+    console.sequence++;
+    console.packets++;
+}
+
+/* The time of archive record 'record'. The newest record is at the last whole archive interval */
+static time_t record_time(int record)
+{
+    time_t newest = (time(NULL) / SIM_ARCHIVE_INTERVAL) * SIM_ARCHIVE_INTERVAL;
+    return newest - (time_t) (options.archive_records - 1 - record) * SIM_ARCHIVE_INTERVAL;
+}
+
+/* Queue archive page 'console.page'. Slots after the newest record are empty (all 0xFF) */
+static void send_page(console_t &console, int index)
+{
+    unsigned char records[ARCHIVE_RECORDS_PER_PAGE * ARCHIVE_RECORD_SIZE];
+    unsigned char page[ARCHIVE_PAGE_SIZE];
+
+    memset(records, 0xFF, sizeof(records));
+    for (int slot = 0; slot < ARCHIVE_RECORDS_PER_PAGE; slot++) {
+        int record = (console.first_page + console.page) * ARCHIVE_RECORDS_PER_PAGE + slot;
+        if (record >= options.archive_records) break;
+        time_t stamp_time = record_time(record);
+        struct tm stamp;
+        localtime_r(&stamp_time, &stamp);
+        encode_archive_record(simulated_weather(stamp_time, index), stamp, &records[slot * ARCHIVE_RECORD_SIZE]);
+    }
+    encode_archive_page(console.page, records, page);
+
+    /* Damage the page, so it has to be sent again */
+    if (chance(options.noise)) {
+        page[random_int(1, ARCHIVE_PAGE_SIZE - 3)] ^= 0x01;
+    }
+    queue_bytes(console, string((char *) page, ARCHIVE_PAGE_SIZE), false);
+    console.pages_sent++;
+}
+
+/* The DMPAFT date and time has been received. Work out which records are newer, and send the number of
+   pages and the first record */
+static void start_archive(console_t &console)
+{
+    unsigned char response[7];
+
+    if (not crc16_check(console.request, sizeof(console.request))) {
+        if (g_debug) cout << console.name << ": bad DMPAFT CRC" << endl;
+        queue_bytes(console, string(1, (char) CANCEL), false);
+        console.state = STATE_COMMAND;
+        return;
+    }
+
+    /* The stamps compare in time order. A date of 0 downloads the whole archive */
+    unsigned long since = ((unsigned long) ((console.request[1] << 8) | console.request[0]) << 16) | ((console.request[3] << 8) | console.request[2]);
+    int first = 0;
+    while (first < options.archive_records) {
+        time_t stamp_time = record_time(first);
+        struct tm stamp;
+        localtime_r(&stamp_time, &stamp);
+        if ((((unsigned long) archive_date_stamp(stamp) << 16) | archive_time_stamp(stamp)) > since) break;
+        first++;
+    }
+
+    console.first_page = first / ARCHIVE_RECORDS_PER_PAGE;
+    console.pages = (options.archive_records - console.first_page * ARCHIVE_RECORDS_PER_PAGE + ARCHIVE_RECORDS_PER_PAGE - 1) / ARCHIVE_RECORDS_PER_PAGE;
+    console.page = 0;
+    if (g_debug) cout << console.name << ": DMPAFT pages " << console.pages << " first record " << first << endl;
+
+    response[0] = ACK;
+    response[1] = console.pages & 0xFF;
+    response[2] = console.pages >> 8;
+    response[3] = (first % ARCHIVE_RECORDS_PER_PAGE) & 0xFF;
+    response[4] = 0;
+    crc16_append(&response[1], 4);
+    queue_bytes(console, string((char *) response, sizeof(response)), false);
+    console.state = (console.pages > 0) ? STATE_DMP_START : STATE_COMMAND;
+}
+
+/* Answer a whole command line */
+static void run_command(console_t &console, string command, bool linefeed)
+{
+    long number = 0;
+
+    command = trim_whitespace(command);
+    /* An empty line is the wakeup */
+    if (command.empty()) {
+        if (linefeed) queue_bytes(console, "\n\r", false);
+        return;
+    }
+
+    console.commands++;
+    if (g_debug) cout << console.name << ": " << command << endl;
+
+    if ((command.compare(0, 4, "LPS ") == 0) or (command.compare(0, 5, "LOOP ") == 0)) {
+        bool lps = (command[1] == 'P');
+        size_t space = command.rfind(' ');
+        console.lps_mask = 1;
+        if (lps and (not convert_long(command.substr(4, space - 4), &number) or (number < 1) or (number > 3))) {
+            queue_bytes(console, "\n\r", false);
+            return;
+        }
+        if (lps) console.lps_mask = number;
+        if ((not convert_long(command.substr(space + 1), &number)) or (number < 1)) {
+            queue_bytes(console, "\n\r", false);
+            return;
+        }
+        queue_bytes(console, string(1, (char) ACK), false);
+        console.packets_remaining = number;
+        console.sequence = 0;
+        console.next_packet = monotonic_now_ns() / 1e9;
+    }
+    else if (command == "DMPAFT") {
+        queue_bytes(console, string(1, (char) ACK), false);
+        console.state = STATE_DMP_REQUEST;
+        console.request_fill = 0;
+    }
+    else if (command == "TEST") {
+        queue_bytes(console, "\n\rTEST\n\r", false);
+    }
+    else {
+        queue_bytes(console, "\n\r", false);
+    }
+}
+
+/* Handle the bytes received from ardexa-davis */
+static void receive_bytes(console_t &console, int index, const unsigned char *data, int length)
+{
+    for (int i = 0; i < length; i++) {
+        unsigned char byte = data[i];
+
+        switch (console.state) {
+            case STATE_COMMAND:
+                /* Anything received stops the LOOP packets */
+                console.packets_remaining = 0;
+                if ((byte == '\n') or (byte == '\r')) {
+                    run_command(console, console.command, byte == '\n');
+                    console.command.clear();
+                }
+                else if (console.command.length() < SIM_MAX_COMMAND) {
+                    console.command += (char) byte;
+                }
+                break;
+
+            case STATE_DMP_REQUEST:
+                console.request[console.request_fill++] = byte;
+                if (console.request_fill == sizeof(console.request)) {
+                    start_archive(console);
+                }
+                break;
+
+            case STATE_DMP_START:
+            case STATE_DMP_PAGES:
+                if (byte == ESC) {
+                    console.state = STATE_COMMAND;
+                }
+                else if ((byte == NAK) and (console.state == STATE_DMP_PAGES)) {
+                    console.naks++;
+                    send_page(console, index);
+                }
+                else if (byte == ACK) {
+                    if (console.state == STATE_DMP_PAGES) console.page++;
+                    console.state = STATE_DMP_PAGES;
+                    if (console.page < console.pages) send_page(console, index);
+                    else console.state = STATE_COMMAND;
+                }
+                break;
+        }
+    }
+}
+
+/* Write the output that is due. Returns false if the pty is full */
+static bool send_due(console_t &console, double now)
+{
+    while ((not console.output.empty()) and (console.output.front().due <= now)) {
+        pending_t &pending = console.output.front();
+        int result = write(console.master, pending.bytes.data(), pending.bytes.length());
+        if (result < 0) {
+            if ((errno == EAGAIN) or (errno == EINTR)) return false;
+            /* EIO if nothing has the pty open. Drop the output, as a console with nothing attached would */
+            console.output.clear();
+            return true;
+        }
+        console.bytes += result;
+        if (result < (int) pending.bytes.length()) {
+            pending.bytes.erase(0, result);
+            return false;
+        }
+        console.output.pop_front();
+    }
+    return true;
+}
+
+/* Create the pty for a console. The slave end is kept open, so the pty isn't closed when ardexa-davis exits */
+static bool open_console(console_t &console, int index)
+{
+    struct termios settings;
+
+    console.master = posix_openpt(O_RDWR | O_NOCTTY);
+    if ((console.master < 0) or (grantpt(console.master) != 0) or (unlockpt(console.master) != 0)) {
+        perror("posix_openpt");
+        return false;
+    }
+    console.name = ptsname(console.master);
+    fcntl(console.master, F_SETFL, fcntl(console.master, F_GETFL) | O_NONBLOCK);
+
+    console.slave = open(console.name.c_str(), O_RDWR | O_NOCTTY);
+    if (console.slave < 0) {
+        perror(console.name.c_str());
+        return false;
+    }
+    tcgetattr(console.slave, &settings);
+    cfmakeraw(&settings);
+    tcsetattr(console.slave, TCSANOW, &settings);
+
+    /* A fixed name for the console, such as /tmp/davis0 */
+    if (not options.link.empty()) {
+        console.link = options.link + ((options.consoles > 1) ? to_string(index) : "");
+        unlink(console.link.c_str());
+        if (symlink(console.name.c_str(), console.link.c_str()) != 0) {
+            perror(console.link.c_str());
+            console.link.clear();
+        }
+    }
+
+    console.state = STATE_COMMAND;
+    console.lps_mask = LPS_LOOP;
+    console.packets_remaining = 0;
+    console.next_packet = 0.0;
+    console.sequence = 0;
+    console.request_fill = 0;
+    console.first_page = console.pages = console.page = 0;
+    console.commands = console.packets = console.pages_sent = console.naks = console.bytes = 0;
+
+    return true;
+}
+
+/* Print the statistics for the consoles, and the totals */
+static void print_statistics(vector<console_t> &consoles)
+{
+    unsigned long packets = 0, bytes = 0;
+    double elapsed = monotonic_now_ns() / 1e9 - start_time;
+
+    for (size_t i = 0; i < consoles.size(); i++) {
+        console_t &console = consoles[i];
+        if (g_debug or (consoles.size() == 1)) {
+            cout << console.name << ": commands " << console.commands << " packets " << console.packets;
+            cout << " pages " << console.pages_sent << " NAKs " << console.naks << " bytes " << console.bytes << endl;
+        }
+        packets += console.packets;
+        bytes += console.bytes;
+    }
+    cout << "Consoles: " << consoles.size() << " Packets: " << packets << " Bytes: " << bytes;
+    cout << " Seconds: " << elapsed << " Packets/s: " << (elapsed > 0 ? packets / elapsed : 0) << endl;
+}
+
+static void usage()
+{
+    cout << "Usage: davis-sim [-n consoles] [-r packets/s] [-x noise] [-p drop] [-s split] [-l latency ms] [-a records]" << endl;
+    cout << "                 [-t seconds] [-L link] [-S seed] [-e]" << endl;
+}
+
+int main(int argc, char *argv[])
+{
+    int opt;
+    long number;
+    vector<console_t> consoles;
+
+    options.consoles = 1;
+    options.rate = 1.0 / 2.5;
+    options.noise = 0.0;
+    options.drop = 0.0;
+    options.split = 0;
+    options.latency = 0.0;
+    options.archive_records = 100;
+    options.duration = 0.0;
+    options.seed = time(NULL);
+
+    /**
+     * -n <consoles> (optional) the number of consoles to simulate
+     * -r <packets/s> (optional) the LOOP packets sent each second by each console. A Davis sends one every 2.5 seconds
+     * -x <probability> (optional) the chance of noise before each packet, or of a damaged archive page
+     * -p <probability> (optional) the chance of a byte being dropped from each packet
+     * -s <bytes> (optional) send packets in random pieces of up to this many bytes
+     * -l <ms> (optional) the delay before each response
+     * -a <records> (optional) the number of records in the archive
+     * -t <seconds> (optional) stop after this long
+     * -L <link> (optional) make a symbolic link to each pty. With more than one console, the number is added to the end
+     * -S <seed> (optional) the seed for the faults, so a run can be repeated
+     * -e (optional) if specified, debug will be turned on
+     */
+    try {
+        while ((opt = getopt(argc, argv, "n:r:x:p:s:l:a:t:L:S:eh")) != -1) {
+            switch (opt) {
+                case 'n':
+                    if ((not convert_long(optarg, &number)) or (number < 1)) {
+                        cout << "The number of consoles must be a positive integer: " << optarg << endl;
+                        return 1;
+                    }
+                    options.consoles = number;
+                    break;
+                case 'r': options.rate = stod(optarg); break;
+                case 'x': options.noise = stod(optarg); break;
+                case 'p': options.drop = stod(optarg); break;
+                case 's': options.split = stoi(optarg); break;
+                case 'l': options.latency = stod(optarg) / 1000.0; break;
+                case 'a': options.archive_records = stoi(optarg); break;
+                case 't': options.duration = stod(optarg); break;
+                case 'L': options.link = optarg; break;
+                case 'S': options.seed = stoul(optarg); break;
+                case 'e': g_debug = 1; break;
+                default:
+                    usage();
+                    return 1;
+            }
+        }
+    }
+    catch (exception &e) {
+        cout << "Invalid number for option -" << (char) opt << ": " << optarg << endl;
+        return 1;
+    }
+    if ((options.rate <= 0.0) or (options.archive_records < 0)) {
+        usage();
+        return 1;
+    }
+    generator.seed(options.seed);
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = stop_handler;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGTERM, &action, NULL);
+    sigaction(SIGINT, &action, NULL);
+
+    consoles.resize(options.consoles);
+    for (int i = 0; i < options.consoles; i++) {
+        if (not open_console(consoles[i], i)) {
+            return 2;
+        }
+        cout << (consoles[i].link.empty() ? consoles[i].name : consoles[i].link) << endl;
+    }
+    cout.flush();
+
+    vector<struct pollfd> fds(options.consoles);
+    unsigned char buffer[BUFSIZE];
+    double period = 1.0 / options.rate;
+    start_time = monotonic_now_ns() / 1e9;
+
+    while ((not g_stop) and ((options.duration <= 0.0) or (monotonic_now_ns() / 1e9 - start_time < options.duration))) {
+        /* Sleep until the next packet or output is due, or something is received */
+        double now = monotonic_now_ns() / 1e9;
+        double next = now + 0.1;
+        for (int i = 0; i < options.consoles; i++) {
+            console_t &console = consoles[i];
+            fds[i].fd = console.master;
+            fds[i].events = POLLIN;
+            if (console.packets_remaining > 0) next = min(next, console.next_packet);
+            if (not console.output.empty()) next = min(next, console.output.front().due);
+        }
+        int timeout = (int) ceil(max(0.0, next - now) * 1000);
+        if (poll(fds.data(), fds.size(), timeout) < 0) {
+            if (errno == EINTR) continue;
+            perror("poll");
+            break;
+        }
+
+        now = monotonic_now_ns() / 1e9;
+        for (int i = 0; i < options.consoles; i++) {
+            console_t &console = consoles[i];
+
+            if (fds[i].revents & POLLIN) {
+                int result = read(console.master, buffer, sizeof(buffer));
+                if (result > 0) receive_bytes(console, i, buffer, result);
+            }
+
+            /* Catch up on the packets that are due, but don't send a backlog if the pty was full */
+            if ((console.packets_remaining > 0) and (console.next_packet <= now) and (console.output.size() < 64)) {
+                send_packet(console, i);
+                console.packets_remaining--;
+                console.next_packet = max(console.next_packet + period, now - period);
+            }
+
+            send_due(console, now);
+        }
+    }
+
+    print_statistics(consoles);
+    for (int i = 0; i < options.consoles; i++) {
+        if (not consoles[i].link.empty()) unlink(consoles[i].link.c_str());
+        close(consoles[i].slave);
+        close(consoles[i].master);
+    }
+
+    return 0;
+}
@@ -0,0 +1,639 @@
+/* Copyright (c) 2013-2018 Ardexa Pty Ltd. All rights reserved.
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <set>
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/epoll.h>
+#include "station.hpp"
+#include "serial.hpp"
+#include "field_decoder.hpp"
+
+/* Constructor for the station class. The device is opened on the first call to on_timer() */
+station::station(const station_config_t &config, arguments &arguments_list, int epoll_filedesc, device_discovery *discovery, frame_ring *ring)
+    : writer(config.directory, "davis_", header_line(config.wdspd_kmh, config.loop2), true)
+{
+    this->config = config;
+    this->debug = arguments_list.get_debug();
+    this->epoll_filedesc = epoll_filedesc;
+    this->discovery = discovery;
+    this->ring = ring;
+    this->reopen_ms = STATION_REOPEN_TIME * 1000;
+    this->filedesc = -1;
+    this->state = STATION_CLOSED;
+    this->due_ms = 0;
+    this->wakes_sent = 0;
+    this->previous_byte = 0;
+    this->waking_ns = 0;
+    this->command_ns = 0;
+    this->frame_start_ns = 0;
+    this->ack_pending = false;
+    this->first_byte_pending = false;
+    this->packets_remaining = 0;
+    this->last_received_ms = 0;
+    this->next_log_ms = 0;
+    this->last_packet_ns = 0;
+    /* When LOOP and LOOP2 packets alternate, a line is logged after the LOOP2 packet, so it has the latest of both */
+    this->log_type = config.loop2 ? LOOP2_TYPE : LOOP_TYPE;
+    clear_davis_data(&this->davis_data);
+
+    this->writer.set_durability(arguments_list.flush_records, arguments_list.flush_ms, arguments_list.sync);
+    this->writer.set_stats(&this->stats);
+    if (config.binary) {
+        this->writer.enable_binary(config.barocal, config.wdspd_kmh, config.winddir_180, config.loop2);
+    }
+    if (config.blocks) {
+        this->writer.enable_blocks(config.barocal, config.wdspd_kmh, config.winddir_180, config.loop2);
+    }
+
+    /* A count of the invalid values of each field of each packet type */
+    for (int packet_type = LOOP_TYPE; packet_type <= LOOP2_TYPE; packet_type++) {
+        const field_t *fields;
+        size_t count = packet_fields(packet_type, &fields);
+        for (size_t i = 0; i < count; i++) this->invalid_fields[packet_type].emplace_back();
+    }
+
+    /* Each reading is also published to shared memory, for davis-latest */
+    if (not config.shm_name.empty()) {
+        this->latest.create(config.shm_name, config.wdspd_kmh, config.loop2);
+    }
+
+    /* The rolling statistics go to their own daily logs, 'davis_aggregate_YYYY-MM-DD.log' */
+    this->aggregates = NULL;
+    this->aggregate_writer = NULL;
+    this->next_aggregate_ms = 0;
+    if (not config.aggregate_minutes.empty()) {
+        this->aggregates = new aggregator(config.aggregate_minutes, config.wdspd_kmh);
+        this->aggregate_writer = new log_writer(config.directory, "davis_aggregate_", this->aggregates->header(), false);
+        this->aggregate_writer->set_durability(arguments_list.flush_records, arguments_list.flush_ms, arguments_list.sync);
+    }
+
+    /* The packets, as received, go to the daily captures 'davis_YYYY-MM-DD.cap' */
+    this->capture_log = NULL;
+    if (config.capture) {
+        this->capture_log = new capture_writer(config.directory, "davis_", config.device);
+        this->capture_log->set_durability(arguments_list.flush_records, arguments_list.flush_ms);
+    }
+}
+
+/* Destructor for the station class */
+station::~station()
+{
+    if (this->filedesc >= 0) {
+        close(this->filedesc);
+    }
+    delete this->aggregate_writer;
+    delete this->aggregates;
+    delete this->capture_log;
+}
+
+/* Open the device, without blocking, and add it to the epoll set. Returns false if it can't be opened */
+bool station::open_device(int64_t now_ms)
+{
+    /* A device of "usb:<serial>" is the Davis USB adaptor with that serial number */
+    this->device = this->config.device;
+    if (this->device.compare(0, 4, "usb:") == 0) {
+        this->device = this->discovery->find_serial(this->device.substr(4));
+        if (this->device.empty()) {
+            if (this->debug) cout << this->config.device << ": the adaptor isn't plugged in" << endl;
+            return false;
+        }
+    }
+
+    /* The device is non-blocking, so read() returns whatever has arrived */
+    int filedesc = open_davis(this->device);
+    if (filedesc < 0) {
+        return false;
+    }
+
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.ptr = this;
+    if (epoll_ctl(this->epoll_filedesc, EPOLL_CTL_ADD, filedesc, &event) != 0) {
+        perror("epoll_ctl");
+        close(filedesc);
+        return false;
+    }
+
+    if (this->debug) cout << this->config.device << ": opened " << this->device << endl;
+    this->filedesc = filedesc;
+    this->start_waking(now_ms);
+    return true;
+}
+
+/* Close the device (which also takes it out of the epoll set), and try again later. If it is unplugged, it will be
+   opened again as soon as it is plugged back in */
+void station::close_device(int64_t now_ms)
+{
+    if (this->filedesc >= 0) {
+        close(this->filedesc);
+        this->filedesc = -1;
+        this->reopens.add();
+    }
+    this->state = STATION_CLOSED;
+    this->due_ms = now_ms + this->reopen_ms;
+}
+
+/* Set how long to wait before opening a closed device again. When adaptors being plugged in are reported by udev,
+   this is only a fallback, so it can be much longer */
+void station::set_reopen_time(int seconds)
+{
+    this->reopen_ms = (int64_t) seconds * 1000;
+}
+
+/* An adaptor was plugged in or unplugged. If it is this station's, open it now, or close it now. Returns true if
+   the adaptor is this station's */
+bool station::on_device_event(const usb_event_t &event, int64_t now_ms)
+{
+    bool mine = (this->config.device == event.devnode) or
+                ((not event.serial.empty()) and (this->config.device == "usb:" + event.serial));
+
+    if (event.added and mine and (this->state == STATION_CLOSED)) {
+        this->due_ms = now_ms;
+    }
+    else if ((not event.added) and (this->filedesc >= 0) and ((this->device == event.devnode) or mine)) {
+        if (this->debug) cout << this->config.device << ": unplugged" << endl;
+        this->close_device(now_ms);
+    }
+    return mine;
+}
+
+/* Wake the console, as wake_davis() does but without waiting: a LF is sent, and when on_event() sees the LF CR
+   answer, the LPS command is sent. If there is no answer within WAKE_TIMEOUT_MS, on_timer() sends the LF again */
+void station::start_waking(int64_t now_ms)
+{
+    this->state = STATION_WAKING;
+    this->wakes_sent = 0;
+    this->previous_byte = 0;
+    this->due_ms = now_ms;
+}
+
+/* The console is awake, so ask it for a burst of LOOP packets. Anything it sent while waking is thrown away */
+void station::start_streaming(int64_t now_ms)
+{
+    int bitmask = this->config.loop2 ? LPS_LOOP_LOOP2 : LPS_LOOP;
+    string command = "LPS " + to_string(bitmask) + " " + to_string(LOOP_BURST) + "\r";
+
+    tcflush(this->filedesc, TCIFLUSH);
+    this->parser.reset();
+    if (not send_command(this->filedesc, command, this->debug)) {
+        this->close_device(now_ms);
+        return;
+    }
+    this->state = STATION_STREAMING;
+    this->command_ns = monotonic_now_ns();
+    this->ack_pending = true;
+    this->first_byte_pending = true;
+    this->packets_remaining = LOOP_BURST;
+    this->last_received_ms = now_ms;
+}
+
+/* Move the station on, when the time returned by next_due_ms() has been reached */
+void station::on_timer(int64_t now_ms)
+{
+    switch (this->state) {
+        case STATION_CLOSED:
+            if ((now_ms >= this->due_ms) and (not this->open_device(now_ms))) {
+                this->close_device(now_ms);
+            }
+            break;
+
+        case STATION_WAKING:
+            if (now_ms < this->due_ms) {
+                break;
+            }
+            /* After WAKE_ATTEMPTS without an answer, wait a while before trying again */
+            if (this->wakes_sent >= WAKE_ATTEMPTS) {
+                if (this->debug) cout << this->config.device << ": the console did not answer the wakeup" << endl;
+                this->wakeup_timeouts.add();
+                this->wakes_sent = 0;
+                this->due_ms = now_ms + DAEMON_STALL_TIME * 1000;
+                break;
+            }
+            tcflush(this->filedesc, TCIFLUSH);
+            if (this->wakes_sent == 0) this->waking_ns = monotonic_now_ns();
+            if (write(this->filedesc, "\n", 1) != 1) {
+                if (this->debug) cout << this->config.device << ": LF could not be written" << endl;
+                this->close_device(now_ms);
+                break;
+            }
+            if (this->debug) cout << this->config.device << ": LF WRITTEN" << endl;
+            this->wakes_sent++;
+            this->wakeups.add();
+            this->previous_byte = 0;
+            this->due_ms = now_ms + WAKE_TIMEOUT_MS;
+            break;
+
+        case STATION_STREAMING:
+            /* Start a new burst if the last one has finished, or nothing has been received for a while */
+            if (this->packets_remaining <= 0) {
+                this->start_waking(now_ms);
+            }
+            else if (now_ms - this->last_received_ms > DAEMON_STALL_TIME * 1000) {
+                if (this->debug) cout << this->config.device << ": nothing received for " << DAEMON_STALL_TIME << " seconds. Waking the console" << endl;
+                this->stalls.add();
+                this->start_waking(now_ms);
+            }
+            break;
+    }
+    this->state_metric.set(this->state);
+}
+
+/* The monotonic time (in milliseconds) at which on_timer() next has something to do */
+int64_t station::next_due_ms()
+{
+    if (this->state == STATION_STREAMING) {
+        if (this->packets_remaining <= 0) return this->last_received_ms;
+        return this->last_received_ms + DAEMON_STALL_TIME * 1000 + 1;
+    }
+    return this->due_ms;
+}
+
+/* Read everything that has arrived, and pull every whole LOOP packet out of it. 'events' are the epoll events */
+void station::on_event(uint32_t events)
+{
+    unsigned char buffer[BUFSIZE];
+
+    while (this->filedesc >= 0) {
+        int result = read(this->filedesc, buffer, sizeof(buffer));
+        if (result < 0) {
+            if (errno == EINTR) continue;
+            if ((errno == EAGAIN) or (errno == EWOULDBLOCK)) break;
+            /* The adaptor has probably been unplugged */
+            perror(this->device.c_str());
+            this->read_errors.add();
+            this->close_device(monotonic_now_ms());
+            return;
+        }
+        if (result == 0) {
+            break;
+        }
+        this->bytes_read.add(result);
+
+        /* Every packet completed by this read is stamped with the time it returned */
+        receive_stamp_t stamp = stamp_now();
+        this->last_received_ms = stamp.monotonic_ns / 1000000;
+
+        /* While waking, look for the LF CR answer. Anything else is thrown away */
+        if (this->state == STATION_WAKING) {
+            for (int i = 0; (i < result) and (this->state == STATION_WAKING); i++) {
+                if ((this->previous_byte == '\n') and (buffer[i] == '\r')) {
+                    if (this->debug) cout << this->config.device << ": awake" << endl;
+                    this->stats.record(STAGE_WAKEUP, stamp.monotonic_ns - this->waking_ns);
+                    this->start_streaming(this->last_received_ms);
+                }
+                this->previous_byte = buffer[i];
+            }
+            continue;
+        }
+        if (this->state != STATION_STREAMING) {
+            continue;
+        }
+        if (this->ack_pending) {
+            if (buffer[0] == ACK) this->stats.record(STAGE_ACK, stamp.monotonic_ns - this->command_ns);
+            this->ack_pending = false;
+        }
+
+        /* A packet is timed from the read that brought its first byte */
+        const unsigned char *data = buffer;
+        size_t remaining = result;
+        while (remaining > 0) {
+            bool starting = (this->parser.partial() == 0);
+            size_t used = this->parser.feed(data, remaining);
+            data += used;
+            remaining -= used;
+            if (starting and ((this->parser.partial() > 0) or this->parser.frame_ready())) {
+                this->frame_start_ns = stamp.monotonic_ns;
+                if (this->first_byte_pending) {
+                    this->stats.record(STAGE_FIRST_BYTE, stamp.monotonic_ns - this->command_ns);
+                    this->first_byte_pending = false;
+                }
+            }
+            if (this->parser.frame_ready()) {
+                this->stats.record(STAGE_FRAME, stamp.monotonic_ns - this->frame_start_ns);
+                /* The packet is copied to the ring. If the logging thread has fallen that far behind, it is lost */
+                this->packets_remaining--;
+                if (not this->ring->push(this, stamp, this->parser.frame())) {
+                    this->dropped.add();
+                }
+            }
+        }
+    }
+
+    if ((this->filedesc >= 0) and (events & (EPOLLHUP | EPOLLERR))) {
+        if (this->debug) cout << this->config.device << ": hung up" << endl;
+        this->close_device(monotonic_now_ms());
+    }
+}
+
+/* Decode a LOOP packet taken from the ring, and log it if it is time. Called by the logging thread */
+void station::handle_frame(const frame_slot_t &slot)
+{
+    const receive_stamp_t &stamp = slot.stamp;
+    int64_t start_ns = monotonic_now_ns();
+
+    this->stats.record(STAGE_QUEUE, start_ns - stamp.monotonic_ns);
+    if (this->last_packet_ns > 0) {
+        if (this->debug) cout << this->config.device << ": packet received " << (stamp.monotonic_ns - this->last_packet_ns) / 1000 << " us after the last one" << endl;
+        this->stats.record(STAGE_INTERVAL, stamp.monotonic_ns - this->last_packet_ns);
+    }
+    this->last_packet_ns = stamp.monotonic_ns;
+    if (this->capture_log) {
+        this->capture_log->append(slot.frame, stamp.realtime_ns, this->formatter.utc_offset(stamp.realtime_ns));
+    }
+
+    int packet_type = extract_results(slot.frame, &this->davis_data, this->debug, this->config.wdspd_kmh, this->config.barocal, this->config.winddir_180);
+    this->stats.record(STAGE_DECODE, monotonic_now_ns() - start_ns);
+    int64_t now_ms = stamp.monotonic_ns / 1000000;
+    if (packet_type >= 0) {
+        const field_t *fields;
+        size_t count = packet_fields(packet_type, &fields);
+        this->packets[packet_type].add();
+        for (size_t i = 0; i < count; i++) {
+            if (this->davis_data.*fields[i].member == (float) ERROR_VALUE_FLOAT) this->invalid_fields[packet_type][i].add();
+        }
+    }
+    if ((packet_type >= 0) and (not this->config.shm_name.empty())) {
+        this->latest.publish(this->davis_data, stamp.realtime_ns / 1000000, this->formatter.utc_offset(stamp.realtime_ns));
+    }
+    if (this->aggregates and (packet_type == LOOP_TYPE)) {
+        this->aggregates->add(this->davis_data, now_ms);
+        this->log_aggregates(stamp);
+    }
+    if ((packet_type == this->log_type) and (now_ms >= this->next_log_ms)) {
+        this->log_result(stamp);
+        this->next_log_ms = now_ms + (int64_t) (this->config.interval * 1000);
+    }
+}
+
+/* Write the results to the station's daily log file and 'latest.csv', stamped with the time the packet was received */
+void station::log_result(const receive_stamp_t &stamp)
+{
+    int32_t utc_offset;
+    char datetime[DATETIME_SIZE];
+    char line[LINE_SIZE];
+    int64_t start_ns = monotonic_now_ns();
+
+    this->formatter.format(datetime, stamp.realtime_ns, &utc_offset);
+    size_t length = format_result(line, sizeof(line), this->davis_data, this->config.loop2, datetime);
+    this->stats.record(STAGE_FORMAT, monotonic_now_ns() - start_ns);
+
+    this->writer.append(line, length, this->davis_data, stamp.realtime_ns / 1000000, utc_offset);
+}
+
+/* At the start of each minute, log a line for each aggregate window. The line is stamped with the minute */
+void station::log_aggregates(const receive_stamp_t &stamp)
+{
+    int64_t realtime_ms = stamp.realtime_ns / 1000000;
+    int64_t minute_ms = AGGREGATE_EMIT_SECONDS * 1000;
+
+    if (this->next_aggregate_ms == 0) {
+        this->next_aggregate_ms = (realtime_ms / minute_ms + 1) * minute_ms;
+        return;
+    }
+    if (realtime_ms < this->next_aggregate_ms) {
+        return;
+    }
+
+    int32_t utc_offset;
+    char datetime[DATETIME_SIZE];
+    char line[LINE_SIZE];
+    int64_t boundary_ms = (realtime_ms / minute_ms) * minute_ms;
+    this->formatter.format(datetime, boundary_ms * 1000000, &utc_offset);
+    for (size_t i = 0; i < this->aggregates->windows(); i++) {
+        size_t length = this->aggregates->format(line, sizeof(line), i, datetime, stamp.monotonic_ns / 1000000);
+        this->aggregate_writer->append(line, length, this->davis_data, boundary_ms, utc_offset);
+    }
+    this->next_aggregate_ms = boundary_ms + minute_ms;
+}
+
+/* Cancel any remaining LPS events and close the device */
+void station::stop()
+{
+    if (this->filedesc >= 0) {
+        int result = write(this->filedesc, "\r", 1);
+        if (this->debug and (result == 1)) cout << this->config.device << ": CR WRITTEN" << endl;
+        close(this->filedesc);
+        this->filedesc = -1;
+    }
+    this->state = STATION_CLOSED;
+}
+
+/* Write the lines that have waited long enough, even if no more are arriving, or every waiting line if 'all' is
+   set. Called by the logging thread */
+void station::flush_logs(bool all)
+{
+    if (all) {
+        this->writer.flush();
+        if (this->aggregate_writer) this->aggregate_writer->flush();
+        if (this->capture_log) this->capture_log->flush();
+    }
+    else {
+        this->writer.flush_if_due();
+        if (this->aggregate_writer) this->aggregate_writer->flush_if_due();
+        if (this->capture_log) this->capture_log->flush_if_due();
+    }
+}
+
+void station::print_statistics()
+{
+    cout << this->config.device << ": LOOP packets received: " << this->parser.get_frames() << " Resyncs: " << this->parser.get_resyncs();
+    cout << " CRC errors: " << this->parser.get_crc_errors() << " Bytes skipped: " << this->parser.get_skipped();
+    cout << " Reopens: " << this->reopens.get() << " Dropped: " << this->dropped.get() << endl;
+}
+
+/* The time taken by each stage, for --stats */
+const stage_stats &station::get_stats()
+{
+    return this->stats;
+}
+
+/* Add the counts of the station, its parser and its logs to the metrics, labelled with the station's device */
+void station::register_metrics(metrics_registry &registry)
+{
+    string device = metric_label("device", this->config.device);
+    const char *type_names[] = { "loop", "loop2" };
+
+    registry.add("davis_station_state", METRIC_GAUGE, "0 while the device is closed, 1 while waking the console and 2 while streaming", device, &this->state_metric);
+    registry.add("davis_bytes_read_total", METRIC_COUNTER, "Bytes read from the serial device", device, &this->bytes_read);
+    registry.add("davis_read_errors_total", METRIC_COUNTER, "Reads from the serial device that failed", device, &this->read_errors);
+    registry.add("davis_wakeups_total", METRIC_COUNTER, "LFs sent to wake the console", device, &this->wakeups);
+    registry.add("davis_wakeup_timeouts_total", METRIC_COUNTER, "Times the console did not answer " + to_string(WAKE_ATTEMPTS) + " LFs", device, &this->wakeup_timeouts);
+    registry.add("davis_stalls_total", METRIC_COUNTER, "Times nothing was received for " + to_string(DAEMON_STALL_TIME) + " seconds while streaming", device, &this->stalls);
+    registry.add("davis_reopens_total", METRIC_COUNTER, "Times the device was closed, to be opened again", device, &this->reopens);
+    registry.add("davis_frames_dropped_total", METRIC_COUNTER, "Packets lost because the logging thread was too far behind", device, &this->dropped);
+    this->parser.register_metrics(registry, device);
+    for (int packet_type = LOOP_TYPE; packet_type <= LOOP2_TYPE; packet_type++) {
+        string type = device + "," + metric_label("type", type_names[packet_type]);
+        registry.add("davis_packets_decoded_total", METRIC_COUNTER, "Packets decoded, by type", type, &this->packets[packet_type]);
+
+        const field_t *fields;
+        size_t count = packet_fields(packet_type, &fields);
+        for (size_t i = 0; i < count; i++) {
+            registry.add("davis_field_invalid_total", METRIC_COUNTER, "Values that were dashed or out of range, and logged as the error value", type + "," + metric_label("field", fields[i].name), &this->invalid_fields[packet_type][i]);
+        }
+    }
+    this->writer.register_metrics(registry, device + "," + metric_label("log", "davis_"));
+    if (this->aggregate_writer) this->aggregate_writer->register_metrics(registry, device + "," + metric_label("log", "davis_aggregate_"));
+    if (this->capture_log) this->capture_log->register_metrics(registry, device);
+}
+
+/* A station using the device, calibration and logging options given on the command line */
+station_config_t station_from_arguments(arguments &arguments_list, string device, string directory)
+{
+    station_config_t config;
+
+    config.device = device;
+    config.directory = directory;
+    config.barocal = arguments_list.barocal;
+    config.wdspd_kmh = arguments_list.wdspd_kmh;
+    config.winddir_180 = arguments_list.winddir_180;
+    config.loop2 = arguments_list.loop2;
+    config.binary = arguments_list.binary;
+    config.blocks = arguments_list.blocks;
+    config.capture = arguments_list.capture;
+    config.interval = arguments_list.interval;
+    config.aggregate_minutes = arguments_list.aggregate_minutes;
+    config.shm_name = arguments_list.shm_name;
+
+    return config;
+}
+
+/* With more than one station, each publishes to its own segment: the --shm name, followed by '_' and the last part
+   of its logging directory (the serial number, with -t all). Empty if there is no --shm */
+string station_shm_name(arguments &arguments_list, string directory)
+{
+    if (arguments_list.shm_name.empty()) {
+        return "";
+    }
+    while ((directory.length() > 1) and (*directory.rbegin() == '/')) directory.erase(directory.length() - 1);
+    return arguments_list.shm_name + "_" + directory.substr(directory.rfind('/') + 1);
+}
+
+/* Read the stations file. Each line is a device, its logging directory, then any of the options -b, -w, -z, -2,
+   -B, -K (the same as --blocks), -C (the same as --capture), -i, -A (the same as --aggregate) and -M (the same as
+   --shm), as on the command line. Options that aren't given are taken from the command line. Blank lines and lines
+   starting with '#' are ignored. For example:
+
+       /dev/ttyUSB0        /opt/ardexa/davis/north     -b 1.002 -2
+       usb:0001234         /opt/ardexa/davis/south     -z -i 60
+
+   Returns false (after printing the reason) if the file can't be read or has an error */
+bool read_stations(string filename, arguments &arguments_list, vector<station_config_t> &stations)
+{
+    ifstream reader(filename.c_str());
+    string line;
+    int line_number = 0;
+    set<string> devices, directories, shm_names;
+
+    if (not reader) {
+        cout << "Could not open the stations file: " << filename << endl;
+        return false;
+    }
+
+    while (getline(reader, line)) {
+        line_number++;
+        line = trim_whitespace(line);
+        if (line.empty() or (line[0] == '#')) {
+            continue;
+        }
+
+        istringstream tokens(line);
+        string device, directory, option;
+        tokens >> device >> directory;
+        if (directory.empty()) {
+            cout << filename << ":" << line_number << ": a device and a logging directory are needed" << endl;
+            return false;
+        }
+
+        station_config_t config = station_from_arguments(arguments_list, device, directory);
+        config.shm_name = station_shm_name(arguments_list, directory);
+        while (tokens >> option) {
+            bool ok = true;
+            if (option == "-w") config.wdspd_kmh = true;
+            else if (option == "-z") config.winddir_180 = true;
+            else if (option == "-2") config.loop2 = true;
+            else if (option == "-B") config.binary = true;
+            else if (option == "-K") config.blocks = true;
+            else if (option == "-C") config.capture = true;
+            else if (option == "-M") {
+                tokens >> config.shm_name;
+                if (config.shm_name.empty() or (config.shm_name.find('/', 1) != string::npos)) {
+                    cout << filename << ":" << line_number << ": invalid shared memory name: " << config.shm_name << endl;
+                    return false;
+                }
+            }
+            else if (option == "-A") {
+                string value;
+                tokens >> value;
+                if (not parse_window_minutes(value, config.aggregate_minutes)) {
+                    cout << filename << ":" << line_number << ": invalid aggregate windows: " << value << endl;
+                    return false;
+                }
+            }
+            else if ((option == "-b") or (option == "-i")) {
+                string value;
+                size_t idx = 0;
+                float number = 0.0;
+                tokens >> value;
+                try {
+                    number = stof(value, &idx);
+                }
+                catch (const std::exception& e) {
+                    ok = false;
+                }
+                if ((not ok) or (idx != value.length()) or ((option == "-i") and (number < 0.0))) {
+                    cout << filename << ":" << line_number << ": invalid value for " << option << ": " << value << endl;
+                    return false;
+                }
+                if (option == "-b") config.barocal = number;
+                else config.interval = number;
+            }
+            else {
+                ok = false;
+            }
+            if (not ok) {
+                cout << filename << ":" << line_number << ": unknown option: " << option << endl;
+                return false;
+            }
+        }
+
+        /* Two stations on one device, or writing to one directory, would interfere with each other */
+        if (not devices.insert(device).second) {
+            cout << filename << ":" << line_number << ": the device is already used: " << device << endl;
+            return false;
+        }
+        if (not directories.insert(directory).second) {
+            cout << filename << ":" << line_number << ": the logging directory is already used: " << directory << endl;
+            return false;
+        }
+        if ((not config.shm_name.empty()) and (not shm_names.insert(shared_latest_path(config.shm_name)).second)) {
+            cout << filename << ":" << line_number << ": the shared memory name is already used: " << config.shm_name << endl;
+            return false;
+        }
+        stations.push_back(config);
+    }
+
+    if (stations.empty()) {
+        cout << "No stations in the file: " << filename << endl;
+        return false;
+    }
+    return true;
+}
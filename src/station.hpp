@@ -0,0 +1,141 @@
+/* Copyright (c) 2013-2018 Ardexa Pty Ltd. All rights reserved.
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+#ifndef STATION_HPP_INCLUDED
+#define STATION_HPP_INCLUDED
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <stdint.h>
+#include "configs.hpp"
+#include "arguments.hpp"
+#include "loop_parser.hpp"
+#include "log_writer.hpp"
+#include "timestamp.hpp"
+#include "discovery.hpp"
+#include "aggregator.hpp"
+#include "frame_ring.hpp"
+#include "shared_latest.hpp"
+#include "metrics.hpp"
+#include "histogram.hpp"
+#include "capture.hpp"
+
+using namespace std;
+
+/* The device, logging directory and calibration of one Davis console. The device is a /dev device, or
+   "usb:<serial>" for the Davis USB adaptor with that serial number (which doesn't change when it is plugged in
+   somewhere else, and is found through the device_discovery cache) */
+typedef struct station_config_s {
+    string device;
+    string directory;
+    float barocal;
+    bool wdspd_kmh;
+    bool winddir_180;
+    bool loop2;
+    bool binary;
+    bool blocks;
+    bool capture;
+    float interval;
+    vector<int> aggregate_minutes;
+    string shm_name;
+} station_config_t;
+
+enum station_state_t {
+    STATION_CLOSED,     /* Waiting to open the device (again) */
+    STATION_WAKING,     /* Sending the LF that wakes the console, and waiting for its LF CR answer */
+    STATION_STREAMING   /* An LPS command has been sent, and LOOP packets are arriving */
+};
+
+/* This class streams LOOP packets from one Davis console and logs them, as run_daemon() did for a single console.
+   Nothing in it blocks, so one event loop can drive many of them: the device is opened non-blocking and added to
+   the epoll set, on_event() is called when data arrives and on_timer() when next_due_ms() is reached.
+   The packets aren't logged by the event loop's thread. on_event() puts them in the frame_ring, and the thread
+   emptying the ring calls handle_frame() and flush_logs(), so the reads never wait for the disk. The device and
+   parser belong to the first thread, and the decoded data and logs to the second */
+class station
+{
+    public:
+        /* methods are public */
+        station(const station_config_t &config, arguments &arguments_list, int epoll_filedesc, device_discovery *discovery, frame_ring *ring);
+        ~station();
+        void on_event(uint32_t events);
+        void on_timer(int64_t now_ms);
+        bool on_device_event(const usb_event_t &event, int64_t now_ms);
+        void set_reopen_time(int seconds);
+        int64_t next_due_ms();
+        void stop();
+        void handle_frame(const frame_slot_t &slot);
+        void flush_logs(bool all);
+        void print_statistics();
+        void register_metrics(metrics_registry &registry);
+        const stage_stats &get_stats();
+
+    private:
+        /* members are private */
+        bool open_device(int64_t now_ms);
+        void close_device(int64_t now_ms);
+        void start_waking(int64_t now_ms);
+        void start_streaming(int64_t now_ms);
+        void log_result(const receive_stamp_t &stamp);
+        void log_aggregates(const receive_stamp_t &stamp);
+        station_config_t config;
+        bool debug;
+        int epoll_filedesc;
+        device_discovery *discovery;
+        frame_ring *ring;
+        int64_t reopen_ms;
+        int filedesc;
+        string device;
+        station_state_t state;
+        int64_t due_ms;
+        int wakes_sent;
+        unsigned char previous_byte;
+        int64_t waking_ns;
+        int64_t command_ns;
+        int64_t frame_start_ns;
+        bool ack_pending;
+        bool first_byte_pending;
+        int packets_remaining;
+        int64_t last_received_ms;
+        int64_t next_log_ms;
+        int64_t last_packet_ns;
+        int log_type;
+        loop_parser parser;
+        davis_data_t davis_data;
+        datetime_formatter formatter;
+        log_writer writer;
+        shared_latest latest;
+        aggregator *aggregates;
+        log_writer *aggregate_writer;
+        int64_t next_aggregate_ms;
+        capture_writer *capture_log;
+        stage_stats stats;
+        metric_counter state_metric;
+        metric_counter bytes_read;
+        metric_counter read_errors;
+        metric_counter wakeups;
+        metric_counter wakeup_timeouts;
+        metric_counter stalls;
+        metric_counter reopens;
+        metric_counter dropped;
+        metric_counter packets[2];
+        deque<metric_counter> invalid_fields[2];
+};
+
+bool read_stations(string filename, arguments &arguments_list, vector<station_config_t> &stations);
+station_config_t station_from_arguments(arguments &arguments_list, string device, string directory);
+string station_shm_name(arguments &arguments_list, string directory);
+
+#endif /* STATION_HPP_INCLUDED */
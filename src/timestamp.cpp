@@ -0,0 +1,173 @@
+/* Copyright (c) 2013-2018 Ardexa Pty Ltd. All rights reserved.
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+#include <string.h>
+#include <stdio.h>
+#include "timestamp.hpp"
+
+/* Stamp a packet with both clocks */
+receive_stamp_t stamp_now()
+{
+    struct timespec realtime;
+    receive_stamp_t stamp;
+
+    clock_gettime(CLOCK_REALTIME, &realtime);
+    stamp.realtime_ns = (int64_t) realtime.tv_sec * 1000000000 + realtime.tv_nsec;
+    stamp.monotonic_ns = monotonic_now_ns();
+
+    return stamp;
+}
+
+/* The monotonic clock, in nanoseconds */
+int64_t monotonic_now_ns()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/* The monotonic clock, in milliseconds */
+int64_t monotonic_now_ms()
+{
+    return monotonic_now_ns() / 1000000;
+}
+
+/* The local day of 'timestamp_ms', as YYYYMMDD. 'start_ms' and 'end_ms' are set to the start of the day and of the
+   next day, which are 23 or 25 hours apart when daylight saving starts or ends */
+uint32_t local_day(int64_t timestamp_ms, int64_t *start_ms, int64_t *end_ms)
+{
+    struct tm timeinfo;
+    time_t seconds = (time_t) (timestamp_ms / 1000);
+
+    localtime_r(&seconds, &timeinfo);
+    uint32_t date = (timeinfo.tm_year + 1900) * 10000 + (timeinfo.tm_mon + 1) * 100 + timeinfo.tm_mday;
+    timeinfo.tm_hour = 0;
+    timeinfo.tm_min = 0;
+    timeinfo.tm_sec = 0;
+    timeinfo.tm_isdst = -1;
+    *start_ms = (int64_t) mktime(&timeinfo) * 1000;
+    timeinfo.tm_mday++;
+    timeinfo.tm_isdst = -1;
+    *end_ms = (int64_t) mktime(&timeinfo) * 1000;
+
+    return date;
+}
+
+/* Write a day from local_day() as "YYYY-MM-DD", as in the names of the daily files */
+void date_string(uint32_t date, char *buffer, size_t size)
+{
+    snprintf(buffer, size, "%04u-%02u-%02u", date / 10000, (date / 100) % 100, date % 100);
+}
+
+/* Write 'value' as 'count' digits */
+static void put_digits(char *out, int value, int count)
+{
+    for (int i = count - 1; i >= 0; i--) {
+        out[i] = '0' + value % 10;
+        value /= 10;
+    }
+}
+
+/* Constructor for the datetime_formatter class */
+datetime_formatter::datetime_formatter()
+{
+    this->window_start = 0;
+    this->window_end = 0;
+    this->offset = 0;
+    this->last_second = -1;
+    memset(this->zone, 0, sizeof(this->zone));
+    memset(this->last_text, 0, sizeof(this->last_text));
+}
+
+/* Look up the date and UTC offset for the 15 minutes that 'seconds' is in */
+void datetime_formatter::load_window(int64_t seconds)
+{
+    struct tm timeinfo;
+    time_t start = (time_t) (seconds - seconds % DATETIME_WINDOW);
+
+    localtime_r(&start, &timeinfo);
+    this->offset = (int32_t) timeinfo.tm_gmtoff;
+    this->window_start = start;
+    this->window_end = start + DATETIME_WINDOW;
+
+    /* An offset that isn't a whole number of 15 minutes (only seen in old local mean times) could move the date
+       within the window. Then the window is just this second */
+    if ((this->offset % DATETIME_WINDOW) != 0) {
+        time_t now = (time_t) seconds;
+        localtime_r(&now, &timeinfo);
+        this->offset = (int32_t) timeinfo.tm_gmtoff;
+        this->window_start = seconds;
+        this->window_end = seconds + 1;
+    }
+
+    /* The date, which is the same for the whole window */
+    strftime(this->last_text, sizeof(this->last_text), "%Y-%m-%dT", &timeinfo);
+
+    int offset_minutes = this->offset / 60;
+    this->zone[0] = (offset_minutes < 0) ? '-' : '+';
+    if (offset_minutes < 0) offset_minutes = -offset_minutes;
+    put_digits(&this->zone[1], offset_minutes / 60, 2);
+    put_digits(&this->zone[3], offset_minutes % 60, 2);
+}
+
+/* Write 'realtime_ns' as a local date-time into 'buffer', which must be at least DATETIME_SIZE bytes. The UTC offset
+   (in seconds) is put in 'utc_offset'. Returns the length */
+size_t datetime_formatter::format(char *buffer, int64_t realtime_ns, int32_t *utc_offset)
+{
+    int64_t seconds = realtime_ns / 1000000000;
+    int millis = (int) ((realtime_ns % 1000000000) / 1000000);
+    if (millis < 0) {
+        seconds--;
+        millis += 1000;
+    }
+
+    if (seconds != this->last_second) {
+        if ((seconds < this->window_start) or (seconds >= this->window_end)) {
+            this->load_window(seconds);
+        }
+        /* The date stays, and the time of day is put after it */
+        int local = (int) (((seconds + this->offset) % 86400 + 86400) % 86400);
+        put_digits(&this->last_text[11], local / 3600, 2);
+        this->last_text[13] = ':';
+        put_digits(&this->last_text[14], (local / 60) % 60, 2);
+        this->last_text[16] = ':';
+        put_digits(&this->last_text[17], local % 60, 2);
+        this->last_second = seconds;
+    }
+
+    memcpy(buffer, this->last_text, sizeof(this->last_text));
+    buffer[19] = '.';
+    put_digits(&buffer[20], millis, 3);
+    memcpy(&buffer[23], this->zone, sizeof(this->zone));
+    buffer[28] = '\0';
+
+    *utc_offset = this->offset;
+    return 28;
+}
+
+/* The UTC offset (in seconds) at 'realtime_ns', without formatting it */
+int32_t datetime_formatter::utc_offset(int64_t realtime_ns)
+{
+    int64_t seconds = realtime_ns / 1000000000;
+    if ((realtime_ns % 1000000000) < 0) {
+        seconds--;
+    }
+
+    if ((seconds < this->window_start) or (seconds >= this->window_end)) {
+        this->load_window(seconds);
+        /* The new window's date has replaced the text of the last second */
+        this->last_second = -1;
+    }
+    return this->offset;
+}
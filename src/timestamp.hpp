@@ -0,0 +1,64 @@
+/* Copyright (c) 2013-2018 Ardexa Pty Ltd. All rights reserved.
+ *
+ * This code is licensed under the MIT License (MIT).
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+
+#ifndef TIMESTAMP_HPP_INCLUDED
+#define TIMESTAMP_HPP_INCLUDED
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+
+using namespace std;
+
+#define DATETIME_SIZE 32          /* "YYYY-MM-DDTHH:MM:SS.mmm+hhmm", and the null */
+#define DATETIME_WINDOW 900       /* In seconds. Time zone changes only happen on a 15 minute boundary */
+
+/* The time a packet was received, taken as soon as the read() that completed it returned. 'realtime_ns' is the
+   wall clock, in nanoseconds since the epoch (UTC). 'monotonic_ns' isn't changed when the clock is set, so it is
+   the one to use for intervals and jitter */
+struct receive_stamp_t {
+    int64_t realtime_ns;
+    int64_t monotonic_ns;
+};
+
+receive_stamp_t stamp_now();
+int64_t monotonic_now_ns();
+int64_t monotonic_now_ms();
+uint32_t local_day(int64_t timestamp_ms, int64_t *start_ms, int64_t *end_ms);
+void date_string(uint32_t date, char *buffer, size_t size);
+
+/* This class formats times as local date-times with milliseconds and the UTC offset, such as
+   "2017-01-30T15:30:45.250+1000". localtime_r() is only called once for each 15 minutes: the date and UTC offset
+   can't change within one, so the time of day is worked out from the offset. The text up to the seconds is also
+   kept, until the second changes */
+class datetime_formatter
+{
+    public:
+        /* methods are public */
+        datetime_formatter();
+        size_t format(char *buffer, int64_t realtime_ns, int32_t *utc_offset);
+        int32_t utc_offset(int64_t realtime_ns);
+
+    private:
+        /* members are private */
+        void load_window(int64_t seconds);
+        int64_t window_start;
+        int64_t window_end;
+        int32_t offset;
+        char zone[5];
+        int64_t last_second;
+        char last_text[19];
+};
+
+#endif /* TIMESTAMP_HPP_INCLUDED */
@@ -12,90 +12,8 @@
  */
 
 #include "utils.hpp"
-
-/* Open the file where the log entry will be written, and write the line to it 
-   When using this function, make sure 'line' and 'header' have a newline at end 
-   If the 'rotate' is true, it will move thew old file and file instead of appending 
-	If the 'log_to_latest' it will also log a line to 'latest.csv' in 'directory' 
-*/
-int log_line(string directory, string filename, string line, string header, bool log_to_latest)
-{
-	struct stat st_directory;
-	string fullpath;
-	bool write_header = false;
-	/* if the log directory does not exist, or the log file does not exist, then declare a 'rotation'.
-	   This is where the 'latest.csv' file is renamed and a new one created */
-	bool rotate = false;
-
-	/* Add an ending '/' to the directory path, if it doesn't exist */
-	if (*directory.rbegin() != '/') {
-		directory += "/";
-	}
-
-	/* Check and create the directory if necessary */
-	if (stat(directory.c_str(), &st_directory) == -1) {
-		if (g_debug > 0) cout << "Directory doesn't exist. Creating it: " << directory.c_str() << endl;
-		rotate = true;
-		bool result = create_directory(directory);
-		if (!result) {
-			return 2;
-		}
-	}
-
-	fullpath = directory + filename;
-	if (g_debug > 1) cout << "Full filename: " << fullpath << endl;
-
-	/* Check the full path. If it doesn't exist, the header line will need to be written 
-		If the file DOES exist AND if a rotation is called, then rename it and annotate a header is required 
-      And the rotate will need to be set to true 
-   */
-	if (stat(fullpath.c_str(), &st_directory) == -1) {
-		if (g_debug > 1) cout << "Fullpath doesn't exist. Path: " << fullpath.c_str() << endl;
-		write_header = true;
-		rotate = true;
-	}
-
-	/* Open it for appending data only */
-	ofstream writer(fullpath.c_str(), ios::app);
-	if(!writer) {
-		if (g_debug > 0) cout << "Cannot open logging file: " << fullpath << endl;
-		return 2;
-	}
-	if (write_header) {
-		writer << header << endl;
-	}
-
-	writer << line << endl;
- 	writer.close();
-
-	write_header = false;
-	/* If 'log_to_latest' is set, then write the line to this file as well */
-	if (log_to_latest) {
-		/* if file exists and rotate is declared, rename it and create a new one */
-		fullpath = directory + "latest.csv";
-		if (rotate) {
-			string newpath = directory + "latest.csv.OLD";
-			rename(fullpath.c_str(), newpath.c_str());
-			write_header = true;
-		}
-
-		/* Open it for appending data only */
-		ofstream latest(fullpath.c_str(), ios::app);
-		if(!latest) {
-			if (g_debug > 0) cout << "Cannot open logging file: " << fullpath << endl;
-			return 3;
-		}
-		if (write_header) {
-			latest << header << endl;
-		}
-		latest << line << endl;
-
-		/* close it */
-		latest.close();
-	}	
-
-	return 0;
-}
+#include "field_decoder.hpp"
+#include <type_traits>
 
 /* Create a directory, including all parent paths if they don't exist */
 bool create_directory(string directory)
@@ -203,51 +121,30 @@ string trim_whitespace(string raw_string) {
 }
 
 
-/* Returns the current date as a string in the format "2017-01-30" */
-string get_current_date()
-{
-    time_t rawtime;
-    struct tm * timeinfo;
-    char buffer[DATESIZE];
-
-    time(&rawtime);
-    timeinfo = localtime(&rawtime);
-
-    strftime(buffer, sizeof(buffer), "%Y-%m-%d", timeinfo);
-
-    string date(buffer);
-    return date;
-}
-
-/* Returns the current time as a string, in the format "2017-01-30T15:30:45" */
-string get_current_datetime()
+/* Returns the header line for the log files */
+string header_line(bool wdspd_kmh, bool loop2)
 {
-    time_t rawtime;
-    struct tm * timeinfo;
-    char buffer[DATESIZE];
-
-    time(&rawtime);
-    timeinfo = localtime(&rawtime);
-
-    /* This includes the time zone at the end of the time */
-    strftime(buffer, DATESIZE, "%H:%M:%S%z", timeinfo);
-
-    string time(buffer);
+    string header;
 
-    string datetime = get_current_date() + "T" + time;
-
-    return datetime;
+    if (wdspd_kmh) {
+        header = HEADER_LINE_KMH;
+        if (loop2) header += HEADER_LOOP2_KMH;
+    }
+    else {
+        header = HEADER_LINE;
+        if (loop2) header += HEADER_LOOP2;
+    }
+    return header;
 }
 
 /*  This function checks for the existence of a PID file. If one is
     found, it checks if the process is alive and exits if so. Otherwise,
     it will (re)write the PID file. */
-bool check_pid_file()
+bool check_pid_file(string pid_file)
 {
     /* Check to see if there is a pid file */
     bool pid_file_exists = true;
     struct stat pid_status;
-    string pid_file = PID_FILE;
     string pid_str, pid_raw;
     long pid_long;
 
@@ -286,10 +183,9 @@ bool check_pid_file()
 }
 
 /* remove a PID file */
-void remove_pid_file()
+void remove_pid_file(string pid_file)
 {
     struct stat pid_status;
-    string pid_file = PID_FILE;
 
     /* if the file exists, then remove it */
     if (stat(pid_file.c_str(), &pid_status) == 0) {
@@ -309,327 +205,351 @@ bool check_root()
 	}
 }
 
-/* This function extracts the results, and returns a string */
-string extract_results(char *input_buffer, int chars_received, bool debug, bool wdspd_kmh, float barocal, bool winddir_180)
+/* Set all the davis_data members to error values */
+void clear_davis_data(davis_data_t *davis_data)
+{
+    davis_data->inside_humidity = ERROR_VALUE_FLOAT;
+    davis_data->outside_humidity = ERROR_VALUE_FLOAT;
+    davis_data->wind_speed = ERROR_VALUE_FLOAT;
+    davis_data->barometer = ERROR_VALUE_FLOAT;
+    davis_data->outside_temperature = ERROR_VALUE_FLOAT;
+    davis_data->inside_temperature = ERROR_VALUE_FLOAT;
+    davis_data->rain = ERROR_VALUE_FLOAT;
+    davis_data->UV = ERROR_VALUE_FLOAT;
+    davis_data->solar_radiation = ERROR_VALUE_FLOAT;
+    davis_data->console_battery = ERROR_VALUE_FLOAT;
+    davis_data->wind_direction = ERROR_VALUE_FLOAT;
+    davis_data->soil_temp1 = ERROR_VALUE_FLOAT;
+    davis_data->soil_moist1 = ERROR_VALUE_FLOAT;
+    davis_data->soil_temp2 = ERROR_VALUE_FLOAT;
+    davis_data->soil_moist2 = ERROR_VALUE_FLOAT;
+    davis_data->soil_temp3 = ERROR_VALUE_FLOAT;
+    davis_data->soil_moist3 = ERROR_VALUE_FLOAT;
+    davis_data->soil_temp4 = ERROR_VALUE_FLOAT;
+    davis_data->soil_moist4 = ERROR_VALUE_FLOAT;
+    davis_data->wind_avg_10min = ERROR_VALUE_FLOAT;
+    davis_data->wind_avg_2min = ERROR_VALUE_FLOAT;
+    davis_data->wind_gust_10min = ERROR_VALUE_FLOAT;
+    davis_data->wind_gust_direction = ERROR_VALUE_FLOAT;
+    davis_data->dew_point = ERROR_VALUE_FLOAT;
+    davis_data->heat_index = ERROR_VALUE_FLOAT;
+    davis_data->wind_chill = ERROR_VALUE_FLOAT;
+    davis_data->thsw = ERROR_VALUE_FLOAT;
+}
+
+/* This function extracts the results from a whole LOOP or LOOP2 packet, as assembled by the loop_parser class.
+   Only the members in that type of packet are updated. Returns the packet type, or -1 if it is not known */
+int extract_results(const unsigned char *packet, davis_data_t *davis_data, bool debug, bool wdspd_kmh, float barocal, bool winddir_180)
 {
-    davis_data_t davis_data;
-
-    /* Set all the Davis_data members to error values */
-    davis_data.inside_humidity = ERROR_VALUE_FLOAT;
-    davis_data.outside_humidity = ERROR_VALUE_FLOAT;
-    davis_data.wind_speed = ERROR_VALUE_FLOAT;
-    davis_data.barometer = ERROR_VALUE_FLOAT;
-    davis_data.outside_temperature = ERROR_VALUE_FLOAT;
-    davis_data.inside_temperature = ERROR_VALUE_FLOAT;
-    davis_data.rain = ERROR_VALUE_FLOAT;
-    davis_data.UV = ERROR_VALUE_FLOAT;
-    davis_data.solar_radiation = ERROR_VALUE_FLOAT;
-    davis_data.console_battery = ERROR_VALUE_FLOAT;
-    davis_data.wind_direction = ERROR_VALUE_FLOAT;
-    davis_data.soil_temp1 = ERROR_VALUE_FLOAT;
-    davis_data.soil_moist1 = ERROR_VALUE_FLOAT;
-    davis_data.soil_temp2 = ERROR_VALUE_FLOAT;
-    davis_data.soil_moist2 = ERROR_VALUE_FLOAT;
-    davis_data.soil_temp3 = ERROR_VALUE_FLOAT;
-    davis_data.soil_moist3 = ERROR_VALUE_FLOAT;
-    davis_data.soil_temp4 = ERROR_VALUE_FLOAT;
-    davis_data.soil_moist4 = ERROR_VALUE_FLOAT;
-
-    if (debug) cout << "Chars received = " << chars_received << endl;
-    for (int i = 0; i < chars_received; i++) {
-        /* The start of a valid line is 'LOO' */
-        /* Check that there at least 88 chars after 'i' before proceeding */
-        if ((input_buffer[i] == 'L') && (input_buffer[i+1] == 'O') && (input_buffer[i+2] == 'O') && (chars_received - i >= 89)) {
-            if (debug) cout << "Found LOO at offset: " << i << " Val: " << input_buffer[i] << input_buffer[i+1] << input_buffer[i+2] << endl;
-
-            /* Call in the data. For sanity checking this is the plan:
-            If any of the values below are DUD, I don't want to invalidate the whole line.
-            So any parameters below which *appear* to be obviously invalid, will be replaced with the value ERROR_VALUE_FLOAT
-            An error condition will then flagged which will then be sent to the log */
-            if (debug) cout << "Raw barometer offset 7 and 8: " << input_buffer[i+7] << input_buffer[i+8] << endl;
-            /* convert inches of mercury to hectopascals */
-            davis_data.barometer = (float) ((input_buffer[i+8] << 8) | input_buffer[i+7])/1000 * 33.86;
-            if ((davis_data.barometer < 800.0) || (davis_data.barometer > 1100.0)) {
-                davis_data.barometer = ERROR_VALUE_FLOAT;
-            }
-            /* calibrate the barometer */
-            if (debug) {
-                cout << "\t Barometer uncalibrated (hectopascals): " << davis_data.barometer << endl;
-            }
-            davis_data.barometer = davis_data.barometer * barocal;
-            if (debug) {
-                cout << "\t Barometer (hectopascals): " << davis_data.barometer << endl;
-                cout << "\t Baro calibration value: " << barocal << endl;
-            }
-
-            if (debug) cout << "Raw outside temp offset 12 and 13: " << input_buffer[i+12] << input_buffer[i+13] << endl;
-            /* convert Fahrenheit to Celsius */
-            davis_data.outside_temperature =   (( (float) ((input_buffer[i+13] << 8) | input_buffer[i+12])/10) - 32.0) * 5/9;
-            if ((davis_data.outside_temperature < -80.0) || (davis_data.outside_temperature > 100.0)) {
-                davis_data.outside_temperature = ERROR_VALUE_FLOAT;
-            }
-            if (debug) cout << "\tOutside temperature (celsius): " << davis_data.outside_temperature << endl;
-
-            if (debug) cout << "Raw inside temp offset 9 and 10: " << input_buffer[i+9] << input_buffer[i+10] << endl;
-            /* convert Fahrenheit to Celsius */
-            davis_data.inside_temperature =   (((float) ((input_buffer[i+10] << 8) | input_buffer[i+9])/10) - 32.0) * 5/9;
-            if ((davis_data.inside_temperature < -80.0) || (davis_data.inside_temperature > 100.0)) {
-                davis_data.inside_temperature = ERROR_VALUE_FLOAT;
-            }
-            if (debug) cout << "\tInside temperature (Celsius): " << davis_data.inside_temperature << endl;
-
-            if (debug) cout << "Raw wind speed offset 14: " << input_buffer[i+14] << endl;
-            /* convert mph to metres/s */
-            davis_data.wind_speed = (float) (input_buffer[i+14] * 0.44704);
-            if ( (davis_data.wind_speed < 0.0) || (davis_data.wind_speed > 50.0)) {
-                davis_data.wind_speed = ERROR_VALUE_FLOAT;
-            }
-            else {
-                /* Convert the wind speed from m/s to km/h if requested by the user */
-                if (wdspd_kmh) {
-                    davis_data.wind_speed = davis_data.wind_speed * MS_TO_KMH;
-                    if (debug) cout << "\tWind speed (km/h): " << davis_data.wind_speed << endl;
-                }
-                else {
-                    if (debug) cout << "\tWind speed (m/s): " << davis_data.wind_speed << endl;
-                }
-            }
-
-            if (debug) cout << "Raw wind direction offset 16 and 17: " << input_buffer[i+16] << input_buffer[i+17] << endl;
-            davis_data.wind_direction = (float) ((input_buffer[i+17] << 8) | input_buffer[i+16]);
-
-            /* Alter the wind direction by 180 degs, if required */
-            if (winddir_180) {
-                davis_data.wind_direction = davis_data.wind_direction + 180.0;
-                if (davis_data.wind_direction > 360.0) {
-                    davis_data.wind_direction = davis_data.wind_direction - 360.0;
-                }
-            }
-            if ( (davis_data.wind_direction < 0.0) || (davis_data.wind_direction > 360.0)) {
-                davis_data.wind_direction = ERROR_VALUE_FLOAT;
-            }
-            if (debug) cout << "\tWind direction (degs): " << davis_data.wind_direction << endl;
-
-            if (debug) cout << "Raw outside humidity offset 33: " << input_buffer[i+33] << endl;
-            davis_data.outside_humidity = (float) (input_buffer[i+11]);
-            if ((davis_data.outside_humidity < 0.0) || (davis_data.outside_humidity > 100.0)) {
-                davis_data.outside_humidity = ERROR_VALUE_FLOAT;
-            }
-            if (debug) cout << "\tOutside humidity (%): " << davis_data.outside_humidity << endl;
-
-            if (debug) cout << "Raw inside humidity offset 11: " << input_buffer[i+11] << endl;
-            davis_data.inside_humidity = (float) (input_buffer[i+33]);
-            if ((davis_data.inside_humidity < 0.0) || (davis_data.inside_humidity > 100.0)) {
-                davis_data.inside_humidity = ERROR_VALUE_FLOAT;
-            }
-            if (debug) cout << "\tInside humidity (%): " << davis_data.inside_humidity << endl;
-
-            /* Part of the DAVIS protocol doc says UV is read directly, and another section says to divide by 10
-               Correct value seems to be if the raw index is divided by 10. */
-            if (debug) cout << "Raw UV offset 43: "<< input_buffer[i+43]<< endl;
-            davis_data.UV = (float) (input_buffer[i+43])/10;
-            if ((davis_data.UV < 0.0) || (davis_data.UV > 50.0)) {
-                davis_data.UV = ERROR_VALUE_FLOAT;
-            }
-            if (debug) cout << "\tUV index: " << davis_data.UV << endl;
-
-            if (debug) cout << "Raw solar radiation offset 44 and 45: " << input_buffer[i+44] << input_buffer[i+45] << endl;
-            davis_data.solar_radiation =  (float) ((input_buffer[i+45] << 8) | input_buffer[i+44]);
-            if ((davis_data.solar_radiation < 0.0) || (davis_data.solar_radiation > 1800.0)) {
-                davis_data.solar_radiation = ERROR_VALUE_FLOAT;
-            }
-            if (debug) cout << "\tSolar radiation (W/m): " << davis_data.solar_radiation << endl;
-
-            if (debug) cout << "Raw console battery voltage offset 87 and 88: " << input_buffer[i+87] << input_buffer[i+88] << endl;
-            /*  Convert to volts. The formula  is directly from the Davis 'Vantage Pro ® , Vantage Pro2 TM and Vantage Vue ®
-                Serial Communication Reference Manual'
-                Voltage = ((Data * 300)/512)/100.0 */
-            davis_data.console_battery =  (((float) ((input_buffer[i+88] << 8) | input_buffer[i+87])*300)/512)/100.0;
-            if ((davis_data.console_battery < -10.0) || (davis_data.console_battery > 50.0)) {
-                davis_data.console_battery = ERROR_VALUE_FLOAT;
-            }
-            if (debug) cout << "\tConsole battery (volts): " << davis_data.console_battery << endl;
-
-            if (debug) cout << "Raw rain offset 46 and 47: " << input_buffer[i+41] << input_buffer[i+42] << endl;
-            /* Nothing in the documentation about reading this figure, but to get it to mm/hr, appears the figure needs to be divided by 4 */
-            davis_data.rain = ((float) ((input_buffer[i+47] << 8) | input_buffer[i+46])*0.25);
-            if ((davis_data.rain < 0.0) || (davis_data.rain > 300.0)) {
-                davis_data.rain = ERROR_VALUE_FLOAT;
-            }
-            if (debug) cout << "\tRain (mm/hr): " << davis_data.rain << endl;
-
-            /* Soil temperature 1 reading...NB A special Davis device is required to read this */
-            if (debug) cout << "Soil temperature 1 offset 25: " << input_buffer[i+25] << endl;
-            davis_data.soil_temp1 = (((float) (input_buffer[i+25]) + -90) - 32.0) * 5/9;
-            if (debug) cout << "\tSoil temperature 1 (Celsius): " << davis_data.soil_temp1 << endl;
-
-            /* Soil Moisture 1 */
-            if (debug) cout << "Soil moisture 1 offset 62: " << input_buffer[i+62] << endl;
-            davis_data.soil_moist1 = (float) (input_buffer[i+62]);
-            if (debug) cout << "\tSoil moisture 1 (Centibar): " << davis_data.soil_moist1 << endl;
-
-            /* Soil temperature 2 reading...NB A special Davis device is required to read this */
-            if (debug) cout << "Soil temperature 2 offset 26: " << input_buffer[i+26] << endl;
-            davis_data.soil_temp2 = (((float) (input_buffer[i+26]) + -90) - 32.0) * 5/9;
-            if (debug) cout << "\tSoil temperature 2 (Celsius): " << davis_data.soil_temp2 << endl;
-
-            /* Soil Moisture 2 */
-            if (debug) cout << "Soil moisture 2 offset 63: " << input_buffer[i+63] << endl;
-            davis_data.soil_moist2 = (float) (input_buffer[i+63]);
-            if (debug) cout << "\tSoil moisture 2 (Centibar): " << davis_data.soil_moist2 << endl;
-
-            /* Soil temperature 3 reading...NB A special Davis device is required to read this */
-            if (debug) cout << "Soil temperature 3 offset 27: " << input_buffer[i+27] << endl;
-            davis_data.soil_temp3 = (((float) (input_buffer[i+27]) + -90) - 32.0) * 5/9;
-            if (debug) cout << "\tSoil temperature 3 (Celsius): " << davis_data.soil_temp3 << endl;
-
-            /* Soil Moisture 3 */
-            if (debug) cout << "Soil moisture 3 offset 64: " << input_buffer[i+64] << endl;
-            davis_data.soil_moist3 = (float) (input_buffer[i+64]);
-            if (debug) cout << "\tSoil moisture 3 (Centibar): " << davis_data.soil_moist3 << endl;
-
-            /* Soil temperature 4 reading...NB A special Davis device is required to read this */
-            if (debug) cout << "Soil temperature 4 offset 28: " << input_buffer[i+28] << endl;
-            davis_data.soil_temp4 = (((float) (input_buffer[i+28]) + -90) - 32.0) * 5/9;
-            if (debug) cout << "\tSoil temperature 4 (Celsius): " << davis_data.soil_temp3 << endl;
-
-            /* Soil Moisture 4 */
-            if (debug) cout << "Soil moisture 4 offset 65: " << input_buffer[i+65] << endl;
-            davis_data.soil_moist4 = (float) (input_buffer[i+65]);
-            if (debug) cout << "\tSoil moisture 4 (Centibar): " << davis_data.soil_moist4 << endl;
-
-            /* The data has been read, exit the for loop */
-            break;
+    int packet_type = packet[LOOP_TYPE_OFFSET];
+
+    if (packet_type == LOOP_TYPE) {
+        decode_loop(packet, *davis_data, debug, wdspd_kmh, barocal, winddir_180);
+    }
+    else if (packet_type == LOOP2_TYPE) {
+        decode_loop2(packet, *davis_data, debug, wdspd_kmh, winddir_180);
+    }
+    else {
+        if (debug) cout << "Unknown LOOP packet type: " << packet_type << endl;
+        return -1;
+    }
+
+    return packet_type;
+}
+
+/* The soil temperatures are in whole degrees Fahrenheit + 90, and the soil moistures in centibars. 255 is dashed.
+   These are looked up, rather than converted, for each raw byte */
+static struct soil_tables_t {
+    float temperature[256];
+    float moisture[256];
+
+    soil_tables_t()
+    {
+        for (int raw = 0; raw < 256; raw++) {
+            this->temperature[raw] = (raw == 255) ? ERROR_VALUE_FLOAT : (((float) raw - 90) - 32.0) * 5/9;
+            this->moisture[raw] = (raw == 255) ? ERROR_VALUE_FLOAT : (float) raw;
         }
     }
+} soil_tables;
+
+/* The layout of a LOOP packet. See the Davis 'Vantage Pro, Vantage Pro2 and Vantage Vue Serial Communication Reference
+   Manual'. Temperatures are in 0.1 degrees Fahrenheit, and wind speeds in mph. The barometer is in 0.001 inches of
+   mercury, and is converted to hectopascals. The console battery voltage is ((Data * 300)/512)/100.0. Part of the
+   DAVIS protocol doc says UV is read directly, and another section says to divide by 10. Correct value seems to be
+   if the raw index is divided by 10. Nothing in the documentation about reading the rain, but to get it to mm/hr,
+   appears the figure needs to be divided by 4. NB A special Davis device is required to read the soil values */
+static constexpr field_t loop_fields[] = {
+    /* name                    unit            member                                offset width      scale               bias            minimum     maximum     dashed     adjust             table */
+    {"Barometer",              "hectopascals", &davis_data_t::barometer,             7,     FIELD_U16, 33.86/1000,         0.0,            800.0,      1100.0,     NO_DASHED, ADJUST_BAROMETER,  NULL},
+    {"Outside temperature",    "celsius",      &davis_data_t::outside_temperature,   12,    FIELD_S16, 0.1 * 5/9,          -32.0 * 5/9,    -80.0,      100.0,      32767,     ADJUST_NONE,       NULL},
+    {"Inside temperature",     "celsius",      &davis_data_t::inside_temperature,    9,     FIELD_S16, 0.1 * 5/9,          -32.0 * 5/9,    -80.0,      100.0,      32767,     ADJUST_NONE,       NULL},
+    {"Wind speed",             "m/s",          &davis_data_t::wind_speed,            14,    FIELD_U8,  0.44704,            0.0,            0.0,        50.0,       255,       ADJUST_WIND_SPEED, NULL},
+    {"Wind direction",         "degrees",      &davis_data_t::wind_direction,        16,    FIELD_U16, 1.0,                0.0,            0.0,        360.0,      NO_DASHED, ADJUST_DIRECTION,  NULL},
+    {"Outside humidity",       "percent",      &davis_data_t::outside_humidity,      33,    FIELD_U8,  1.0,                0.0,            0.0,        100.0,      255,       ADJUST_NONE,       NULL},
+    {"Inside humidity",        "percent",      &davis_data_t::inside_humidity,       11,    FIELD_U8,  1.0,                0.0,            0.0,        100.0,      255,       ADJUST_NONE,       NULL},
+    {"UV index",               "index",        &davis_data_t::UV,                    43,    FIELD_U8,  0.1,                0.0,            0.0,        50.0,       255,       ADJUST_NONE,       NULL},
+    {"Solar radiation",        "W/m^2",        &davis_data_t::solar_radiation,       44,    FIELD_U16, 1.0,                0.0,            0.0,        1800.0,     32767,     ADJUST_NONE,       NULL},
+    {"Console battery",        "volts",        &davis_data_t::console_battery,       87,    FIELD_U16, 300.0/512/100,      0.0,            -10.0,      50.0,       NO_DASHED, ADJUST_NONE,       NULL},
+    {"Rain",                   "mm/hr",        &davis_data_t::rain,                  46,    FIELD_U16, 0.25,               0.0,            0.0,        300.0,      NO_DASHED, ADJUST_NONE,       NULL},
+    {"Soil temperature 1",     "celsius",      &davis_data_t::soil_temp1,            25,    FIELD_U8,  1.0,                0.0,            NO_MINIMUM, NO_MAXIMUM, NO_DASHED, ADJUST_NONE,       soil_tables.temperature},
+    {"Soil moisture 1",        "centibar",     &davis_data_t::soil_moist1,           62,    FIELD_U8,  1.0,                0.0,            NO_MINIMUM, NO_MAXIMUM, NO_DASHED, ADJUST_NONE,       soil_tables.moisture},
+    {"Soil temperature 2",     "celsius",      &davis_data_t::soil_temp2,            26,    FIELD_U8,  1.0,                0.0,            NO_MINIMUM, NO_MAXIMUM, NO_DASHED, ADJUST_NONE,       soil_tables.temperature},
+    {"Soil moisture 2",        "centibar",     &davis_data_t::soil_moist2,           63,    FIELD_U8,  1.0,                0.0,            NO_MINIMUM, NO_MAXIMUM, NO_DASHED, ADJUST_NONE,       soil_tables.moisture},
+    {"Soil temperature 3",     "celsius",      &davis_data_t::soil_temp3,            27,    FIELD_U8,  1.0,                0.0,            NO_MINIMUM, NO_MAXIMUM, NO_DASHED, ADJUST_NONE,       soil_tables.temperature},
+    {"Soil moisture 3",        "centibar",     &davis_data_t::soil_moist3,           64,    FIELD_U8,  1.0,                0.0,            NO_MINIMUM, NO_MAXIMUM, NO_DASHED, ADJUST_NONE,       soil_tables.moisture},
+    {"Soil temperature 4",     "celsius",      &davis_data_t::soil_temp4,            28,    FIELD_U8,  1.0,                0.0,            NO_MINIMUM, NO_MAXIMUM, NO_DASHED, ADJUST_NONE,       soil_tables.temperature},
+    {"Soil moisture 4",        "centibar",     &davis_data_t::soil_moist4,           65,    FIELD_U8,  1.0,                0.0,            NO_MINIMUM, NO_MAXIMUM, NO_DASHED, ADJUST_NONE,       soil_tables.moisture}
+};
+
+/* The values in a LOOP2 packet that aren't in a LOOP packet. The average wind speeds are in 0.1 mph. The protocol doc
+   says the 10 min gust is in 0.1 mph too, but consoles send it in whole mph. The temperatures derived by the console
+   are signed, in whole degrees Fahrenheit */
+static constexpr field_t loop2_fields[] = {
+    /* name                    unit            member                                offset width      scale               bias            minimum     maximum     dashed     adjust             table */
+    {"10 min avg wind speed",  "m/s",          &davis_data_t::wind_avg_10min,        18,    FIELD_U16, 0.044704,           0.0,            0.0,        50.0,       32767,     ADJUST_WIND_SPEED, NULL},
+    {"2 min avg wind speed",   "m/s",          &davis_data_t::wind_avg_2min,         20,    FIELD_U16, 0.044704,           0.0,            0.0,        50.0,       32767,     ADJUST_WIND_SPEED, NULL},
+    {"10 min wind gust",       "m/s",          &davis_data_t::wind_gust_10min,       22,    FIELD_U16, 0.44704,            0.0,            0.0,        100.0,      255,       ADJUST_WIND_SPEED, NULL},
+    {"10 min wind gust direction", "degrees",  &davis_data_t::wind_gust_direction,   24,    FIELD_U16, 1.0,                0.0,            0.0,        360.0,      NO_DASHED, ADJUST_DIRECTION,  NULL},
+    {"Dew point",              "celsius",      &davis_data_t::dew_point,             30,    FIELD_S16, 5.0/9,              -32.0 * 5/9,    -80.0,      100.0,      255,       ADJUST_NONE,       NULL},
+    {"Heat index",             "celsius",      &davis_data_t::heat_index,            35,    FIELD_S16, 5.0/9,              -32.0 * 5/9,    -80.0,      100.0,      255,       ADJUST_NONE,       NULL},
+    {"Wind chill",             "celsius",      &davis_data_t::wind_chill,            37,    FIELD_S16, 5.0/9,              -32.0 * 5/9,    -80.0,      100.0,      255,       ADJUST_NONE,       NULL},
+    {"THSW index",             "celsius",      &davis_data_t::thsw,                  39,    FIELD_S16, 5.0/9,              -32.0 * 5/9,    -80.0,      100.0,      255,       ADJUST_NONE,       NULL}
+};
+
+static const field_decoder<extent<decltype(loop_fields)>::value> loop_decoder(loop_fields);
+static const field_decoder<extent<decltype(loop2_fields)>::value> loop2_decoder(loop2_fields);
+
+/* The fields decoded from a packet of 'packet_type' (LOOP_TYPE or LOOP2_TYPE), so their values can be checked.
+   Returns the number of fields, or 0 for an unknown type */
+size_t packet_fields(int packet_type, const field_t **fields)
+{
+    if (packet_type == LOOP_TYPE) {
+        *fields = loop_fields;
+        return extent<decltype(loop_fields)>::value;
+    }
+    if (packet_type == LOOP2_TYPE) {
+        *fields = loop2_fields;
+        return extent<decltype(loop2_fields)>::value;
+    }
+    *fields = NULL;
+    return 0;
+}
 
-    /* Send the struct to the write function */
-    return write_result_string(davis_data);
+/* This function decodes a whole LOOP packet into the davis_data struct. Any value that is dashed, or
+   *appears* to be obviously invalid, is replaced with ERROR_VALUE_FLOAT, without invalidating the whole line */
+void decode_loop(const unsigned char *frame, davis_data_t &davis_data, bool debug, bool wdspd_kmh, float barocal, bool winddir_180)
+{
+    loop_decoder.decode(frame, davis_data, debug, wdspd_kmh, barocal, winddir_180);
 }
 
-/* This function writes a string based on the davis_data struct */
-string write_result_string(davis_data_t davis_data)
+/* This function decodes a whole LOOP2 packet into the davis_data struct. Only the members that aren't in a LOOP packet
+   are updated */
+void decode_loop2(const unsigned char *frame, davis_data_t &davis_data, bool debug, bool wdspd_kmh, bool winddir_180)
 {
-    stringstream stream;
-
-    /* Get the current date-time */
-    string datetime = get_current_datetime();
-
-    /* clear the stringstream and make the string to create the CSV entry */
-    stream << datetime;
-    stream << ",";
-    stream << fixed << setprecision(2) << davis_data.inside_temperature;
-    stream << ",";
-    stream << fixed << setprecision(2) << davis_data.outside_temperature;
-    stream << ",";
-    stream << fixed << setprecision(2) << davis_data.inside_humidity;
-    stream << ",";
-    stream << fixed << setprecision(2) << davis_data.outside_humidity;
-    stream << ",";
-    stream << fixed << setprecision(2) << davis_data.wind_speed;
-    stream << ",";
-    stream << fixed << setprecision(2) << davis_data.wind_direction;
-    stream << ",";
-    stream << fixed << setprecision(2) << davis_data.barometer;
-    stream << ",";
-    stream << fixed << setprecision(2) << davis_data.solar_radiation;
-    stream << ",";
-    stream << fixed << setprecision(2) << davis_data.UV;
-    stream << ",";
-    stream << fixed << setprecision(2) << davis_data.rain;
-    stream << ",";
-    stream << fixed << setprecision(2) << davis_data.console_battery;
-    stream << ",";
-    stream << fixed << setprecision(2) << davis_data.soil_temp1;
-    stream << ",";
-    stream << fixed << setprecision(2) << davis_data.soil_moist1;
-    stream << ",";
-    stream << fixed << setprecision(2) << davis_data.soil_temp2;
-    stream << ",";
-    stream << fixed << setprecision(2) << davis_data.soil_moist2;
-    stream << ",";
-    stream << fixed << setprecision(2) << davis_data.soil_temp3;
-    stream << ",";
-    stream << fixed << setprecision(2) << davis_data.soil_moist3;
-    stream << ",";
-    stream << fixed << setprecision(2) << davis_data.soil_temp4;
-    stream << ",";
-    stream << fixed << setprecision(2) << davis_data.soil_moist4;
-    return stream.str();
+    loop2_decoder.decode(frame, davis_data, debug, wdspd_kmh, 1.0, winddir_180);
 }
 
+/* Write 'value' with 2 decimal places, exactly as printf("%.2f") would, and return the end. The value is scaled to a whole
+   number of hundredths, which is exact in a double, and rounded half to even as glibc does. No locale is used */
+static char *format_fixed2(char *out, float value)
+{
+    double scaled = fabs((double) value * 100);
+    if ((not isfinite(value)) or (scaled >= 1e15)) {
+        return out + sprintf(out, "%.2f", value);
+    }
+
+    double whole = floor(scaled);
+    uint64_t hundredths = (uint64_t) whole;
+    if ((scaled - whole > 0.5) or ((scaled - whole == 0.5) and (hundredths & 1))) {
+        hundredths++;
+    }
 
-/* This function will search the USB devices to find the one that corresponds to a Davis weather station */
-string find_usb_device(bool debug)
+    if (signbit(value)) *out++ = '-';
+
+    /* The digits before the point are written backwards, then reversed */
+    uint64_t units = hundredths / 100;
+    char *start = out;
+    do {
+        *out++ = '0' + units % 10;
+        units /= 10;
+    } while (units > 0);
+    reverse(start, out);
+
+    *out++ = '.';
+    *out++ = '0' + (hundredths / 10) % 10;
+    *out++ = '0' + hundredths % 10;
+    return out;
+}
+
+/* Write the current local date-time, with the time zone at the end, into 'buffer'. Returns its length */
+size_t format_current_datetime(char *buffer, size_t size)
 {
-    struct udev *udev;
-    struct udev_enumerate *enumerate;
-    struct udev_list_entry *devices, *dev_list_entry;
-    struct udev_device *dev;
-    const char *vendor_id, *product_id, *serial, *path, *full_syspath, *device_found;
-    bool found = false;
+    time_t rawtime = time(NULL);
+    struct tm timeinfo;
 
-    /* Create the udev object */
-    udev = udev_new();
-    if (!udev) {
-        cout << "Can't create udev data type" << endl;
-        return string();
+    localtime_r(&rawtime, &timeinfo);
+    return strftime(buffer, size, "%Y-%m-%dT%H:%M:%S%z", &timeinfo);
+}
+
+/* This function writes a CSV line (without a newline) based on the davis_data struct into 'buffer', which should be
+   at least LINE_SIZE bytes. If 'loop2' is set, the LOOP2 values are added to the end. If 'datetime' is NULL, the current
+   date-time is used. Nothing is allocated. Returns the length of the line, or 0 if it doesn't fit */
+size_t format_result(char *buffer, size_t size, const davis_data_t &davis_data, bool loop2, const char *datetime)
+{
+    static float davis_data_t::* const columns[] = {
+        &davis_data_t::inside_temperature, &davis_data_t::outside_temperature, &davis_data_t::inside_humidity,
+        &davis_data_t::outside_humidity, &davis_data_t::wind_speed, &davis_data_t::wind_direction, &davis_data_t::barometer,
+        &davis_data_t::solar_radiation, &davis_data_t::UV, &davis_data_t::rain, &davis_data_t::console_battery,
+        &davis_data_t::soil_temp1, &davis_data_t::soil_moist1, &davis_data_t::soil_temp2, &davis_data_t::soil_moist2,
+        &davis_data_t::soil_temp3, &davis_data_t::soil_moist3, &davis_data_t::soil_temp4, &davis_data_t::soil_moist4,
+        /* LOOP2 */
+        &davis_data_t::wind_avg_10min, &davis_data_t::wind_avg_2min, &davis_data_t::wind_gust_10min,
+        &davis_data_t::wind_gust_direction, &davis_data_t::dew_point, &davis_data_t::heat_index,
+        &davis_data_t::wind_chill, &davis_data_t::thsw
+    };
+    size_t count = loop2 ? 27 : 19;
+    size_t length;
+
+    /* Each value is at most a sign, 15 digits, the point and 2 decimals, and the comma before it */
+    if (size < count * 20) {
+        return 0;
+    }
+
+    if (datetime == NULL) {
+        length = format_current_datetime(buffer, size - count * 20);
+    }
+    else {
+        length = strlen(datetime);
+        if (length >= size - count * 20) return 0;
+        memcpy(buffer, datetime, length);
+    }
+
+    char *out = buffer + length;
+    for (size_t i = 0; i < count; i++) {
+        *out++ = ',';
+        out = format_fixed2(out, davis_data.*columns[i]);
+    }
+    *out = '\0';
+
+    return out - buffer;
+}
+
+/* This function returns the CSV line for the davis_data struct, as a string. If 'datetime' is empty, the current
+   date-time is used */
+string write_result_string(const davis_data_t &davis_data, bool loop2, const string &datetime)
+{
+    char buffer[LINE_SIZE];
+    size_t length = format_result(buffer, sizeof(buffer), davis_data, loop2, datetime.empty() ? NULL : datetime.c_str());
+
+    return string(buffer, length);
+}
+
+
+/* Check if a tty device is on a Davis USB adaptor. If so, its /dev device and the adaptor's serial number are put
+   in 'usb_device' */
+bool davis_usb_device(struct udev_device *tty, usb_device_t *usb_device, bool debug)
+{
+    const char *vendor_id, *product_id, *serial, *path;
+
+    /* get the path to the device */
+    path = udev_device_get_devnode(tty);
+    if (!path) {
+        return false;
+    }
+
+    /* Retrieve the USB device information. The parent belongs to 'tty', so it isn't unreferenced */
+    struct udev_device *dev = udev_device_get_parent_with_subsystem_devtype(tty, "usb", "usb_device");
+    if (!dev) {
+        return false;
+    }
+    /* Davis weather station Vendor ID: 10c4 and Product ID: ea61
+       Executing "lsusb" should see the line "...Bus 002 Device 002: ID 10c4:ea61 Cygnal Integrated Products, Inc...." */
+    vendor_id = udev_device_get_sysattr_value(dev, "idVendor");
+    product_id = udev_device_get_sysattr_value(dev, "idProduct");
+    serial = udev_device_get_sysattr_value(dev, "serial");
+    if ((!vendor_id) or (!product_id) or (strcmp(vendor_id, DAVIS_USBSERIAL_VENDOR) != 0) or
+        ((strcmp(product_id, DAVIS_USBSERIAL_PRODUCT) != 0) and (strcmp(product_id, DAVIS_USBSERIAL_PRODUCT2) != 0))) {
+        return false;
     }
 
+    usb_device->devnode = path;
+    usb_device->serial = serial ? serial : "";
+    if (debug) {
+        cout << "Device node: " << path << endl;
+        cout << "\tFull Path: " << udev_device_get_syspath(tty) << endl;
+        cout << "\tVendor ID: " << vendor_id << endl;
+        cout << "\tProduct ID: " << product_id << endl;
+        cout << "\tSerial: " << usb_device->serial << endl;
+    }
+    return true;
+}
+
+/* Search the tty devices for all of those on a Davis USB adaptor, using an existing udev object */
+vector<usb_device_t> scan_usb_devices(struct udev *udev, bool debug)
+{
+    struct udev_enumerate *enumerate;
+    struct udev_list_entry *devices, *dev_list_entry;
+    vector<usb_device_t> found;
+
     /* Create a list of the devices in the 'tty' subsystem. */
     enumerate = udev_enumerate_new(udev);
+    if (!enumerate) {
+        return found;
+    }
     udev_enumerate_add_match_subsystem(enumerate, "tty");
     udev_enumerate_scan_devices(enumerate);
     devices = udev_enumerate_get_list_entry(enumerate);
     /* For loop that iterates through each tty device found */
     udev_list_entry_foreach(dev_list_entry, devices) {
         /* Get the file name of the /sys entry for the device */
-        full_syspath = udev_list_entry_get_name(dev_list_entry);
-        dev = udev_device_new_from_syspath(udev, full_syspath);
-        /* get the path to the device */
-        path = udev_device_get_devnode(dev);
-
-        /* Retrieve the USB device information */
-        dev = udev_device_get_parent_with_subsystem_devtype(dev, "usb", "usb_device");
-        if (!dev) {
-            udev_device_unref(dev);
+        struct udev_device *tty = udev_device_new_from_syspath(udev, udev_list_entry_get_name(dev_list_entry));
+        if (!tty) {
             continue;
         }
-        /* Davis weather station Vendor ID: 10c4 and Product ID: ea61
-           Executing "lsusb" should see the line "...Bus 002 Device 002: ID 10c4:ea61 Cygnal Integrated Products, Inc...." */
-        vendor_id = udev_device_get_sysattr_value(dev, "idVendor");
-        product_id = udev_device_get_sysattr_value(dev, "idProduct");
-        serial = udev_device_get_sysattr_value(dev, "serial");
-        if (((strcmp(vendor_id, DAVIS_USBSERIAL_VENDOR) == 0) and (strcmp(product_id, DAVIS_USBSERIAL_PRODUCT) == 0)) or
-           ((strcmp(vendor_id, DAVIS_USBSERIAL_VENDOR) == 0) and (strcmp(product_id, DAVIS_USBSERIAL_PRODUCT2) == 0))) {
-            if (found) {
-                cout << "Duplicate \"Cygnal Integrated Products\" USB found. Check by running \'lsusb\'. If necessary specify the /dev device manually" << endl;
-                return "";
-            }
-            found = true;
-            device_found = path;
-            if (debug) {
-                cout << "Device node: " << path << endl;
-                cout << "\tFull Path: " << full_syspath << endl;
-                cout << "\tVendor ID: " << vendor_id << endl;
-                cout << "\tProduct ID: " << product_id << endl;
-                cout << "\tSerial: " << serial << endl;
-            }
+        usb_device_t usb_device;
+        if (davis_usb_device(tty, &usb_device, debug)) {
+            found.push_back(usb_device);
         }
-        udev_device_unref(dev);
+        udev_device_unref(tty);
     }
 
     udev_enumerate_unref(enumerate);
+    return found;
+}
+
+/* This function will search the USB devices to find all of those that correspond to a Davis weather station */
+vector<usb_device_t> find_usb_devices(bool debug)
+{
+    vector<usb_device_t> found;
+
+    /* Create the udev object */
+    struct udev *udev = udev_new();
+    if (!udev) {
+        cout << "Can't create udev data type" << endl;
+        return found;
+    }
+
+    found = scan_usb_devices(udev, debug);
     udev_unref(udev);
 
-    string device(device_found, strlen(device_found));
+    return found;
+}
+
+/* This function will search the USB devices to find the one that corresponds to a Davis weather station. If there is
+   more than one, the device must be given on the command line (or use '-t all') */
+string find_usb_device(bool debug)
+{
+    vector<usb_device_t> found = find_usb_devices(debug);
 
-    if (found) {
-        if (debug) cout << "Device found: " << device << endl;
-        return device;
+    if (found.size() > 1) {
+        cout << "Duplicate \"Cygnal Integrated Products\" USB found. Check by running \'lsusb\'. If necessary specify the /dev device manually, or use '-t all'" << endl;
+        return string();
     }
-    else {
+    if (found.empty()) {
         cout << "Davis weather station USB Serial device not found. Check by running \'lsusb\'. If necessary specify the /dev device manually" << endl;
         return string();
     }
+
+    if (debug) cout << "Device found: " << found[0].devnode << endl;
+    return found[0].devnode;
 }
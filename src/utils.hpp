@@ -18,6 +18,7 @@
 #define UTILS_HPP_INCLUDED
 
 #include <string>
+#include <vector>
 #include <stdlib.h>
 #include <iostream>
 #include <sys/stat.h>
@@ -32,20 +33,37 @@
 #include <fstream>
 #include <sstream>
 #include <iomanip>
+#include <stdint.h>
+#include <math.h>
 
 extern int g_debug;
 
 using namespace std;
 
-int log_line(string directory, string filename, string line, string header, bool log_to_latest);
-string get_current_date();
-string get_current_datetime();
-string extract_results(char *input_buffer, int chars_received, bool debug, bool wdspd_kmh, float barocal, bool winddir_180);
-string write_result_string(davis_data_t davis_data);
+struct field_t;
+
+/* A Davis USB serial adaptor found by udev */
+typedef struct usb_device_s {
+    string devnode;
+    string serial;
+} usb_device_t;
+
+int extract_results(const unsigned char *packet, davis_data_t *davis_data, bool debug, bool wdspd_kmh, float barocal, bool winddir_180);
+void decode_loop(const unsigned char *frame, davis_data_t &davis_data, bool debug, bool wdspd_kmh, float barocal, bool winddir_180);
+void decode_loop2(const unsigned char *frame, davis_data_t &davis_data, bool debug, bool wdspd_kmh, bool winddir_180);
+void clear_davis_data(davis_data_t *davis_data);
+string write_result_string(const davis_data_t &davis_data, bool loop2 = false, const string &datetime = "");
+size_t format_result(char *buffer, size_t size, const davis_data_t &davis_data, bool loop2, const char *datetime);
+size_t format_current_datetime(char *buffer, size_t size);
+string header_line(bool wdspd_kmh, bool loop2);
+size_t packet_fields(int packet_type, const field_t **fields);
+bool davis_usb_device(struct udev_device *tty, usb_device_t *usb_device, bool debug);
+vector<usb_device_t> scan_usb_devices(struct udev *udev, bool debug);
+vector<usb_device_t> find_usb_devices(bool debug);
 string find_usb_device(bool debug);
 bool create_directory(string directory);
-bool check_pid_file();
-void remove_pid_file();
+bool check_pid_file(string pid_file);
+void remove_pid_file(string pid_file);
 bool check_root();
 bool check_directory(string directory);
 bool check_file(string file);